@@ -1,5 +1,17 @@
 #include "yaml-path/yaml-accumulate.h"
 #include "yaml-path/yaml-path.h"
+#include "yaml-path/yaml-columns.h"
+#include "yaml-path/yaml-pool.h"
+#include "yaml-path/yaml-explain.h"
+#include "yaml-path/yaml-metrics.h"
+#include "yaml-path/yaml-stream.h"
+#include "yaml-path/yaml-frozen.h"
+#include "yaml-path/yaml-cache.h"
+#include "yaml-path/yaml-watch.h"
+#include "yaml-path/yaml-resume.h"
+#include "yaml-path/yaml-index.h"
+#include "yaml-path/yaml-ordered.h"
+#include "yaml-path/yaml-bind.h"
 
 #define DOCTEST_CONFIG_IMPLEMENT
 #include <doctest/doctest.h>
@@ -9,6 +21,40 @@
 #include <yaml-path/yaml-path-internals.h>
 #include <iostream>
 #include <assert.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+
+// ---- allocation counting: replaces the global operator new, see AllocCount
+namespace AllocCount
+{
+   thread_local size_t count = 0;      ///< number of calls to operator new on this thread
+
+   /// returns the number of heap allocations made by \c f on the calling thread
+   template <typename TFunc>
+   size_t Of(TFunc f)
+   {
+      size_t before = count;
+      f();
+      return count - before;
+   }
+}
+
+void * operator new(size_t size)
+{
+   ++AllocCount::count;
+   if (void * p = malloc(size ? size : 1))
+      return p;
+   throw std::bad_alloc();
+}
+
+void operator delete(void * p) noexcept { free(p); }
+void operator delete(void * p, size_t) noexcept { free(p); }
 
 struct YamlNodeForDocTest
 {
@@ -391,6 +437,13 @@ TEST_CASE("PathValidate")
    CHECK(PathValidate(".a.b") == EPathError::InvalidToken);
    CHECK(PathValidate("].a.b") == EPathError::InvalidToken);
    CHECK(PathValidate("a.") == EPathError::UnexpectedEnd);
+
+   std::string valid = "x";
+   size_t errorOffs = 0;
+   CHECK(PathValidate("a.b", &valid, &errorOffs) == EPathError::OK);
+   CHECK(valid == "");
+   CHECK(PathValidate("a.b.[x", &valid, &errorOffs) == EPathError::InvalidIndex);
+   CHECK(valid == "a.b");
 }
 
 YAML::Node CheckPathResolve(YAML::Node node, YAML::PathArg path, std::string expectedRemainder)
@@ -638,6 +691,130 @@ TEST_CASE("Accumulate with custom op")
    CHECK(result == 120);
 }
 
+TEST_CASE("ExtractColumns")
+{
+   auto root = Load(R"(
+pods:
+   - { name: web, cpu: 0.5, mem: 128, labels: { tier: front } }
+   - { name: db, cpu: 2, mem: many }
+   - just a scalar
+   - { mem: 64, name: cache, cpu: .inf, labels: { tier: back } }
+)");
+
+   auto cols = ExtractColumns(root, "pods", { "name", { "cpu", EColumnType::Number }, { "mem", EColumnType::Number }, "labels.tier" });
+   CHECK(cols.rows == 4);
+   REQUIRE(cols.columns.size() == 4);
+
+   CHECK(cols[0].type == EColumnType::Text);
+   CHECK(cols[0].text.size() == 4);
+   CHECK(cols[0].text[0] == "web");
+   CHECK(cols[0].text[1] == "db");
+   CHECK(!cols[0].IsValid(2));
+   CHECK(cols[0].text[3] == "cache");
+   CHECK(cols[0].ValidCount() == 3);
+
+   CHECK(cols[1].number.size() == 4);
+   CHECK(cols[1].number[0] == 0.5);
+   CHECK(cols[1].number[1] == 2);
+   CHECK(cols[1].number[3] > 1e300);
+
+   CHECK(cols[2].IsValid(0));
+   CHECK(!cols[2].IsValid(1));      // "many" is not a number
+   CHECK(cols[2].number[3] == 64);
+
+   CHECK(cols[3].text[0] == "front");
+   CHECK(!cols[3].IsValid(1));
+   CHECK(cols[3].text[3] == "back");
+
+   // string views refer to the document
+   CHECK(cols[0].text[0].data() == Select(root, "pods[0].name").Scalar().data());
+
+   // single map, no match, filter as row path
+   CHECK(ExtractColumns(root, "pods[0]", { "name" }).rows == 1);
+   CHECK(ExtractColumns(root, "nope", { "name" }).rows == 0);
+   CHECK(ExtractColumns(root, "pods.{labels=}", { "name" })[0].text[1] == "cache");
+   CHECK_THROWS_AS(ExtractColumns(root, "pods", { "a..b" }), PathException);
+}
+namespace
+{
+   /// document with \c count elements in a sequence "pods", used by concurrency tests and benchmarks
+   YAML::Node MakePods(size_t count)
+   {
+      std::stringstream s;
+      s << "pods:\n";
+      for (size_t i = 0; i < count; ++i)
+         s << "  - { name: pod" << i << ", node: n" << (i % 7) << ", cpu: " << (i % 10) << ", phase: " << (i % 3 ? "Running" : "Pending") << " }\n";
+      return Load(s.str());
+   }
+}
+
+TEST_CASE("SelectNodes")
+{
+   auto root = Load("{ a : { b : 1, c : 2 }, s : [ { k : 1 }, { k : 2 }, x, { l : 3 } ] }");
+
+   CHECK(SelectNodes(root, "a.b").size() == 1);
+   CHECK(SelectNodes(root, "a.b")[0].as<std::string>() == "1");
+   CHECK(SelectNodes(root, "a")[0].is(root["a"]));    // refers to the document
+   CHECK(SelectNodes(root, "s.k").size() == 2);
+   CHECK(SelectNodes(root, "s.k")[1].as<std::string>() == "2");
+   CHECK(SelectNodes(root, "s.k[1]").size() == 1);
+   CHECK(SelectNodes(root, "s.{k=2}").size() == 1);
+   CHECK(SelectNodes(root, "a.{b}")[0].size() == 1);
+   CHECK(SelectNodes(root, "a.x").empty());
+   CHECK(SelectNodes(root, "s[9]").empty());
+   CHECK_THROWS_AS(SelectNodes(root, "a..b"), PathException);
+
+   std::string before = (YAML::Emitter() << root).c_str();
+   for (int i = 0; i < 3; ++i)
+   {
+      SelectNodes(root, "a.x");
+      SelectNodes(root, "s.nope");
+      SelectNodes(root, "s.{nope=1}");
+      SelectNodes(root, "s.k");
+   }
+   CHECK(before == (YAML::Emitter() << root).c_str());
+}
+
+TEST_CASE("Select - undefined node is not shared")
+{
+   auto root = Load("{ a : 1 }");
+   Node miss = Select(root, "x");
+   CHECK(!miss);
+   miss = "assigned";      // must not affect the result of later calls
+   CHECK(!Select(root, "y"));
+}
+
+TEST_CASE("SelectNodes - concurrent readers")
+{
+   const size_t podCount = 500;
+   auto root = MakePods(podCount);
+   std::string before = (YAML::Emitter() << root).c_str();
+
+   std::atomic<size_t> failures = 0;
+   std::vector<std::thread> threads;
+   for (size_t t = 0; t < 8; ++t)
+   {
+      threads.emplace_back([&, t]
+      {
+         for (size_t i = 0; i < 200; ++i)
+         {
+            size_t idx = (i * 31 + t) % podCount;
+            auto name = SelectNodes(root, "pods[%].name", { idx });
+            if (name.size() != 1 || name[0].Scalar() != "pod" + std::to_string(idx))
+               ++failures;
+            if (SelectNodes(root, "pods.{phase=Pending}").size() != (podCount + 2) / 3)
+               ++failures;
+            if (!SelectNodes(root, "pods[%].nope", { idx }).empty() || !SelectNodes(root, "pods[%]", { podCount + i }).empty())
+               ++failures;
+         }
+      });
+   }
+   for (auto & t : threads)
+      t.join();
+
+   CHECK(failures == 0);
+   CHECK(before == (YAML::Emitter() << root).c_str());
+}
 
 
 void CheckCreate(char const * path, char const * expectedNode)
@@ -649,6 +826,1333 @@ void CheckCreate(char const * path, char const * expectedNode)
 }
 
 
+TEST_CASE("PoolStats / Compact")
+{
+   auto root = Load("{ a : { b : 1, c : [ x, y ] }, d : &anchor text, e : *anchor }");
+   auto stats = PoolStats(root);
+   CHECK(stats.reachableNodes == 12);        // the value of 'e' is the same node as the value of 'd'
+   CHECK(stats.poolNodes == 12);
+   CHECK(stats.reachableBytes > 0);
+   CHECK(stats.poolBytes >= stats.reachableBytes);
+
+   // non-const lookups of keys that don't exist leave nodes in the pool
+   for (int i = 0; i < 100; ++i)
+      root["a"]["nope" + std::to_string(i)];
+   auto grown = PoolStats(root);
+   CHECK(grown.reachableNodes == 12);
+#if YAML_PATH_POOL_INTERNALS
+   CHECK(grown.poolNodes >= stats.poolNodes + 100);
+#endif
+
+   std::string before = Dump(root);
+   size_t reclaimed = Compact(root);
+#if YAML_PATH_POOL_INTERNALS
+   CHECK(reclaimed > 0);
+#endif
+   CHECK(Dump(root) == before);
+
+   auto compact = PoolStats(root);
+   CHECK(compact.poolNodes == compact.reachableNodes);
+   CHECK(compact.reachableNodes == 12);
+   CHECK(Select(root, "e").Scalar() == "text");
+
+   Node undef;
+   CHECK(Compact(undef) == 0);
+   CHECK(PoolStats(Node(NodeType::Undefined)).reachableNodes == 0);
+}
+
+TEST_CASE("TrySelect / TryRequire")
+{
+   auto root = Load("{ a : { b : 1 }, s : [ x, y ] }");
+
+   auto r = TrySelect(root, "a.b");
+   REQUIRE(r);
+   CHECK(r.Error() == EPathError::OK);
+   CHECK(r->Scalar() == "1");
+   CHECK(TryRequire(root, "s[%]", { size_t(1) }).Value().Scalar() == "y");
+
+   // no match: TrySelect succeeds with an undefined node like Select returns, TryRequire fails
+   auto sel = TrySelect(root, "a.c");
+   CHECK(sel);
+   CHECK(!sel.Value());
+   CHECK(sel.Value().Type() == Select(root, "a.c").Type());
+   CHECK(!sel->IsNull());
+   CHECK(sel.Value().as<std::string>("default") == "default");
+   CHECK(sel.Error() == EPathError::NodeNotFound);
+
+   auto req = TryRequire(root, "a.c");
+   CHECK(!req);
+   CHECK(!*req);
+   CHECK(req.Error() == EPathError::NodeNotFound);
+   CHECK(req.Info().resolvedLength == 1);
+   CHECK(req.Exception().ResolvedPath() == "a");
+   CHECK_THROWS_AS(Require(root, "a.c"), PathException);
+
+   // malformed path: both fail, diagnostics match the exception thrown by Select
+   std::string path = "a.[x";
+   auto bad = TrySelect(root, path);
+   CHECK(!bad);
+   CHECK(bad.Error() == EPathError::InvalidIndex);
+   try
+   {
+      Select(root, path);
+      CHECK(false);
+   }
+   catch (PathException const & x)
+   {
+      CHECK(x.Error() == bad.Error());
+      CHECK(x.ErrorOffset() == bad.Info().errorOffset);
+      CHECK(std::string(x.what()) == bad.What());
+   }
+   CHECK(!TryRequire(root, "%", {}));
+}
+
+TEST_CASE("EnsureMany / EnsureExists")
+{
+   // EnsureMany must build the same document as repeated calls to Ensure
+   std::vector<std::string> paths =
+   {
+      "a.b", "a.bc", "a.b.c", "a.b.d", "l.[1].x", "a.b.d", "s", "s.[0]", "s[2].k", "{m=1, n}.o", "a.'b.c'", "a.b.c.e",
+   };
+
+   Node expected = Load("{ s : [ { z : 1 }, [ 1 ], ~ ] }");
+   for (auto & p : paths)
+      Ensure(expected, p);
+
+   Node root = Load("{ s : [ { z : 1 }, [ 1 ], ~ ] }");
+   EnsureMany(root, paths);
+   CHECK(T(root) == T(expected));
+
+   Node single = Load("{ s : [ { z : 1 }, [ 1 ], ~ ] }");
+   for (auto & p : paths)
+      EnsureExists(single, p);
+   CHECK(T(single) == T(expected));
+
+   // existing keys are found, and not added again
+   Node doc = Load("{ a : { b : 1 } }");
+   EnsureMany(doc, { "a.b", "a.c", "a.b" });
+   CHECK(T(doc) == T(Load("{ a : { b : 1, c : ~ } }")));
+
+   // bound arguments, and errors report offsets into the full path
+   EnsureBatch batch(doc);
+   batch.Ensure("a.%.x", { "d" });
+   batch.Ensure("a.%.y", { "d" });
+   CHECK(Select(doc, "a.d.y").IsNull());
+   batch.Ensure("a.c.z");
+   try
+   {
+      batch.Ensure("a.c.[x");
+      CHECK(false);
+   }
+   catch (PathException const & x)
+   {
+      CHECK(x.IsPathError());
+      CHECK(x.ErrorOffset() == 6);
+      CHECK(x.ResolvedPath() == "a.c");
+      CHECK(x.FullPath() == "a.c.[x");
+   }
+   CHECK_THROWS_AS(EnsureExists(doc, "a.b.c"), PathException);    // can't add a key to a scalar
+}
+
+TEST_CASE("Select - allocation budget")
+{
+   // steady-state Select on key / index paths must not allocate, and must not add nodes to the document
+   auto root = MakePods(100);
+   root["meta"] = Load("{ name : list, labels : { app : web, tier : front } }");
+
+   struct Shape { char const * path; size_t budget; };
+   Shape shapes[] =
+   {
+      { "meta", 0 },
+      { "meta.labels.tier", 0 },
+      { "pods[42]", 0 },
+      { "pods[42].name", 0 },
+      { "pods.[42].'cpu'", 0 },
+      { "meta.labels.{tier=front}", 0 },
+      { "pods[%].name", 0 },
+   };
+
+   auto poolNodes = PoolStats(root).poolNodes;
+   for (auto & shape : shapes)
+   {
+      Select(root, shape.path, { size_t(7) });      // warm up
+      INFO(shape.path);
+      CHECK(AllocCount::Of([&] { Select(root, shape.path, { size_t(7) }); }) <= shape.budget);
+      CHECK(AllocCount::Of([&] { TrySelect(root, shape.path, { size_t(7) }); }) <= shape.budget);
+   }
+
+   Select(root, "meta.%", { "name" });    // warm up (with YAML_PATH_METRICS, the first evaluation of each path allocates)
+   for (char const * path : { "meta.nope", "pods[1000]", "meta.[x" })
+      TrySelect(root, path);
+   CHECK(AllocCount::Of([&] { Select(root, "meta.%", { "name" }); }) == 0);
+   CHECK(AllocCount::Of([&] { TryRequire(root, "meta.nope"); }) == 0);
+   CHECK(AllocCount::Of([&] { Select(root, "meta.nope"); }) <= 12);    // Select and TrySelect return a new undefined node on a miss
+   CHECK(AllocCount::Of([&] { TrySelect(root, "meta.nope"); }) <= 12);
+   CHECK(AllocCount::Of([&] { TryRequire(root, "pods[1000]"); }) == 0);
+   CHECK(AllocCount::Of([&] { TrySelect(root, "meta.[x"); }) == 0);
+   CHECK(PoolStats(root).poolNodes == poolNodes);
+
+   // selecting keys with a map filter creates a new map, fan-out creates a new sequence.
+   // Both are created in the memory of the document, so the cost does not depend on the size of the document
+   CHECK(AllocCount::Of([&] { Select(root, "meta.labels.{tier=front,app}"); }) <= 20);
+   CHECK(AllocCount::Of([&] { Select(root, "pods.name"); }) <= 30);          // 100 elements, sequence grows by doubling
+   CHECK(AllocCount::Of([&] { SelectNodes(root, "pods.name"); }) <= 10);     // result list grows by doubling
+}
+
+TEST_CASE("PathExplain")
+{
+   using YamlPathDetail::ESelector;
+   auto root = MakePods(20);
+   SetPathAllocationCounter([] { return AllocCount::count; });
+
+   auto report = PathExplain(root, "pods.{pha*=Pending}.name");
+   CHECK(report.error == EPathError::OK);
+   CHECK(report.allocationsCounted);
+   REQUIRE(report.steps.size() == 3);
+
+   auto & key = report.steps[0];
+   CHECK(key.selector == ESelector::Key);
+   CHECK(key.text == "pods");
+   CHECK(key.nodesIn == 1);
+   CHECK(key.nodesVisited == 1);
+   CHECK(key.mapsScanned == 0);
+   CHECK(key.nodesEmitted == 1);
+   CHECK(key.allocations == 0);
+
+   auto & filter = report.steps[1];
+   CHECK(filter.selector == ESelector::MapFilter);
+   CHECK(filter.text == "{pha*=Pending}");
+   CHECK(filter.nodesVisited == 21);      // the sequence, and its elements
+   CHECK(filter.mapsScanned == 20);       // starry key is matched by scanning
+   CHECK(filter.nodesEmitted == 7);
+
+   auto & name = report.steps[2];
+   CHECK(name.nodesIn == 7);
+   CHECK(name.nodesEmitted == 7);
+   CHECK(report.nanoseconds >= key.nanoseconds + filter.nanoseconds + name.nanoseconds);
+
+   auto text = report.Text();
+   CHECK(text.find("map filter") != std::string::npos);
+   CHECK(text.find("{pha*=Pending}") != std::string::npos);
+
+   // errors are recorded, not thrown
+   auto bad = PathExplain(root, "pods[1].nope");
+   CHECK(bad.error == EPathError::NodeNotFound);
+   REQUIRE(bad.steps.size() == 3);
+   CHECK(bad.steps[2].error == EPathError::NodeNotFound);
+   CHECK(bad.steps[2].nodesEmitted == 0);
+
+   auto malformed = PathExplain(root, "pods.[x");
+   CHECK(malformed.error == EPathError::InvalidIndex);
+   CHECK(malformed.steps.back().selector == ESelector::Invalid);
+   CHECK(malformed.Text().find("invalid index") != std::string::npos);
+
+   SetPathAllocationCounter(nullptr);
+   CHECK(!PathExplain(root, "pods").allocationsCounted);
+
+   // explaining a path does not create nodes in the document
+   auto poolNodes = PoolStats(root).poolNodes;
+   CHECK(PathExplain(root, "pods.{name,phase}").steps.back().nodesEmitted == 20);
+   CHECK(PoolStats(root).poolNodes == poolNodes);
+}
+
+#if YAML_PATH_METRICS
+TEST_CASE("PathMetrics")
+{
+   auto root = MakePods(20);
+   ResetPathMetrics();
+
+   for (int i = 0; i < 10; ++i)
+      Select(root, "pods[3].name");
+   Select(root, "pods.name");
+   Select(root, "pods[100]");
+   CHECK_THROWS_AS(Require(root, "pods[100]"), PathException);
+   CHECK_THROWS_AS(Select(root, "pods.[x"), PathException);
+   CHECK(!TryRequire(root, "nope"));
+   CHECK(SelectNodes(root, "pods.{phase=Pending}").size() == 7);
+   Node doc;
+   Ensure(doc, "a.b.c");
+
+   std::thread([&] { Select(root, "pods[1]"); }).join();    // metrics of ended threads are kept
+
+   auto m = GetPathMetrics();
+   CHECK(m.enabled);
+   auto & sel = m[EPathOp::Select];
+   CHECK(sel.calls == 14);
+   CHECK(sel.resultNodes == 10 + 20 + 1);
+   CHECK(sel.nodesVisited >= 10 * 3 + 21);
+   CHECK(sel.errors.at(EPathError::NodeNotFound) == 1);
+   CHECK(sel.errors.at(EPathError::InvalidIndex) == 1);
+   CHECK(m[EPathOp::Require].calls == 2);     // including TryRequire
+   CHECK(m[EPathOp::Require].errors.at(EPathError::NodeNotFound) == 2);
+   CHECK(m[EPathOp::SelectNodes].resultNodes == 7);
+   CHECK(m[EPathOp::Ensure].calls == 1);
+   CHECK(m[EPathOp::Ensure].errors.empty());
+   CHECK(m[EPathOp::PathResolve].calls == 0);
+
+   // latency is recorded by canonical path, indices and values written inline are replaced by '%'
+   REQUIRE(m.latency.count("pods[%].name"));
+   auto & hist = m.latency["pods[%].name"];
+   CHECK(hist.count == 10);
+   CHECK(hist.Percentile(0.5) <= hist.Percentile(0.99));
+   CHECK(hist.Percentile(1) == hist.maxNanoseconds);
+   CHECK(m.latency["pods[%]"].count == 3);
+   CHECK(m.latency.count("pods.{phase=%}"));
+
+   ResetPathMetrics();
+   for (int i = 0; i < 20; ++i)
+      SelectNodes(root, "pods.{ name = 'pod" + std::to_string(i) + "', cpu>" + std::to_string(i % 5) + " }.phase");
+   Select(root, "pods.[ % ].name", { size_t(2) });
+   m = GetPathMetrics();
+   CHECK(m.latency.size() == 2);
+   CHECK(m.latency["pods.{name=%,cpu>%}.phase"].count == 20);
+   CHECK(m.latency["pods.[%].name"].count == 1);
+
+   // slow query log: node threshold
+   std::vector<std::string> slow;
+   SetPathSlowQueryHandler([&](PathSlowQuery const & q) { slow.push_back(std::string(q.path)); }, UINT64_MAX, 15);
+   Select(root, "pods[3].name");
+   Select(root, "pods.name");
+   CHECK_THROWS_AS(Require(root, "pods.nope"), PathException);
+   REQUIRE(slow.size() == 2);
+   CHECK(slow[0] == "pods.name");
+   CHECK(slow[1] == "pods.nope");
+
+   // time threshold
+   slow.clear();
+   SetPathSlowQueryHandler([&](PathSlowQuery const & q) { slow.push_back(std::string(q.path)); CHECK(q.op == EPathOp::Select); }, 0);
+   Select(root, "pods[3].name");
+   CHECK(slow.size() == 1);
+
+   SetPathSlowQueryHandler(nullptr, 0);
+   Select(root, "pods[3].name");
+   CHECK(slow.size() == 1);
+
+   // limits don't change the nodes visited
+   ResetPathMetrics();
+   SelectNodes(root, "pods.{phase=Pending}.name");
+   auto unlimited = GetPathMetrics()[EPathOp::SelectNodes].nodesVisited;
+   CHECK(unlimited >= 20 + 7);
+   ResetPathMetrics();
+   SelectNodes(root, "pods.{phase=Pending}.name", {}, PathLimits());
+   CHECK(GetPathMetrics()[EPathOp::SelectNodes].nodesVisited == unlimited);
+
+   ResetPathMetrics();
+   CHECK(GetPathMetrics()[EPathOp::Select].calls == 0);
+   CHECK(GetPathMetrics().latency.empty());
+}
+#else
+TEST_CASE("PathMetrics - disabled")
+{
+   Select(MakePods(2), "pods[1].name");
+   auto m = GetPathMetrics();
+   CHECK(!m.enabled);
+   CHECK(m[EPathOp::Select].calls == 0);
+   CHECK(m.latency.empty());
+}
+#endif
+
+TEST_CASE("CompiledPath")
+{
+   auto root = MakePods(20);
+   CompiledPath names("pods.{phase=Pending}.name");
+   CHECK(names.Path() == "pods.{phase=Pending}.name");
+
+   auto nodes = SelectNodes(root, names);
+   REQUIRE(nodes.size() == 7);
+   CHECK(nodes == SelectNodes(root, "pods.{phase=Pending}.name"));
+   CHECK(Select(root, names).size() == 7);
+
+   CompiledPath copy = names;    // copies share the selectors
+   CHECK(SelectNodes(root, copy).size() == 7);
+   CHECK(Select(root, CompiledPath("pods[3].name")).Scalar() == Select(root, "pods[3].name").Scalar());
+
+   CHECK(SelectNodes(root, CompiledPath("pods[100]")).empty());
+   CHECK(!Select(root, CompiledPath("pods.nope")));
+   CHECK_THROWS_AS(CompiledPath("pods.[x"), PathException);
+}
+
+TEST_CASE("SelectEachDocument")
+{
+   char const * text =
+      "level: info\nmessage: started\n"
+      "---\nlevel: error\nmessage: disk full\n"
+      "---\n"
+      "---\n[ { level: error, message: a }, { level: info, message: b }, { level: error, message: c } ]\n"
+      "---\nbase: &b { level: error, message: aliased }\nentries: [ *b, *b ]\n"
+      "---\n!tagged { level: error, message: 'quoted: yes' }\n";
+
+   // documents are built like Load does
+   {
+      std::istringstream in(text);
+      auto expected = LoadAll(text);
+      size_t count = ForEachDocument(in, [&](size_t index, Node const & doc)
+      {
+         REQUIRE(index < expected.size());
+         CHECK(Dump(doc) == Dump(expected[index]));
+         CHECK(doc.Tag() == expected[index].Tag());
+         CHECK(doc.Mark().line == expected[index].Mark().line);
+         CHECK(doc.Mark().column == expected[index].Mark().column);
+      });
+      CHECK(count == expected.size());
+      CHECK(count == 6);
+   }
+
+   // each document is built in a new pool, so the pool does not grow with the number of documents
+   {
+      std::string same;
+      for (int i = 0; i < 5; ++i)
+         same += "---\n{ a: 1, b: [ x, y ], c: { d: e } }\n";
+      std::istringstream in(same);
+      std::vector<Node> docs;
+      ForEachDocument(in, [&](size_t, Node const & doc)
+      {
+         auto stats = PoolStats(doc);
+         CHECK(stats.reachableNodes == 11);
+#if YAML_PATH_POOL_INTERNALS
+         CHECK(stats.poolNodes == stats.reachableNodes);
+#endif
+         for (auto & prev : docs)
+            CHECK(YamlPathDetail::NodeAccess::Memory(prev) != YamlPathDetail::NodeAccess::Memory(doc));
+         docs.push_back(doc);
+      });
+      CHECK(docs.size() == 5);
+   }
+
+   std::vector<std::pair<size_t, std::string>> found;
+   auto Collect = [&](size_t doc, std::vector<Node> const & matches)
+   {
+      for (auto & m : matches)
+         found.emplace_back(doc, m.Scalar());
+   };
+
+   std::istringstream in(text);
+   CHECK(SelectEachDocument(in, "{level=error}.message", Collect) == 6);
+   using Match = std::pair<size_t, std::string>;
+   CHECK(found == std::vector<Match>{ { 1, "disk full" }, { 3, "a" }, { 3, "c" }, { 5, "quoted: yes" } });
+
+   // matches keep their position in the stream, like nodes from Load
+   {
+      std::istringstream in(text);
+      auto expected = LoadAll(text);
+      std::vector<Mark> marks;
+      SelectEachDocument(in, "{level=error}.message", [&](size_t doc, std::vector<Node> const & matches)
+      {
+         if (doc == 1)
+            for (auto & m : matches)
+               marks.push_back(m.Mark());
+      });
+      REQUIRE(marks.size() == 1);
+      CHECK(marks[0].line == expected[1]["message"].Mark().line);
+      CHECK(marks[0].column == expected[1]["message"].Mark().column);
+      CHECK(marks[0].line == 4);
+      CHECK(marks[0].column == 9);
+   }
+
+   // aliases refer to the same node
+   found.clear();
+   std::istringstream in2(text);
+   SelectEachDocument(in2, CompiledPath("entries.message"), Collect);
+   CHECK(found == std::vector<Match>{ { 4, "aliased" }, { 4, "aliased" } });
+
+   std::istringstream empty("");
+   CHECK(SelectEachDocument(empty, "a", Collect) == 0);
+
+   std::istringstream bad("a: [ 1, 2\n---\nb: 1\n");
+   CHECK_THROWS_AS(SelectEachDocument(bad, "a", Collect), ParserException);
+}
+
+TEST_CASE("SelectBatch")
+{
+   std::vector<std::string> texts;
+   for (size_t i = 0; i < 30; ++i)
+      texts.push_back("name: s" + std::to_string(i) + "\nsize: " + std::to_string(i) + "\n---\nname: t" + std::to_string(i) + "\n");
+   texts[7] = "name: [ unterminated\n";
+
+   std::vector<BatchSource> sources;
+   for (size_t i = 0; i < texts.size(); ++i)
+      sources.push_back(BatchSource::Buffer("buffer" + std::to_string(i), texts[i]));
+
+   char const * fileName = "yaml-path-batch-test.yaml";
+   std::ofstream(fileName) << "name: file\nsize: 99\n";
+   sources.push_back(BatchSource::File(fileName));
+   sources.push_back(BatchSource::File("no-such-file.yaml"));
+
+   std::vector<CompiledPath> paths = { CompiledPath("name"), CompiledPath("size") };
+
+   auto Run = [&](BatchOptions options)
+   {
+      std::vector<std::string> lines;
+      SelectBatch(sources, paths, [&](BatchSourceResult & r)
+      {
+         std::string line = std::to_string(r.source) + ":" + std::to_string(r.documents);
+         for (auto & m : r.matches)
+            line += " " + std::to_string(m.document) + "/" + std::to_string(m.path) + "=" + m.nodes[0].Scalar();
+         if (!r.error.empty())
+            line += " error";
+         lines.push_back(line);
+      }, options);
+      return lines;
+   };
+
+   auto ordered = Run({ 1, true });
+   REQUIRE(ordered.size() == sources.size());
+   CHECK(ordered[0] == "0:2 0/0=s0 0/1=0 1/0=t0");
+   CHECK(ordered[7] == "7:0 error");
+   CHECK(ordered[30] == "30:1 0/0=file 0/1=99");
+   CHECK(ordered[31] == "31:0 error");
+
+   CHECK(Run({ 4, true }) == ordered);    // deterministic, independent of the number of threads
+
+   auto unordered = Run({ 4, false });
+   std::sort(unordered.begin(), unordered.end());
+   auto sorted = ordered;
+   std::sort(sorted.begin(), sorted.end());
+   CHECK(unordered == sorted);
+
+   // each document is built in its own pool: matches from different sources and documents don't share memory
+   {
+      std::map<YAML::detail::memory_holder const *, std::pair<size_t, size_t>> pools;    // pool -> source, document
+      std::vector<Node> kept;
+      SelectBatch(sources, paths, [&](BatchSourceResult & r)
+      {
+         for (auto & m : r.matches)
+         {
+            auto pool = YamlPathDetail::NodeAccess::Memory(m.nodes[0]);
+            auto doc = std::make_pair(r.source, m.document);
+            CHECK(pools.emplace(pool, doc).first->second == doc);
+            kept.push_back(m.nodes[0]);    // keeps the pool alive, so its address is not reused
+         }
+      }, { 4, false });
+      CHECK(pools.size() == 2 * 29 + 1);   // two documents in 29 buffers, one in the file
+   }
+
+   // an exception from the handler stops the batch
+   size_t calls = 0;
+   CHECK_THROWS_AS(SelectBatch(sources, paths, [&](BatchSourceResult &) { if (++calls == 3) throw std::runtime_error("stop"); }, { 3 }), std::runtime_error);
+   CHECK(calls == 3);
+
+   SelectBatch({}, paths, [&](BatchSourceResult &) { ++calls; });
+   CHECK(calls == 3);
+
+   std::remove(fileName);
+}
+
+TEST_CASE("FrozenDocument")
+{
+   auto root = MakePods(20);
+   root["meta"] = Load("{ k0: 0, k1: 1, k2: 2, k3: 3, k4: 4, k5: 5, k6: 6, k7: 7, k8: 8, k9: 9, '': empty, [x]: seqkey, k5: dup }");
+   root["shared"] = Load("base: &b { name: base, phase: Pending }\nlist: [ *b, *b, ~, scalar ]");
+
+   FrozenDocument frozen(root);
+   CHECK(frozen.Root().IsMap());
+   CHECK(frozen.Root()["meta"].size() == 13);
+   CHECK(frozen.Root()["meta"]["k9"].Scalar() == "9");
+   CHECK(frozen.Root()["meta"][""].Scalar() == "empty");
+   CHECK(frozen.Root()["meta"]["k5"].Scalar() == "5");         // first of duplicate keys, like FindKey
+   CHECK(!frozen.Root()["meta"]["nope"]);
+   CHECK(!frozen.Root()["pods"][20]);
+
+   auto list = frozen.Root()["shared"]["list"];
+   CHECK(list[0] == list[1]);      // aliases are stored once
+   CHECK(list[2].IsNull());
+
+   std::function<std::string(Node const &)> Text = [&](Node const & n) -> std::string    // ignores styles
+   {
+      std::string result;
+      if (n.IsScalar())
+         return n.Scalar();
+      if (n.IsSequence())
+      {
+         for (auto && el : n)
+            result += Text(el) + ",";
+         return "[" + result + "]";
+      }
+      if (n.IsMap())
+      {
+         for (auto && kv : n)
+            result += Text(kv.first) + ":" + Text(kv.second) + ",";
+         return "{" + result + "}";
+      }
+      return "~";
+   };
+
+   auto Dumps = [&](auto const & nodes)
+   {
+      std::vector<std::string> result;
+      for (auto & n : nodes)
+      {
+         if constexpr (std::is_same_v<std::decay_t<decltype(n)>, FrozenNode>)
+            result.push_back(Text(n.ToNode()));
+         else
+            result.push_back(Text(n));
+      }
+      return result;
+   };
+
+   for (char const * path : {
+      "", "pods", "pods[3]", "pods[3].name", "pods.name", "pods.name[4]", "pods.[3]", "pods[20]", "pods.{phase=Pending}.name",
+      "pods.{phase~=Pending}", "pods.{pha*=Run*}", "pods.{^PHASE=^pending}", "pods.{name=,cpu=3}", "pods.{!cpu=3,!node=n1}", "pods.{*}",
+      "meta.k8", "meta.k9", "meta.''", "meta.nope", "meta[0]", "meta[1]", "meta.{k3=3}", "meta.{k3=4}", "meta.k1.x",
+      "shared.list.name", "shared.list.{phase=Pending}", "shared.list[3]", "nope" })
+   {
+      INFO(path);
+      CHECK(Dumps(frozen.Select(path)) == Dumps(SelectNodes(root, path)));
+      CHECK(Dumps(frozen.Select(CompiledPath(path))) == Dumps(SelectNodes(root, path)));
+   }
+
+   CHECK(frozen.Select("pods[%].%", { size_t(5), "cpu" })[0].Scalar() == "5");
+   CHECK_THROWS_AS(frozen.Select("pods.[x"), PathException);
+   CHECK_THROWS_AS(frozen.Select("pods.{name,cpu}"), PathException);     // selecting keys creates new maps
+
+   CHECK(frozen.MemoryUsage() < PoolStats(root).poolBytes);
+
+   // compiling a path does not intern its keys, evaluating it on a frozen document does
+   CompiledPath unseen("pods.{keyOfCompiledPath=x}");
+   CHECK(YamlPathDetail::FindKeyId("keyOfCompiledPath") == YamlPathDetail::NoKeyId);
+   CHECK(frozen.Select(unseen).empty());
+   CHECK(YamlPathDetail::FindKeyId("keyOfCompiledPath") != YamlPathDetail::NoKeyId);
+   CHECK(FrozenDocument(Load("pods: [ { keyOfCompiledPath: x } ]")).Select(unseen).size() == 1);
+
+   // keys are interned: a compiled path resolves its keys before the document exists
+   CompiledPath early("freshkey.{otherkey=1}");
+   FrozenDocument fresh(Load("{ freshkey: [ { otherkey: 1 }, { otherkey: 2 } ], pad: [ { otherkey: 1 } ] }"));
+   CHECK(fresh.Select(early).size() == 1);
+   CHECK(fresh.Select("neverusedkey").empty());
+   CHECK(fresh.Root()["freshkey"][1].Key(0).Scalar().data() == fresh.Root()["pad"][0].Key(0).Scalar().data());   // stored once
+
+   FrozenDocument empty((Node()));
+   CHECK(empty.Root().IsNull());
+   CHECK(empty.Select("a").empty());
+}
+
+TEST_CASE("QueryCache")
+{
+   auto root = MakePods(20);
+   auto other = MakePods(2);
+   QueryCache cache(root);
+
+   CHECK(cache.SelectNodes("pods.{phase=Pending}").size() == 7);
+   CHECK(cache.SelectNodes("pods.{phase=Pending}").size() == 7);
+   CHECK(cache.Hits() == 1);
+   CHECK(cache.Misses() == 1);
+
+   // bound arguments are part of the key
+   CHECK(cache.SelectNodes("pods[%].name", { size_t(3) })[0].Scalar() == "pod3");
+   CHECK(cache.SelectNodes("pods[%].name", { size_t(4) })[0].Scalar() == "pod4");
+   CHECK(cache.SelectNodes("pods[%].%", { size_t(4), "name" })[0].Scalar() == "pod4");
+   CHECK(cache.SelectNodes(CompiledPath("pods.{phase=Pending}")).size() == 7);     // same key as the path
+   CHECK(cache.Hits() == 2);
+   CHECK(cache.Size() == 4);
+
+   // Ensure on any node of the document invalidates
+   QueryCache second(root);
+   second.SelectNodes("pods.{phase=Pending}");
+   Node pod = root["pods"][1];
+   Ensure(pod, "phase");
+   EnsureExists(other, "unrelated");    // other documents don't invalidate
+   CHECK(cache.SelectNodes("pods.{phase=Pending}").size() == 7);
+   CHECK(cache.Misses() == 5);
+   second.SelectNodes("pods.{phase=Pending}");
+   CHECK(second.Misses() == 2);
+
+   // direct modifications need TouchDocument
+   root["pods"][1]["phase"] = "Pending";
+   CHECK(cache.SelectNodes("pods.{phase=Pending}").size() == 7);   // stale
+   TouchDocument(root["pods"]);
+   CHECK(cache.SelectNodes("pods.{phase=Pending}").size() == 8);
+
+#if YAML_PATH_POOL_INTERNALS
+   // a node built separately keeps its memory holder after it was added to the document, but shares the pool of the document
+   Node extra = Load("{ phase: Running }");
+   root["extra"] = extra;
+   REQUIRE(YamlPathDetail::NodeAccess::Memory(extra) != YamlPathDetail::NodeAccess::Memory(root));
+   CHECK(cache.SelectNodes("extra.owner").empty());
+   EnsureExists(extra, "owner");
+   CHECK(cache.SelectNodes("extra.owner").size() == 1);
+#endif
+
+   CHECK_THROWS_AS(cache.SelectNodes("pods.[x"), PathException);
+
+   QueryCache small(root, 2);
+   small.SelectNodes("pods[0]");
+   small.SelectNodes("pods[1]");
+   small.SelectNodes("pods[2]");
+   CHECK(small.Size() == 1);
+   cache.Clear();
+   CHECK(cache.Size() == 0);
+}
+
+TEST_CASE("PathSubscriptions")
+{
+   auto root = MakePods(6);
+   PathSubscriptions subs(root);
+   std::vector<PathChange> changes;
+   auto Record = [&](PathChange const & change) { changes.push_back(change); };
+
+   auto pending = subs.Subscribe(CompiledPath("pods.{phase=Pending}"), Record);
+   auto port = subs.Subscribe(CompiledPath("settings.port"), Record);
+   auto last = subs.Subscribe(CompiledPath("pods[7].name"), Record);
+   CHECK(subs.Current(pending).size() == 2);
+   CHECK(subs.Current(port).empty());
+   CHECK(subs.Current(last).empty());
+   CHECK(subs.Evaluations() == 3);
+
+   // only subscriptions that can reach the new nodes are evaluated
+   Ensure(root, "pods.[6].{name=pod6,phase=Pending}");
+   CHECK(subs.Evaluations() == 4);
+   REQUIRE(changes.size() == 1);
+   CHECK(changes[0].subscription == pending);
+   REQUIRE(changes[0].added.size() == 1);
+   CHECK(changes[0].added[0].is(root["pods"][6]));
+   CHECK(changes[0].removed.empty());
+   CHECK(subs.Current(pending).size() == 3);
+
+   Ensure(root, "settings.port");
+   CHECK(subs.Evaluations() == 5);
+   REQUIRE(changes.size() == 2);
+   CHECK(changes[1].subscription == port);
+   CHECK(subs.Current(port)[0].is(root["settings"]["port"]));
+
+   EnsureExists(root, "settings.port");   // nothing changes
+   CHECK(subs.Evaluations() == 5);
+
+   // from another node of the document, all subscriptions are evaluated
+   Node pods = root["pods"];
+   Ensure(pods, "[8].name");
+   CHECK(subs.Evaluations() == 8);
+   CHECK(changes.size() == 2);
+
+   // direct modifications need Refresh
+   root["pods"][0]["phase"] = "Running";
+   subs.Refresh();
+   REQUIRE(changes.size() == 3);
+   CHECK(changes[2].removed.size() == 1);
+   CHECK(changes[2].removed[0].is(root["pods"][0]));
+   CHECK(subs.Current(pending).size() == 2);
+
+   // a value assigned to the node Ensure returns is seen by Refresh. Only the modified pod is evaluated again
+   Ensure(root, "pods.[1].phase")[0] = "Pending";
+   CHECK(changes.size() == 3);
+   CHECK(subs.ElementEvaluations() == 1);
+   auto evaluations = subs.Evaluations();
+   subs.Refresh("pods.[1]");
+   CHECK(subs.Evaluations() == evaluations + 1);
+   CHECK(subs.ElementEvaluations() == 2);
+   REQUIRE(changes.size() == 4);
+   REQUIRE(changes[3].added.size() == 1);
+   CHECK(changes[3].added[0].is(root["pods"][1]));
+   {
+      auto & current = subs.Current(pending);    // still in document order
+      REQUIRE(current.size() == 3);
+      CHECK(current[0].is(root["pods"][1]));
+      CHECK(current[1].is(root["pods"][3]));
+      CHECK(current[2].is(root["pods"][6]));
+   }
+
+   root["pods"][3]["phase"] = "Running";
+   subs.Refresh("pods.[3].phase");
+   CHECK(subs.ElementEvaluations() == 3);
+   REQUIRE(changes.size() == 5);
+   REQUIRE(changes[4].removed.size() == 1);
+   CHECK(changes[4].removed[0].is(root["pods"][3]));
+   REQUIRE(subs.Current(pending).size() == 2);
+   CHECK(subs.Current(pending)[1].is(root["pods"][6]));
+
+   // handlers are called without a lock: they may wait for a thread modifying another document
+   auto otherRoot = MakePods(2);
+   PathSubscriptions otherSubs(otherRoot);
+   auto otherPending = otherSubs.Subscribe(CompiledPath("pods.{phase=Pending}"), {});
+   size_t waited = 0;
+   auto waiting = subs.Subscribe(CompiledPath("pods.{phase=Unknown}"), [&](PathChange const &)
+   {
+      std::thread([&] { EnsureExists(otherRoot, "pods.[5].{phase=Pending}"); }).join();
+      ++waited;
+   });
+   EnsureExists(root, "pods.[10].{phase=Unknown}");
+   CHECK(waited == 1);
+   CHECK(otherSubs.Current(otherPending).size() == 2);
+   subs.Unsubscribe(waiting);
+
+#if YAML_PATH_POOL_INTERNALS
+   // a node built separately keeps its memory holder after it was added to the document, but shares the pool of the document
+   Node extra = Load("{ phase: Pending }");
+   root["pods"].push_back(extra);
+   REQUIRE(YamlPathDetail::NodeAccess::Memory(extra) != YamlPathDetail::NodeAccess::Memory(root));
+   EnsureExists(extra, "name");
+   REQUIRE(!changes.empty());
+   REQUIRE(changes.back().added.size() == 1);
+   CHECK(changes.back().added[0].is(extra));
+#endif
+
+   // handlers can unsubscribe
+   subs.Subscribe(CompiledPath("pods.{phase=Failed}"), [&](PathChange const & change) { subs.Unsubscribe(change.subscription); });
+   CHECK(subs.Size() == 4);
+   Ensure(root, "pods.[9].{phase=Failed}");
+   CHECK(subs.Size() == 3);
+
+   subs.Unsubscribe(last);
+   CHECK(subs.Current(last).empty());
+   CHECK_THROWS_AS(subs.Subscribe(CompiledPath("pods.{name,phase}"), Record), PathException);
+}
+
+TEST_CASE("PathEvaluation")
+{
+   auto root = MakePods(1000);
+   CompiledPath path("pods.{phase=Pending}.name");
+   auto expected = SelectNodes(root, path);
+   REQUIRE(expected.size() == 334);
+
+   PathEvaluation eval(root, path);
+   CHECK(!eval.Done());
+   size_t calls = 0;
+   while (eval.Resume({ 100 }) == EPathEvalState::Pending)
+      ++calls;
+   CHECK(calls >= 10);               // 1000 pods in the filter, 334 pending pods for the key
+   CHECK(eval.Calls() == calls + 1);
+   CHECK(eval.Done());
+   CHECK(eval.Error() == EPathError::OK);
+   REQUIRE(eval.Result().size() == expected.size());
+   for (size_t i = 0; i < expected.size(); ++i)
+      CHECK(eval.Result()[i].is(expected[i]));
+   CHECK(eval.Resume() == EPathEvalState::Done);
+   CHECK(eval.Calls() == calls + 1);
+
+   // a budget too small for any work still progresses
+   PathEvaluation slow(root, CompiledPath("pods[3].name"));
+   CHECK(slow.Resume({ 0 }) == EPathEvalState::Pending);
+   CHECK(slow.Resume({ 0, std::chrono::nanoseconds(0) }) == EPathEvalState::Pending);
+   REQUIRE(slow.Resume({ 0 }) == EPathEvalState::Done);
+   CHECK(slow.Result()[0].Scalar() == "pod3");
+   CHECK(slow.NodesVisited() == 3);
+
+   // !top is applied at once, counting the sorted elements, so it starts a new call
+   PathEvaluation sorted(root, CompiledPath("pods.!top(5,name)"));
+   CHECK(sorted.Resume({ 100 }) == EPathEvalState::Pending);
+   CHECK(sorted.NodesVisited() == 1);
+   CHECK(sorted.Resume({ 100 }) == EPathEvalState::Done);
+   CHECK(sorted.NodesVisited() == 1001);
+   CHECK(sorted.Result().size() == 5);
+
+   PathEvaluation timed(root, path);
+   while (timed.Resume({ SIZE_MAX, std::chrono::microseconds(20) }) == EPathEvalState::Pending) {}
+   CHECK(timed.Result().size() == expected.size());
+
+   PathEvaluation missing(root, CompiledPath("pods.{phase=Failed}.name"));
+   CHECK(missing.Resume() == EPathEvalState::Done);
+   CHECK(missing.Error() == EPathError::NodeNotFound);
+   CHECK(missing.Result().empty());
+}
+
+TEST_CASE("PathLimits")
+{
+   auto root = MakePods(1000);
+   CHECK(SelectNodes(root, "pods.{phase=Pending}", {}, PathLimits()).size() == 334);
+
+   auto LimitHit = [&](PathArg path, PathLimits const & limits) -> std::string
+   {
+      try
+      {
+         SelectNodes(root, path, {}, limits);
+      }
+      catch (PathException const & e)
+      {
+         CHECK(e.Error() == EPathError::LimitExceeded);
+         CHECK(e.IsLimitError());
+         CHECK(!e.IsNodeError());
+         CHECK(!e.IsPathError());
+         return e.What();
+      }
+      return {};
+   };
+
+   PathLimits limits;
+   limits.maxNodesVisited = 100;
+   CHECK(LimitHit("pods.{phase=Pending}", limits).find("limit: nodes visited") != std::string::npos);
+   CHECK(LimitHit("pods[3].{*=pod3}", limits).empty());
+   limits.maxNodesVisited = 3;
+   CHECK(LimitHit("pods[3].{*=Pending}", limits).find("nodes visited") != std::string::npos);    // scanning the keys of a single map
+
+   limits = PathLimits();
+   limits.maxResultNodes = 100;
+   CHECK(LimitHit("pods.{phase=Pending}", limits).find("limit: result nodes") != std::string::npos);
+   limits.maxResultNodes = 334;
+   CHECK(LimitHit("pods.{phase=Pending}", limits).empty());
+
+   limits = PathLimits();
+   limits.maxBytes = 10000;
+   CHECK(LimitHit("pods.{name,phase}", limits).find("limit: bytes") != std::string::npos);  // copies of the selected keys
+   CHECK(LimitHit("pods[3].{name,phase}", limits).empty());
+
+   CHECK(LimitHit("pods.{phase=Pending}", PathLimits::Timeout(std::chrono::nanoseconds(0))).find("limit: deadline") != std::string::npos);
+   CHECK(LimitHit("pods.{phase=Pending}", PathLimits::Timeout(std::chrono::seconds(60))).empty());
+
+   // compiled paths, PathResolve
+   limits = PathLimits();
+   limits.maxNodesVisited = 100;
+   CHECK_THROWS_AS(SelectNodes(root, CompiledPath("pods.{phase=Pending}"), limits), PathException);
+   CHECK(SelectNodes(root, CompiledPath("pods.[3].name"), limits).size() == 1);
+   CHECK(SelectNodes(root, CompiledPath("pods.[3000].name"), limits).empty());
+
+   Node node = root;
+   PathArg path = "pods.{phase=Pending}.name";
+   PathException px;
+   CHECK(PathResolve(node, path, {}, limits, &px) == EPathError::LimitExceeded);
+   CHECK(node.IsSequence());
+   CHECK(node.size() == 1000);
+   CHECK(path == ".{phase=Pending}.name");
+   CHECK(px.What(false) == "evaluation limit exceeded");
+}
+
+TEST_CASE("IndexedDocument")
+{
+   // maps with inconsistent key casing, large enough to be indexed
+   std::stringstream s;
+   s << "hosts:\n";
+   for (int i = 0; i < 50; ++i)
+   {
+      s << "  - { " << (i % 2 ? "Name" : "NAME") << ": h" << i << ", " << (i % 3 ? "status" : "Status") << ": " << (i % 4 ? "up" : "down");
+      for (int k = 0; k < 10; ++k)
+         s << ", label" << k << ": v" << k;
+      s << (i == 7 ? ", \xC3\x84rea: x" : "") << " }\n";
+   }
+   s << "small: { A: 1, b: 2 }\n";
+   auto root = Load(s.str());
+
+   IndexedDocument doc(root);
+   auto Same = [&](PathArg path) -> size_t
+   {
+      auto expected = SelectNodes(root, path);
+      auto actual = doc.SelectNodes(path);
+      REQUIRE(actual.size() == expected.size());
+      for (size_t i = 0; i < actual.size(); ++i)
+         CHECK(Dump(actual[i]) == Dump(expected[i]));
+      return actual.size();
+   };
+
+   CHECK(Same("hosts.{^status=down}") == 13);
+   CHECK(doc.IndexedMaps() == 50);
+   CHECK(doc.MemoryUsage() > 0);
+   CHECK(Same("hosts.{^name=h7}.label3") == 1);
+   CHECK(Same("hosts.{^NAME=h8,^STATUS=up}") == 38);   // either condition
+   CHECK(Same("hosts.{^Status}") == 50);          // selects the key into a new map
+   CHECK(Same("hosts.{^missing=1}") == 0);
+   CHECK(Same("hosts.{^\xC3\x84REA}") == 1);      // non-ASCII: compared with each key
+   CHECK(Same("hosts.{name*=h1}") == 0);            // case sensitive: not NAME
+   CHECK(Same("small.{^a=1}") == 1);               // not indexed
+   CHECK(doc.IndexedMaps() == 50);
+
+   // key prefixes: sorted key index, results in document order
+   CHECK(Same("hosts.{label*}") == 50);
+   CHECK(Dump(doc.SelectNodes("hosts.[0].{label*}")[0]).find("label0: v0\nlabel1: v1") == 0);
+   CHECK(Same("hosts.{label1*=v1}") == 50);
+   CHECK(Same("hosts.{NA*=h8}") == 1);
+   CHECK(Same("hosts.{N*=h9}") == 1);
+   CHECK(Same("hosts.{labels*}") == 0);
+   CHECK(Same("hosts.{z*}") == 0);
+   CHECK(Same("hosts.{\xC3\x84*}") == 1);
+   CHECK(doc.IndexedMaps() == 50);
+
+   // modifications discard the indexes
+   Ensure(root, "hosts.[50].{NaMe=new}");
+   CHECK(Same("small.{^a=1}") == 1);
+   CHECK(doc.IndexedMaps() == 0);
+   CHECK(Same("hosts.{^name=new}") == 1);
+
+   IndexOptions noFolding;
+   noFolding.foldedKeys = false;
+   IndexedDocument plain(root, noFolding);
+   CHECK(plain.SelectNodes("hosts.{^status=down}").size() == 13);
+   CHECK(plain.IndexedMaps() == 0);
+   CHECK(plain.SelectNodes("hosts.{label1*}").size() == 50);
+   CHECK(plain.IndexedMaps() == 50);
+   noFolding.sortedKeys = false;
+   IndexedDocument none(root, noFolding);
+   CHECK(none.SelectNodes("hosts.{label1*}").size() == 50);
+   CHECK(none.IndexedMaps() == 0);
+
+   // key signatures skip maps without the key, results are the same
+   IndexOptions signatures;
+   signatures.keySignatures = true;
+   IndexedDocument signedDoc(root, signatures);
+   const size_t unsignedMemory = signedDoc.MemoryUsage();
+   for (char const * path : { "hosts.label3", "hosts.Name", "hosts.{Name=h7}", "hosts.{NAME=h8}.label1", "hosts.{Status}", "hosts.{NaMe=new}",
+                              "hosts.{status~=up}", "hosts.missing", "hosts.{missing=1}", "small.A", "small.a", "hosts.[3].{Status=down}" })
+   {
+      auto expected = SelectNodes(root, path);
+      auto actual = signedDoc.SelectNodes(path);
+      REQUIRE(actual.size() == expected.size());
+      for (size_t i = 0; i < actual.size(); ++i)
+         CHECK(Dump(actual[i]) == Dump(expected[i]));
+   }
+   CHECK(signedDoc.MemoryUsage() >= unsignedMemory + 52 * 16);
+   Ensure(root, "hosts.[0].fresh");
+   CHECK(signedDoc.SelectNodes("hosts.fresh").size() == 1);
+   CHECK_THROWS_AS(doc.SelectNodes("hosts.{"), PathException);
+}
+
+TEST_CASE("SelectNodes - map filter blocks")
+{
+   // more than one block of 64, with elements that are not maps, lack the key, or have a non-scalar value
+   std::stringstream s;
+   s << "s:\n";
+   for (int i = 0; i < 150; ++i)
+   {
+      if (i % 17 == 0)
+         s << "  - scalar" << i << "\n";
+      else if (i % 13 == 0)
+         s << "  - { other: 1 }\n";
+      else if (i % 11 == 0)
+         s << "  - { k: [ 1, 2 ] }\n";
+      else
+         s << "  - { k: " << (i % 3 == 0 ? "Abc" : i % 3 == 1 ? "abcd" : "x") << ", n: " << i << " }\n";
+   }
+   auto root = Load(s.str());
+
+   for (char const * path : { "s.{k=Abc}", "s.{k=abc*}", "s.{k=^abc}", "s.{k=^ABC*}", "s.{k~=x}", "s.{k=}", "s.{k=*}", "s.{k=''}",
+                              "s.{k=abcd}.n", "s.{n=5}", "s.{k=Abc}.{n=9}" })
+   {
+      auto blocks = SelectNodes(root, path);
+      auto elementWise = SelectNodes(root, path, {}, PathLimits());    // limits disable the block evaluation
+      REQUIRE(blocks.size() == elementWise.size());
+      for (size_t i = 0; i < blocks.size(); ++i)
+         CHECK(blocks[i].is(elementWise[i]));
+   }
+   CHECK(SelectNodes(root, "s.{k=Abc}").size() == 40);
+}
+
+TEST_CASE("SelectDistinct")
+{
+   auto root = Load(R"(
+pods:
+  - { name: a, node: n1, labels: { app: web, tier: front }, ports: [ 80, 443 ] }
+  - { name: b, node: n2, labels: { app: web, tier: front }, ports: [ 80 ] }
+  - { name: c, node: n1, labels: { tier: front, app: web }, ports: [ 80, 443 ] }
+  - { name: d, node: '1', labels: { app: db }, ports: [ 5432 ] }
+  - { name: e, node: 1, ports: [ ] }
+  - { name: f, node: n2, labels: { app: db }, ports: [ ] }
+)");
+
+   auto Scalars = [](std::vector<Node> const & nodes)
+   {
+      std::string s;
+      for (auto & n : nodes)
+         s += (s.empty() ? "" : ",") + n.Scalar();
+      return s;
+   };
+
+   CHECK(Scalars(SelectDistinct(root, "pods.node")) == "n1,n2,1");     // in order of first occurrence, quoting is ignored
+   CHECK(Scalars(SelectDistinct(root, "pods.name")) == "a,b,c,d,e,f");
+   CHECK(SelectDistinct(root, "pods.labels").size() == 3);              // key order matters
+   CHECK(SelectDistinct(root, "pods.ports").size() == 4);
+   CHECK(SelectDistinct(root, "pods.[0]").size() == 1);
+   CHECK(SelectDistinct(root, "pods.nope").empty());
+   CHECK(SelectDistinct(root, "pods.{app=db}").empty());
+   CHECK(Scalars(SelectDistinct(root, "pods.{node=n2}.labels.app")) == "web,db");
+
+   auto distinct = SelectDistinct(root, "pods.labels");
+   CHECK(distinct[2]["app"].Scalar() == "db");
+   CHECK(distinct[1]["tier"].Scalar() == "front");
+
+   // the same node selected more than once, through aliases
+   auto aliased = Load("items: [ &a { x: 1 }, *a, *a ]");
+   CHECK(SelectNodes(aliased, "items.{x=1}").size() == 3);
+   CHECK(SelectDistinct(aliased, "items.{x=1}").size() == 1);
+
+   CompiledPath nodes("pods.node");
+   CHECK(Scalars(SelectDistinct(root, nodes)) == "n1,n2,1");
+   CHECK(Scalars(SelectDistinct(root, "pods.{name=%}.node", { "a" })) == "n1");
+   CHECK_THROWS_AS(SelectDistinct(root, "pods.[x"), PathException);
+
+   auto mixed = Load("[ 1, '1', ~, null, [], {}, [ ~ ], { a: ~ }, { a: }, [ [] ], [ {} ] ]");
+   CHECK(SelectDistinct(mixed, "").size() == 1);
+   std::vector<Node> elements;
+   for (auto el : mixed)
+      elements.push_back(el);
+   YamlPathDetail::RemoveDuplicates(elements);
+   CHECK(elements.size() == 8);    // 1, ~, [], {}, [ ~ ], { a: ~ }, [ [] ], [ {} ]
+}
+
+TEST_CASE("SelectNodes - sort and top")
+{
+   auto root = Load(R"(
+pods:
+  - { name: a, restarts: 3, phase: Running }
+  - { name: b, restarts: 10, phase: Running }
+  - { name: c, phase: Pending }
+  - { name: d, restarts: 2.5, phase: Running }
+  - { name: e, restarts: x, phase: Running }
+  - { name: f, restarts: 10, phase: Pending }
+  - { name: g, restarts: '.nan', phase: Running }
+  - plain
+)");
+
+   auto Names = [](std::vector<Node> const & nodes)
+   {
+      std::string s;
+      for (auto & n : nodes)
+         s += n.IsMap() ? n["name"].Scalar() : n.Scalar();
+      return s;
+   };
+
+   CHECK(Names(SelectNodes(root, "pods.!sort(restarts)")) == "dabfecgplain");     // numbers, then strings, then no value, in order
+   CHECK(Names(SelectNodes(root, "pods.!sort(name)")) == "abcdefgplain");
+   CHECK(Names(SelectNodes(root, "pods.!top(3,restarts)")) == "bfa");             // ties keep their order
+   CHECK(Names(SelectNodes(root, "pods.!top(20,restarts)")) == "bfade");
+   CHECK(Names(SelectNodes(root, "pods.{phase=Running}.!top(2,restarts)")) == "ba");
+   CHECK(Names(SelectNodes(root, "pods.{phase=Running}.!top(2,restarts).name")) == "ba");
+   CHECK(Names(SelectNodes(root, "pods.!top(%,%)", { size_t(1), "restarts" })) == "b");
+   CHECK(Names(SelectNodes(root, "pods.restarts.!top(2)")) == "1010");              // by the nodes' values
+   CHECK(Names(SelectNodes(root, "pods.name.!sort()")) == "abcdefg");
+   CHECK(Names(SelectNodes(root, "pods!top( 1 , 'restarts' )")) == "b");
+   CHECK(SelectNodes(root, "pods.!top(0,restarts)").empty());
+   CHECK(SelectNodes(root, "pods.!top(2,nope)").empty());
+   CHECK(SelectNodes(root, "pods.[0].!sort(name)").empty());                        // not a sequence
+
+   auto top = Select(root, "pods.!top(2,restarts)");
+   REQUIRE(top.IsSequence());
+   CHECK(top.size() == 2);
+   CHECK(top[0].is(root["pods"][1]));                                               // refers to the document
+
+   for (char const * path : { "pods.!top", "pods.!top(x,restarts)", "pods.!top(2 restarts)", "pods.!sort(restarts", "pods.!median(restarts)", "!", "pods.!sort(a,b)" })
+      CHECK_THROWS_AS(SelectNodes(root, path), PathException);
+   CHECK(PathValidate("pods.!median(x)") == EPathError::SelectorNotSupported);
+   CHECK(PathValidate("pods.!top(2,x).name") == EPathError::OK);
+   CHECK(PathValidate("pods.!top(3,)") == EPathError::InvalidToken);          // the field is required after the comma
+   CHECK(PathValidate("pods.!top(3, )") == EPathError::InvalidToken);
+
+   PathLimits limits;
+   limits.maxResultNodes = 2;
+   CHECK_THROWS_AS(SelectNodes(root, "pods.!sort(name)", {}, limits), PathException);
+   CHECK(SelectNodes(root, "pods.!top(2,name)", {}, limits).size() == 2);
+
+   CHECK_THROWS_AS(Ensure(root, "pods.!sort(name)"), PathException);
+   FrozenDocument frozen(root);
+   CHECK_THROWS_AS(frozen.Select("pods.!sort(name)"), PathException);
+}
+
+TEST_CASE("SelectNodes - comparisons")
+{
+   auto root = Load("s: [ { v: 3 }, { v: 10 }, { v: '2.5' }, { v: abc }, { v: '2024-05-01T10:00' }, { v: .nan }, { v: [ 1 ] }, { w: 1 }, x ]");
+   auto Count = [&](PathArg path) { return SelectNodes(root, path).size(); };
+
+   CHECK(Count("s.{v<10}") == 2);               // numbers as numbers: 2.5 < 3 < 10
+   CHECK(Count("s.{v<=10}") == 3);
+   CHECK(Count("s.{v>'2.5'}") == 2);
+   CHECK(Count("s.{v>=3}") == 2);
+   CHECK(Count("s.{v>a}") == 1);                // strings as strings, numbers don't match
+   CHECK(Count("s.{v<'2024-06'}") == 1);
+   CHECK(SelectNodes(root, "s.{v>=%}", { "2024-05-01" }).size() == 2);
+   CHECK(Count("s.{v<'.nan'}") == 0);
+   CHECK(Count("s.{v < 4}") == 2);
+   CHECK(Count("s.{v<4}.v") == 2);
+   CHECK(Count("s.{v>1,w=1}") == 4);             // either condition
+   CHECK(SelectNodes(root, "s.{v>1}", {}, PathLimits()).size() == 3);
+
+   for (char const * invalid : { "s.{v<}", "s.{v>=}", "s.{v<a*}", "s.{v>^a}", "s.{v=<1}", "s.{v<<1}" })
+      CHECK(PathValidate(invalid) != EPathError::OK);
+
+   CHECK_THROWS_AS(Ensure(root, "s.[0].{v<3}"), PathException);
+}
+
+TEST_CASE("OrderedIndex")
+{
+   std::stringstream s;
+   s << "hosts:\n";
+   for (int i = 0; i < 200; ++i)
+   {
+      if (i % 23 == 0)
+         s << "  - { name: h" << i << " }\n";
+      else
+         s << "  - { name: h" << i << ", load: '0." << (i * 37) % 100 << "', since: '2024-0" << 1 + i % 9 << "-01' }\n";
+   }
+   s << "other: [ { load: 1 } ]\n";
+   auto root = Load(s.str());
+
+   auto Names = [](std::vector<Node> const & nodes)
+   {
+      std::string names;
+      for (auto & n : nodes)
+         names += (n.IsScalar() ? n : n["name"]).as<std::string>("?") + " ";
+      return names;
+   };
+   std::vector<std::string> paths = { "hosts.{load>'0.8'}", "hosts.{load<='0.1'}", "hosts.{load<1}", "hosts.{load>=0}",
+                                      "hosts.{since<'2024-03'}", "hosts.{since>='2024-09-01'}.name", "hosts.{load>a}" };
+   std::vector<std::string> expected;
+   for (auto & path : paths)
+      expected.push_back(Names(SelectNodes(root, path)));
+   CHECK(SelectNodes(root, "hosts.{load>'0.8'}").size() == 40);
+
+   OrderedIndex byLoad(root, "hosts", "load");
+   OrderedIndex bySince(root, "hosts", "since");
+   CHECK(byLoad.Rebuilds() == 0);
+   for (size_t i = 0; i < paths.size(); ++i)
+   {
+      CHECK(Names(SelectNodes(root, paths[i])) == expected[i]);
+      CHECK(Names(SelectNodes(root, CompiledPath(paths[i]))) == expected[i]);
+   }
+   CHECK(byLoad.Size() == 191);
+   CHECK(byLoad.Rebuilds() == 1);
+   CHECK(byLoad.MemoryUsage() > 0);
+   CHECK(Select(root, "hosts.{load>'0.9'}").size() == SelectNodes(root, "hosts.{load>'0.9'}", {}, PathLimits()).size());
+   CHECK(SelectNodes(root, "other.{load>'0.5'}").size() == 1);     // other sequence
+
+   Node resolved = root;
+   PathArg path = "hosts.{load>'0.8'}.name";
+   CHECK(PathResolve(resolved, path) == EPathError::OK);
+   CHECK(resolved.size() == 40);
+
+   // appending and modifying through Ensure updates the index without rebuilding it
+   Ensure(root, "hosts.[200].{name=new,load='0.99'}");
+   Ensure(root, "hosts.[23].{load='0.85'}");      // had no load
+   Ensure(root, "hosts.[1].comment");             // other key
+   Ensure(root, "other.[1].{load=2}");            // other sequence
+   Ensure(root, "hosts.[5].{load='0.5'}");        // not modified: load exists
+   auto high = SelectNodes(root, "hosts.{load>'0.8'}");
+   CHECK(high.size() == 42);
+   CHECK(Names(high).find(" h23 ") != std::string::npos);
+   CHECK(Names(high).find("new") == Names(high).size() - 4);
+   CHECK(Names(high) == Names(SelectNodes(root, "hosts.{load>'0.8'}", {}, PathLimits())));
+   CHECK(byLoad.Size() == 193);
+   CHECK(byLoad.Rebuilds() == 1);
+
+   // padding, and assigning to an element that had no load
+   Ensure(root, "hosts.[205].{name=pad,load='-1'}");
+   CHECK(Names(SelectNodes(root, "hosts.{load<0}")) == "pad ");
+   CHECK(byLoad.Rebuilds() == 1);
+
+   // enough appends to merge the added values
+   for (size_t i = 0; i < 100; ++i)
+      Ensure(root, "hosts.[%].{name=x,load=%}", { 210 + i, std::to_string(i % 10) });
+   CHECK(Names(SelectNodes(root, "hosts.{load>=5}")) == Names(SelectNodes(root, "hosts.{load>=5}", {}, PathLimits())));
+   CHECK(SelectNodes(root, "hosts.{load>=5}").size() == 50);
+   CHECK(byLoad.Rebuilds() == 1);
+
+   // modifications the index cannot follow rebuild it
+   root["hosts"][3]["load"] = "0.95";
+   TouchDocument(root);
+   CHECK(SelectNodes(root, "hosts.{load>'0.9'}").size() == SelectNodes(root, "hosts.{load>'0.9'}", {}, PathLimits()).size());
+   CHECK(byLoad.Rebuilds() == 2);
+   Node hosts = root["hosts"];
+   Ensure(hosts, "[207].{load='0.1'}");          // from another node
+   CHECK(byLoad.Size() == 295);
+   CHECK(byLoad.Rebuilds() == 3);
+
+   // concurrent readers share the index
+   const size_t busy = SelectNodes(root, "hosts.{load>'0.9'}", {}, PathLimits()).size();
+   std::atomic<size_t> failures = 0;
+   std::vector<std::thread> readers;
+   for (int t = 0; t < 4; ++t)
+      readers.emplace_back([&]
+      {
+         for (int i = 0; i < 200; ++i)
+            if (SelectNodes(root, "hosts.{load>'0.9'}").size() != busy)
+               ++failures;
+      });
+   for (auto & t : readers)
+      t.join();
+   CHECK(failures == 0);
+   CHECK(byLoad.Rebuilds() == 3);
+
+   CHECK_THROWS_AS(OrderedIndex(root, "hosts.{name=h1}", "load"), PathException);
+   CHECK_THROWS_AS(OrderedIndex(root, "hosts.[", "load"), PathException);
+   OrderedIndex missing(root, "nothing", "load");
+   CHECK(missing.Size() == 0);
+}
+
+TEST_CASE("PathBinding")
+{
+   struct Server
+   {
+      std::string host;
+      int port = 80;
+      double load = 0;
+      std::vector<std::string> tags;
+      std::string firstTag;
+      bool tls = false;
+   };
+
+   PathBinding<Server> binding = {
+      { "server.host", &Server::host },
+      { "server.port", &Server::port, false },
+      { "server.limits.load", &Server::load },
+      { "server.tags", &Server::tags, false },
+      { "server.tags.[0]", &Server::firstTag, false },
+      { "server.tls", &Server::tls, false },
+   };
+
+   Server server;
+   auto result = binding.Bind(Load("server: { host: example.org, port: 8080, limits: { load: 0.5 }, tags: [ a, b ], tls: true }"), server);
+   CHECK(result);
+   CHECK(result.bound == 6);
+   CHECK(server.host == "example.org");
+   CHECK(server.port == 8080);
+   CHECK(server.load == 0.5);
+   CHECK(server.tags.size() == 2);
+   CHECK(server.firstTag == "a");
+   CHECK(server.tls);
+
+   // missing and malformed fields are reported together, in the order of the fields
+   Server other;
+   result = binding.Bind(Load("server: { port: http, limits: 3, tags: x, tls: ~ }"), other);
+   CHECK(!result);
+   CHECK(result.bound == 1);      // "[0]" selects a scalar itself
+   CHECK(other.firstTag == "x");
+   REQUIRE(result.issues.size() == 4);
+   CHECK((result.issues[0].field == 0 && result.issues[0].error == EBindError::Missing && result.issues[0].path == "server.host"));
+   CHECK((result.issues[1].field == 1 && result.issues[1].error == EBindError::Malformed));
+   CHECK((result.issues[2].field == 2 && result.issues[2].error == EBindError::Missing));
+   CHECK((result.issues[3].field == 3 && result.issues[3].error == EBindError::Malformed));
+   CHECK(other.port == 80);     // not bound: keeps its value
+
+   CHECK(binding.Bind(Load("[]"), other).issues.size() == 2);   // required fields
+
+   // paths selecting several nodes are decoded as sequence, copies share the binding
+   struct Cluster { std::vector<std::string> names; std::string second; size_t size = 0; };
+   auto clusterBinding = PathBinding<Cluster>{
+      { "servers.name", &Cluster::names },
+      { "servers.[1].name", &Cluster::second },
+      { "size", &Cluster::size, false },
+   };
+   auto copy = clusterBinding;
+   Cluster cluster;
+   CHECK(copy.Bind(Load("{ size: 2, servers: [ { name: a }, { name: b } ] }"), cluster));
+   CHECK(cluster.names == std::vector<std::string>{ "a", "b" });
+   CHECK(cluster.second == "b");
+   CHECK(cluster.size == 2);
+
+   // fan-out results are decoded element by element, without building a sequence in the document
+   auto doc = Load("{ servers: [ { name: a }, { name: b }, { name: [ c ] } ] }");
+   auto poolNodes = PoolStats(doc).poolNodes;
+   Cluster partial;
+   result = clusterBinding.Bind(doc, partial);
+   REQUIRE(result.issues.size() == 1);
+   CHECK((result.issues[0].field == 0 && result.issues[0].error == EBindError::Malformed));
+   CHECK(partial.names.empty());
+   CHECK(PoolStats(doc).poolNodes == poolNodes);
+   CHECK(!PathBinding<Cluster>{ { "servers.name", &Cluster::second } }.Bind(doc, partial));   // not a sequence member
+
+   CHECK_THROWS_AS((PathBinding<Cluster>{ { "servers.[x", &Cluster::second } }), PathException);
+
+   // numbers are decoded like as<T>()
+   struct Number { int i = 0; unsigned u = 0; double d = 0; };
+   PathBinding<Number> numberBinding = { { "", &Number::i }, { "", &Number::u }, { "", &Number::d } };
+   for (char const * text : { "12", "-7", "0", "-0", "010", "0x1F", "+3", "1e3", "2.5", ".inf", "99999999999", "12abc" })
+   {
+      auto node = Load(text);
+      Number number;
+      auto bound = numberBinding.Bind(node, number);
+      auto IsBound = [&](size_t field) { return std::none_of(bound.issues.begin(), bound.issues.end(), [&](PathBindIssue const & issue) { return issue.field == field; }); };
+      int i = 0;
+      unsigned u = 0;
+      double d = 0;
+      CHECK(IsBound(0) == convert<int>::decode(node, i));
+      CHECK(IsBound(1) == convert<unsigned>::decode(node, u));
+      CHECK(IsBound(2) == convert<double>::decode(node, d));
+      CHECK((number.i == (IsBound(0) ? i : 0) && number.u == (IsBound(1) ? u : 0) && number.d == (IsBound(2) ? d : 0)));
+   }
+}
+
 TEST_CASE("Create")
 {
    CheckCreate("keyA.keyB",         "{ keyA : { keyB : ~ } }");
@@ -719,13 +2223,602 @@ TEST_CASE("Ensure")
 
 }
 
+TEST_CASE("Ensure - upsert")
+{
+   auto root = Load("users: [ { id: 1, name: a }, { id: 2 }, x, { name: c } ]");
+   auto users = root["users"];
+
+   auto found = Ensure(root, "users.{id=2}");
+   REQUIRE(found.size() == 1);
+   CHECK(found[0]["id"].as<int>() == 2);
+   CHECK(users.size() == 4);
+
+   Ensure(root, "users.{id=3}.name");                  // appended
+   REQUIRE(users.size() == 5);
+   CHECK(users[4]["id"].as<int>() == 3);
+   CHECK(users[4]["name"].IsNull());
+
+   Ensure(root, "users.{id=2,name=b}");                // other conditions are assigned to the element
+   Ensure(root, "users.{id=1,name=z}");                // existing values are kept
+   CHECK(users[1]["name"].as<std::string>() == "b");
+   CHECK(users[0]["name"].as<std::string>() == "a");
+
+   auto names = Ensure(root, "users.{id=%,name}", { "7" });    // selected keys of the element
+   REQUIRE(names.size() == 1);
+   CHECK(names[0].IsNull());
+   CHECK(users.size() == 6);
+
+   CHECK_THROWS_AS(Ensure(root, "users.{id=}"), PathException);     // no value to upsert
+   CHECK_THROWS_AS(Ensure(root, "users.{name}"), PathException);
+   CHECK_THROWS_AS(Ensure(root, "users.{id!=1}"), PathException);
+   CHECK(users.size() == 6);
+
+   // a batch indexes the elements by id
+   EnsureBatch batch(root);
+   for (size_t i = 0; i < 1000; ++i)
+      batch.Ensure("users.{id=%}.count", { std::to_string(i % 100 + 10) });
+   CHECK(users.size() == 106);
+   CHECK(users[6]["id"].as<int>() == 10);
+   CHECK(users[105]["count"].IsNull());
+
+   batch.Ensure("users.{id=1}.count");
+   CHECK(users.size() == 106);
+   CHECK(users[0]["count"].IsNull());
+
+   batch.Ensure("users.[3].{id=x}");                   // element without id gets one
+   batch.Ensure("users.{id=x}");
+   CHECK(users.size() == 106);
+   batch.Ensure("users.[200].{id=late}");              // elements appended by index
+   batch.Ensure("users.{id=late}.name");
+   CHECK(users.size() == 201);
+   CHECK(users[200]["name"].IsNull());
+}
+
+
+
+
+
+// ---- benchmarks, run with --benchmark
+namespace Bench
+{
+   using Clock = std::chrono::steady_clock;
+
+   double Seconds(Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); }
+
+   /// calls \c f(i) for i in [0, count) on each of \c threadCount threads, returns the total number of calls per second
+   template <typename TFunc>
+   double Throughput(size_t threadCount, size_t count, TFunc f)
+   {
+      std::vector<std::thread> threads;
+      auto start = Clock::now();
+      for (size_t t = 0; t < threadCount; ++t)
+         threads.emplace_back([&] { for (size_t i = 0; i < count; ++i) f(i); });
+      for (auto & t : threads)
+         t.join();
+      return threadCount * count / Seconds(start);
+   }
+
+   /// thread counts to measure scaling: 1, 2, 4, ... up to the number of hardware threads
+   std::vector<size_t> ThreadCounts()
+   {
+      std::vector<size_t> result;
+      size_t hw = std::max<size_t>(1, std::thread::hardware_concurrency());
+      for (size_t n = 1; n < hw; n *= 2)
+         result.push_back(n);
+      result.push_back(hw);
+      return result;
+   }
+
+   void SelectNodesConcurrent()
+   {
+      const size_t podCount = 10000;
+      auto root = MakePods(podCount);
+
+      for (size_t threads : ThreadCounts())
+      {
+         double lookups = Throughput(threads, 20000, [&](size_t i) { SelectNodes(root, "pods[%].name", { (i * 7919) % podCount }); });
+         double filters = Throughput(threads, 20, [&](size_t) { SelectNodes(root, "pods.{phase=Pending}"); });
+         std::cout << "  threads: " << threads << "   index + key: " << size_t(lookups) << " /s   filter over " << podCount << ": " << size_t(filters) << " /s\n";
+      }
+
+      double fanOutSelect = Throughput(1, 20, [&](size_t) { Select(root, "pods.name"); });
+      double fanOutNodes = Throughput(1, 20, [&](size_t) { SelectNodes(root, "pods.name"); });
+      std::cout << "  fan-out over " << podCount << ": Select " << size_t(fanOutSelect) << " /s, SelectNodes " << size_t(fanOutNodes) << " /s\n";
+   }
+
+   void FailedLookups()
+   {
+      auto root = MakePods(100);
+      const size_t count = 100000;
+
+      double require = Throughput(1, count, [&](size_t) { try { Require(root, "pods[3].nope"); } catch (PathException const &) {} });
+      double tryRequire = Throughput(1, count, [&](size_t) { TryRequire(root, "pods[3].nope"); });
+      double select = Throughput(1, count, [&](size_t) { Select(root, "pods[3].nope"); });
+      double trySelect = Throughput(1, count, [&](size_t) { TrySelect(root, "pods[3].nope"); });
+      std::cout << "  Require " << size_t(require) << " /s, TryRequire " << size_t(tryRequire) << " /s\n"
+                << "  Select " << size_t(select) << " /s, TrySelect " << size_t(trySelect) << " /s\n";
+   }
+
+   void EnsureManyKeys()
+   {
+      for (size_t count : { 25000, 50000, 100000 })
+      {
+         std::vector<std::string> paths;
+         for (size_t i = 0; i < count; ++i)
+            paths.push_back("items.k" + std::to_string(i) + ".value");
+
+         Node root;
+         root.reset(Node(NodeType::Map));
+         auto start = Clock::now();
+         EnsureMany(root, paths);
+         double t = Seconds(start);
+         std::cout << "  " << count << " keys: " << t * 1000 << " ms, " << t * 1e9 / count << " ns/key\n";
+      }
+
+      for (size_t count : { 2500, 5000 })
+      {
+         Node root;
+         root.reset(Node(NodeType::Map));
+         auto start = Clock::now();
+         for (size_t i = 0; i < count; ++i)
+            Ensure(root, "items.k" + std::to_string(i) + ".value");
+         double t = Seconds(start);
+         std::cout << "  Ensure, " << count << " keys: " << t * 1000 << " ms, " << t * 1e9 / count << " ns/key\n";
+      }
+   }
+
+   void Upsert()
+   {
+      auto MakeUsers = [](size_t count)
+      {
+         Node root;
+         root.reset(Node(NodeType::Map));
+         for (size_t i = 0; i < count; ++i)
+         {
+            Node user(NodeType::Map);
+            user["id"] = i;
+            root["users"].push_back(user);
+         }
+         return root;
+      };
+
+      const size_t count = 20000;
+      {
+         auto root = MakeUsers(count);
+         auto start = Clock::now();
+         for (size_t i = 0; i < 2000; ++i)   // half existing, half appended
+            EnsureExists(root, "users.{id=%}.seen", { std::to_string(i * 20) });
+         double t = Seconds(start);
+         std::cout << "  EnsureExists, 2000 upserts into " << count << " users: " << t * 1e6 / 2000 << " us/upsert\n";
+      }
+      {
+         auto root = MakeUsers(count);
+         EnsureBatch batch(root);
+         auto start = Clock::now();
+         for (size_t i = 0; i < 200000; ++i)
+            batch.Ensure("users.{id=%}.seen", { std::to_string(i % (2 * count)) });
+         double t = Seconds(start);
+         std::cout << "  EnsureBatch, 200000 upserts into " << count << " users: " << t * 1e6 / 200000 << " us/upsert, "
+                   << root["users"].size() << " users\n";
+      }
+   }
+
+   void Binding()
+   {
+      struct Config
+      {
+         std::string name, host, logLevel, logFile;
+         int port = 0, workers = 0, timeout = 0, retries = 0;
+         double ratio = 0;
+         bool tls = false;
+      };
+      static const PathBinding<Config> binding = {
+         { "service.name", &Config::name },
+         { "service.server.host", &Config::host },
+         { "service.server.port", &Config::port },
+         { "service.server.workers", &Config::workers },
+         { "service.server.tls", &Config::tls },
+         { "service.client.timeout", &Config::timeout },
+         { "service.client.retries", &Config::retries },
+         { "service.client.ratio", &Config::ratio },
+         { "service.log.level", &Config::logLevel },
+         { "service.log.file", &Config::logFile },
+      };
+
+      auto root = Load(R"(
+service:
+  name: api
+  owner: team
+  labels: { a: 1, b: 2, c: 3 }
+  server: { host: example.org, port: 8080, workers: 16, tls: true, backlog: 128 }
+  client: { timeout: 30, retries: 3, ratio: 0.25 }
+  log: { level: info, file: /var/log/api.log, rotate: daily }
+)");
+
+      const size_t count = 100000;
+      Config config;
+      auto start = Clock::now();
+      for (size_t i = 0; i < count; ++i)
+      {
+         config.name = Select(root, "service.name").as<std::string>();
+         config.host = Select(root, "service.server.host").as<std::string>();
+         config.port = Select(root, "service.server.port").as<int>();
+         config.workers = Select(root, "service.server.workers").as<int>();
+         config.tls = Select(root, "service.server.tls").as<bool>();
+         config.timeout = Select(root, "service.client.timeout").as<int>();
+         config.retries = Select(root, "service.client.retries").as<int>();
+         config.ratio = Select(root, "service.client.ratio").as<double>();
+         config.logLevel = Select(root, "service.log.level").as<std::string>();
+         config.logFile = Select(root, "service.log.file").as<std::string>();
+      }
+      double select = Seconds(start);
+
+      size_t bound = 0;
+      start = Clock::now();
+      for (size_t i = 0; i < count; ++i)
+         bound += binding.Bind(root, config).bound;
+      double bind = Seconds(start);
+      std::cout << "  10 fields, Select().as<T>() per field: " << select * 1e6 / count << " us, PathBinding: " << bind * 1e6 / count << " us ("
+                << bound / count << " bound)\n";
+   }
+
+   void Distinct()
+   {
+      std::stringstream s;
+      s << "services:\n";
+      for (size_t i = 0; i < 100000; ++i)
+         s << "  - { name: svc" << i << ", image: 'registry/app" << (i % 500) << ":1." << (i % 3) << "', labels: { team: t" << (i % 40) << ", tier: " << (i % 2 ? "front" : "back") << " } }\n";
+      auto root = Load(s.str());
+
+      for (char const * path : { "services.image", "services.labels" })
+      {
+         auto start = Clock::now();
+         auto nodes = SelectNodes(root, path);
+         double select = Seconds(start);
+         std::vector<Node> kept;
+         for (auto & n : nodes)
+            if (std::none_of(kept.begin(), kept.end(), [&](Node const & k) { return YamlPathDetail::IsEqualNode(*YamlPathDetail::NodeAccess::Impl(k), *YamlPathDetail::NodeAccess::Impl(n)); }))
+               kept.push_back(n);
+         double pairwise = Seconds(start);
+
+         start = Clock::now();
+         auto distinct = SelectDistinct(root, path);
+         double hashed = Seconds(start);
+         std::cout << "  " << path << ": " << nodes.size() << " nodes, " << distinct.size() << " distinct: compare with kept "
+                   << pairwise * 1000 << " ms, SelectDistinct " << hashed * 1000 << " ms (SelectNodes " << select * 1000 << " ms)\n";
+      }
+   }
+
+   void TopK()
+   {
+      std::stringstream s;
+      s << "pods:\n";
+      for (size_t i = 0; i < 1000000; ++i)
+         s << "  - { name: pod" << i << ", restarts: " << (i * 7919) % 100003 << " }\n";
+      auto root = Load(s.str());
+
+      auto start = Clock::now();
+      auto pods = SelectNodes(root, "pods.{restarts=}");
+      std::vector<std::pair<int, size_t>> sorted;    // note: sorting Nodes would assign them
+      for (size_t i = 0; i < pods.size(); ++i)
+         sorted.emplace_back(pods[i]["restarts"].as<int>(), i);
+      std::stable_sort(sorted.begin(), sorted.end(), [](auto & a, auto & b) { return a.first > b.first; });
+      sorted.resize(10);
+      double user = Seconds(start);
+
+      start = Clock::now();
+      auto top = SelectNodes(root, "pods.!top(10,restarts)");
+      double stage = Seconds(start);
+
+      start = Clock::now();
+      auto all = SelectNodes(root, "pods.!sort(restarts)");
+      double sort = Seconds(start);
+      std::cout << "  top 10 of 1M: select and sort " << user * 1000 << " ms, !top " << stage * 1000 << " ms ("
+                << (top.size() == 10 && top[9].is(pods[sorted[9].second]) ? "same" : "different") << "); !sort " << sort * 1000 << " ms\n";
+   }
+
+   void Allocations()
+   {
+      auto root = MakePods(1000);
+      root["meta"] = Load("{ name : list, labels : { app : web, tier : front } }");
+      const size_t count = 100000;
+
+      for (char const * path : { "meta.labels.tier", "pods[42].name", "meta.labels.{tier=front}", "meta.labels.{tier=front,app}", "meta.nope" })
+      {
+         size_t allocs = AllocCount::Of([&] { Select(root, path); });
+         double rate = Throughput(1, count, [&](size_t) { Select(root, path); });
+         std::cout << "  " << path << ": " << allocs << " allocations, " << 1e9 / rate << " ns\n";
+      }
+   }
+
+   void DocumentStream()
+   {
+      const size_t count = 20000;
+      std::string text;
+      for (size_t i = 0; i < count; ++i)
+         text += "---\nseq: " + std::to_string(i) + "\nlevel: " + (i % 10 ? "info" : "error") + "\nmessage: event " + std::to_string(i) + "\ntags: [ a, b, c ]\n";
+
+      auto start = Clock::now();
+      size_t loadAllMatches = 0;
+      for (auto & doc : LoadAll(text))
+         loadAllMatches += SelectNodes(doc, "{level=error}.message").size();
+      double loadAll = Seconds(start);
+
+      start = Clock::now();
+      std::istringstream parseOnly(text);
+      ForEachDocument(parseOnly, [](size_t, Node const &) {});
+      double parse = Seconds(start);
+
+      start = Clock::now();
+      std::istringstream in(text);
+      size_t matches = 0;
+      SelectEachDocument(in, "{level=error}.message", [&](size_t, std::vector<Node> const & m) { matches += m.size(); });
+      double stream = Seconds(start);
+
+      std::cout << "  " << count << " documents: LoadAll + SelectNodes " << loadAll * 1000 << " ms, parse only " << parse * 1000
+                << " ms, SelectEachDocument " << stream * 1000 << " ms (" << matches << " / " << loadAllMatches << " matches)\n";
+   }
+
+   void Batch()
+   {
+      const size_t sourceCount = 400;
+      std::vector<std::string> texts(sourceCount);
+      size_t bytes = 0;
+      for (size_t i = 0; i < sourceCount; ++i)
+      {
+         for (size_t d = 0; d < 20; ++d)
+            texts[i] += "---\nmetadata: { name: app" + std::to_string(d) + ", labels: { tier: " + (d % 3 ? "back" : "front") + " } }\n"
+                        "spec: { replicas: " + std::to_string(d % 5) + ", containers: [ { name: main, image: 'img:1' }, { name: sidecar, image: 'log:2' } ] }\n";
+         bytes += texts[i].size();
+      }
+
+      std::vector<BatchSource> sources;
+      for (size_t i = 0; i < sourceCount; ++i)
+         sources.push_back(BatchSource::Buffer(std::to_string(i), texts[i]));
+      std::vector<CompiledPath> paths = { CompiledPath("metadata.name"), CompiledPath("spec.containers.image"), CompiledPath("metadata.labels.{tier=front}") };
+
+      for (size_t threads : ThreadCounts())
+      {
+         size_t documents = 0;
+         auto start = Clock::now();
+         SelectBatch(sources, paths, [&](BatchSourceResult & r) { documents += r.documents; }, { threads });
+         double t = Seconds(start);
+         std::cout << "  threads: " << threads << "   " << size_t(documents / t) << " documents/s, " << bytes / t / 1e6 << " MB/s\n";
+      }
+   }
+
+   void Frozen()
+   {
+      const size_t podCount = 1000;
+      auto root = MakePods(podCount);
+      root["meta"] = Load("{ name : list, labels : { app : web, tier : front } }");
+      FrozenDocument frozen(root);
+
+      std::cout << "  memory: Node " << PoolStats(root).poolBytes / 1024 << " KB, FrozenDocument " << frozen.MemoryUsage() / 1024 << " KB\n";
+
+      const size_t count = 100000;
+      for (char const * path : { "meta.labels.tier", "pods[742].name", "pods.{phase=Pending}" })
+      {
+         CompiledPath compiled(path);
+         size_t n = strchr(path, '{') ? count / 500 : count;
+         double nodes = Throughput(1, n, [&](size_t) { SelectNodes(root, path); });
+         double compiledNodes = Throughput(1, n, [&](size_t) { SelectNodes(root, compiled); });
+         double frozenPath = Throughput(1, n, [&](size_t) { frozen.Select(path); });
+         double frozenCompiled = Throughput(1, n, [&](size_t) { frozen.Select(compiled); });
+         std::cout << "  " << path << ": SelectNodes " << 1e9 / nodes << " ns (compiled " << 1e9 / compiledNodes << " ns), "
+                   << "FrozenDocument " << 1e9 / frozenPath << " ns (compiled " << 1e9 / frozenCompiled << " ns)\n";
+      }
+   }
+
+   void Cache()
+   {
+      auto root = MakePods(1000);
+      QueryCache cache(root);
+      const size_t count = 2000;
+      double direct = Throughput(1, count, [&](size_t i) { SelectNodes(root, "pods.{phase=Pending,node=%}.name", { i % 2 ? "n1" : "n2" }); });
+      double cached = Throughput(1, count, [&](size_t i) { cache.SelectNodes("pods.{phase=Pending,node=%}.name", { i % 2 ? "n1" : "n2" }); });
+      std::cout << "  filter over 1000 pods: SelectNodes " << 1e9 / direct << " ns, QueryCache " << 1e9 / cached << " ns\n";
+
+      double ensure = Throughput(1, count, [&](size_t) { EnsureExists(root, "meta.touched"); });
+      std::cout << "  EnsureExists with a cache attached: " << 1e9 / ensure << " ns\n";
+   }
+
+   void Resumable()
+   {
+      auto root = MakePods(100000);
+      CompiledPath path("pods.{phase=Pending}.name");
+      double direct = Throughput(1, 10, [&](size_t) { SelectNodes(root, path); });
+      size_t calls = 0;
+      double sliced = Throughput(1, 10, [&](size_t)
+      {
+         PathEvaluation eval(root, path);
+         while (eval.Resume({ SIZE_MAX, std::chrono::microseconds(100) }) == EPathEvalState::Pending) {}
+         calls = eval.Calls();
+      });
+      std::cout << "  filter over 100000 pods: SelectNodes " << 1e6 / direct << " us, PathEvaluation in 100 us slices " << 1e6 / sliced << " us (" << calls << " slices)\n";
+   }
+
+   void Indexed()
+   {
+      std::stringstream s;
+      s << "items:\n";
+      for (int i = 0; i < 2000; ++i)
+      {
+         s << "  - { Status: " << (i % 5 ? "ok" : "failed");
+         for (int k = 0; k < 60; ++k)
+            s << ", Field" << k << ": " << k;
+         s << " }\n";
+      }
+      auto root = Load(s.str());
+      IndexedDocument doc(root);
+      doc.SelectNodes("items.{^status=failed}");      // build the indexes
+      double scan = Throughput(1, 20, [&](size_t) { SelectNodes(root, "items.{^field59=59}"); });
+      double indexed = Throughput(1, 20, [&](size_t) { doc.SelectNodes("items.{^field59=59}"); });
+      std::cout << "  {^key=value} over 2000 maps of 61 keys: scan " << 1e6 / scan << " us, folded key index " << 1e6 / indexed << " us"
+         << " (" << doc.MemoryUsage() / 1024 << " KB)\n";
+   }
+
+   void KeySignatures()
+   {
+      // most maps don't contain the key selected
+      std::stringstream s;
+      s << "items:\n";
+      for (size_t i = 0; i < 100000; ++i)
+         s << "  - { id: " << i << ", kind: k" << i % 5 << ", size: " << i % 100 << ", color: c" << i % 3 << ", shape: s" << i % 4
+           << (i % 20 ? "" : ", owner: bob") << " }\n";
+      auto root = Load(s.str());
+      IndexOptions options;
+      options.keySignatures = true;
+      IndexedDocument doc(root, options);
+      doc.SelectNodes("items.owner");      // build the signatures
+      double scan = Throughput(1, 20, [&](size_t) { SelectNodes(root, "items.{owner=bob}"); SelectNodes(root, "items.owner"); });
+      double indexed = Throughput(1, 20, [&](size_t) { doc.SelectNodes("items.{owner=bob}"); doc.SelectNodes("items.owner"); });
+      std::cout << "  {owner=bob} and .owner over 100000 maps, 5% with the key: scan " << 1e6 / scan << " us, key signatures " << 1e6 / indexed << " us"
+         << " (" << doc.MemoryUsage() / 1024 << " KB)\n";
+   }
+
+   void KeyPrefix()
+   {
+      std::stringstream s;
+      s << "metrics:\n";
+      for (int i = 0; i < 50000; ++i)
+         s << "  " << (i % 2 ? "cpu" : "mem") << i << ": " << i << "\n";
+      auto root = Load(s.str());
+      IndexedDocument doc(root);
+      doc.SelectNodes("metrics.{cpu1*}");      // build the index
+      double scan = Throughput(1, 20, [&](size_t) { SelectNodes(root, "metrics.{cpu123*}"); });
+      double indexed = Throughput(1, 20, [&](size_t) { doc.SelectNodes("metrics.{cpu123*}"); });
+      std::cout << "  {cpu123*} on a map of 50000 keys: scan " << 1e6 / scan << " us, sorted key index " << 1e6 / indexed << " us"
+         << " (" << doc.MemoryUsage() / 1024 << " KB)\n";
+   }
 
+   void Ordered()
+   {
+      std::stringstream s;
+      s << "events:\n";
+      for (size_t i = 0; i < 500000; ++i)
+         s << "  - { id: " << i << ", load: " << (i * 7919) % 10007 << " }\n";
+      auto root = Load(s.str());
+      CompiledPath path("events.{load>10000}");
+      double scan = Throughput(1, 5, [&](size_t) { SelectNodes(root, path); });
+      OrderedIndex index(root, "events", "load");
+      SelectNodes(root, path);      // build the index
+      double indexed = Throughput(1, 20, [&](size_t) { SelectNodes(root, path); });
+      double append = Throughput(1, 1000, [&](size_t i)
+      {
+         std::string load = std::to_string(5000 + i % 100);
+         Ensure(root, "events.[%].{load=%}", { 500000 + i, load });
+         SelectNodes(root, path);
+      });
+      std::cout << "  {load>10000} over 500000 events (" << SelectNodes(root, path).size() << " matches): scan " << 1e6 / scan << " us, ordered index " << 1e6 / indexed
+         << " us, append + select " << 1e6 / append << " us (" << index.MemoryUsage() / 1024 << " KB, " << index.Rebuilds() << " rebuilds)\n";
+   }
 
+   void FilterBlocks()
+   {
+      auto root = MakePods(200000);
+      CompiledPath path("pods.{phase=Running}");
+      double blocks = Throughput(1, 10, [&](size_t) { SelectNodes(root, path); });
+      double elementWise = Throughput(1, 10, [&](size_t) { SelectNodes(root, path, PathLimits()); });
+      std::cout << "  {phase=Running} over 200000 pods: blocks " << 1e6 / blocks << " us, element-wise " << 1e6 / elementWise << " us\n";
+   }
+
+   struct Entry { char const * name; void (*run)(); };
+   Entry All[] =
+   {
+      { "SelectNodes concurrent", SelectNodesConcurrent },
+      { "failed lookups", FailedLookups },
+      { "EnsureMany", EnsureManyKeys },
+      { "upsert", Upsert },
+      { "struct binding", Binding },
+      { "distinct", Distinct },
+      { "top k", TopK },
+      { "allocations per Select", Allocations },
+      { "document stream", DocumentStream },
+      { "batch", Batch },
+      { "frozen document", Frozen },
+      { "query cache", Cache },
+      { "resumable evaluation", Resumable },
+      { "indexed document", Indexed },
+      { "key signatures", KeySignatures },
+      { "key prefix index", KeyPrefix },
+      { "ordered index", Ordered },
+      { "map filter blocks", FilterBlocks },
+   };
+
+   int Run(char const * filter)
+   {
+      for (auto & b : All)
+      {
+         if (filter && !strstr(b.name, filter))
+            continue;
+         std::cout << b.name << "\n";
+         b.run();
+      }
+      return 0;
+   }
+}
 
 
 bool is(char const * a, char const * b) { return _stricmp(a, b) == 0; }
 bool is(char const * a, char const * b, char const * balt) { return is(a,b) || (balt && is(a,balt)); }
 
+/// --batch mode: evaluates paths on many files using \ref SelectBatch
+int RunBatch(int argc, char ** argv)
+{
+   using namespace YAML;
+   std::vector<CompiledPath> paths;
+   std::vector<BatchSource> sources;
+   BatchOptions options;
+
+   try
+   {
+      for (int i = 2; i < argc; ++i)
+      {
+         if ((is(argv[i], "-p", "--path")) && i + 1 < argc)
+            paths.emplace_back(argv[++i]);
+         else if ((is(argv[i], "-j", "--threads")) && i + 1 < argc)
+            options.threads = strtoul(argv[++i], nullptr, 10);
+         else if (is(argv[i], "-u", "--unordered"))
+            options.ordered = false;
+         else
+            sources.push_back(BatchSource::File(argv[i]));
+      }
+   }
+   catch (PathException const & x)
+   {
+      std::cout << "ERROR: " << x.what() << "\n";
+      return 1;
+   }
+
+   if (paths.empty() || sources.empty())
+   {
+      std::cout << "--batch requires at least one path and one file. use -h for help.\n";
+      return 1;
+   }
+
+   int result = 0;
+   SelectBatch(sources, paths, [&](BatchSourceResult & r)
+   {
+      auto & name = sources[r.source].name;
+      for (auto & m : r.matches)
+      {
+         Emitter out;
+         out << Flow << BeginSeq;
+         for (auto & node : m.nodes)
+            out << node;
+         out << EndSeq;
+         std::cout << name << "[" << m.document << "] " << paths[m.path].Path() << ": " << out.c_str() << "\n";
+      }
+      if (!r.error.empty())
+      {
+         std::cout << name << ": ERROR: " << r.error << "\n";
+         result = 1;
+      }
+   }, options);
+   return result;
+}
+
 int main(int argc, char ** argv)
 {
    auto is_ = [&](int argidx, char const * b, char const * balt = nullptr)
@@ -736,11 +2829,26 @@ int main(int argc, char ** argv)
    if (is_(1, "--runtests", "-r"))
       return doctest::Context(argc-1, argv+1).run();
 
+   if (is_(1, "--benchmark", "-b"))
+      return Bench::Run(argc > 2 ? argv[2] : nullptr);
+
+   if (is_(1, "--batch", "-m"))
+      return RunBatch(argc, argv);
+
    if (argc == 1 || (argc == 2 && is_(1, "--help", "-h")))
    {
       std::cout << R"(Options:
  --runtest, -r   (must be first) Run unit tests. all following arguments are passed to doctest.
 
+ --benchmark, -b [<name>]  Run all benchmarks, or those whose name contains <name>
+
+ --batch, -m -p <path> [-p <path> ...] [-j <threads>] [-u] <YAMLFile> ...
+
+   Evaluate the paths on all documents of all files, using multiple threads.
+   Prints the nodes matched as "<file>[<document>] <path>: [ <nodes> ]", in the order of the files.
+   -j sets the number of threads (default: one per hardware thread), 
+   -u prints results as soon as a file is completed, instead of in the order of the files
+
  --help, -h      (must be the only argument) show this help
 
  <YAMLFile> <path> [-v|--verbose] [<command>]
@@ -19,11 +19,31 @@ The most important methods are
 
    - \ref Select "Select"(node, path) selecting a node. If no node can be matched, an empty node is returned
    - \ref Require "Require"(node, path) Like \c select, but failure to match a node throws an exception
+   - \ref TrySelect, \ref TryRequire like \c Select and \c Require, but return errors in a \ref PathResult instead of throwing
+   - \ref SelectNodes reads nodes without modifying the document; \ref SelectDistinct returns each distinct value once
+   - \ref Ensure "Ensure"(node, path) creating the nodes selected by path if they don't exist; \ref EnsureMany for many paths at once
+   - \ref CompiledPath scans a path once, for evaluating it many times; \ref PathEvaluation (<tt>yaml-resume.h</tt>) evaluates it in slices of limited work
    - \ref PathResolve for incremental matching
    - \ref PathValidate for validating a path
 
    - \ref SelectByKey, \ref SelectByIndex, \ref SelectBySeqMapFilter
 
+# Utilities
+
+   - \ref FrozenDocument (<tt>yaml-frozen.h</tt>) an immutable, compact copy of a document for fast read-only lookups
+   - \ref IndexedDocument (<tt>yaml-index.h</tt>) evaluates paths using indexes of the document's maps, built on first use
+   - \ref OrderedIndex (<tt>yaml-ordered.h</tt>) sorts the values of a field over a sequence, for comparisons like <code>{load>'0.8'}</code>
+   - \ref QueryCache (<tt>yaml-cache.h</tt>) remembers query results for a document until it is modified
+   - \ref PathSubscriptions (<tt>yaml-watch.h</tt>) keeps path results up to date as the document is modified, and reports nodes added and removed
+   - \ref ExtractColumns (<tt>yaml-columns.h</tt>) extracts multiple fields from all elements of a sequence in a single pass
+   - \ref PathBinding (<tt>yaml-bind.h</tt>) decodes the members of a struct from paths scanned once, in a single pass over the document
+   - \ref SelectEachDocument (<tt>yaml-stream.h</tt>) evaluates a path on each document of a multi-document stream, one document at a time;
+     \ref SelectBatch evaluates paths on many files or buffers in parallel
+   - \ref Accumulate (<tt>yaml-accumulate.h</tt>) accumulates node values
+   - \ref PathExplain (<tt>yaml-explain.h</tt>) reports nodes visited, allocations and time for each selector of a path
+   - \ref GetPathMetrics and \ref SetPathSlowQueryHandler (<tt>yaml-metrics.h</tt>) collect call counts, errors and latency per path, if compiled with <code>YAML_PATH_METRICS=1</code>
+   - \ref PoolStats and \ref Compact (<tt>yaml-pool.h</tt>) measure and reclaim memory of unreachable nodes in long-lived documents
+
 
 # Selectors
 
@@ -63,6 +83,25 @@ If \c node is a sequence, selects all maps from the sequence that contain a key
 independent of its value.\n
 To check for an empty key, you can use quotes, e.g. <code>Select(node, "{key=''}"</code> (see quoting)
 
+Comparisons <code>{key<value}</code>, <code>{key<=value}</code>, <code>{key>value}</code> and <code>{key>=value}</code> select maps
+whose value for \c key is a scalar ordered accordingly. If \c value is a number, only numbers match, and are compared as numbers.
+Otherwise, values that are not numbers are compared as strings, e.g. <code>{since>='2024-05-01'}</code>.
+Values containing a period or a dash need to be quoted or bound, e.g. <code>{load>'0.8'}</code>.
+An \ref OrderedIndex answers comparisons on a large sequence without checking each element.
+
+## Sort and Top
+
+<code>Select(node, "pods.!sort(name)")</code> or <code>Select(node, "pods.{phase=Running}.!top(10,restarts)")</code>
+
+Applied to a sequence, or to the nodes selected from a sequence (e.g. by a seq-map filter), <code>!sort(field)</code> selects
+the maps ordered by their value for \c field, ascending. <code>!top(k,field)</code> selects the \c k maps with the highest values,
+highest first. Values are ordered like comparisons: numbers as numbers, other scalars as strings, numbers before other scalars.
+\c sort keeps the maps without a value for \c field at the end, \c top skips them. Equal values keep their order.
+Without a field, e.g. <code>pods.restarts.!top(3)</code>, the nodes are ordered by their own values.
+
+Each value is parsed once. \c top keeps only \c k nodes while scanning, and takes O(n log k) time for n nodes.
+\c k and \c field can be bound (see argument binding).
+
 ## Selector Chaining
 
 <code>Select(node, "keyA.keyB")</code>
@@ -79,6 +118,7 @@ All <i>string tokens</i> can be quoted. String tokens are:
    - key selector
    - key of a seq-map filter
    - value of a seq-map filter
+   - field of \c sort and \c top
 
 The token can be wrapped either in single or double quotes. A token in single quotes may contain double quotes, and vice versa.
 
@@ -90,7 +130,7 @@ The token can be wrapped either in single or double quotes. A token in single qu
 Each element in the list can be initialized by either a \c PathArg or an unsigned integer.
 If a \c "%" is found where a a <i>bindable token</i> is expected, the next value from the argument list is taken instead.
 
-Bindable tokens are all string tokens (see "Quoting") and the value of an index selector.
+Bindable tokens are all string tokens (see "Quoting"), the value of an index selector, and the arguments of \c sort and \c top.
 
 ## Character Set and Case Sensitivity
 
@@ -106,6 +146,12 @@ There are two categories of errors: \ref PathException::IsPathError "path errors
 \ref PathException::IsNodeError "node errors" indicate a failure
 to find a matching node for a selector.
 
+A third category, \ref PathException::IsLimitError "limit errors", indicates that an evaluation was stopped by \ref PathLimits
+(see the overloads of \ref SelectNodes and \ref PathResolve taking limits).
+
+\ref TrySelect and \ref TryRequire report errors as \ref PathErrorInfo, which does not allocate strings. 
+The message text of \ref PathException is formatted only when requested.
+
 
 */
 
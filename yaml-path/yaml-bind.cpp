@@ -0,0 +1,220 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-bind.h"
+#include "yaml-path-internals.h"
+#include <yaml-cpp/yaml.h>
+#include <algorithm>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      /// \internal a node of the selector tree of a \ref PathBinding: a selector, applied to the nodes selected by the parent step
+      struct BindStep
+      {
+         SelectorRecord      selector;
+         std::vector<size_t> fields;                   // fields whose path ends at this step
+         std::vector<size_t> children;                 // steps continuing from this one
+         std::unordered_map<PathArg, size_t> keys;     // children that are key selectors, by key, matched in a single scan of a map
+      };
+
+      /// \internal a field of a \ref PathBinding, holding its path
+      struct BindField
+      {
+         std::string     path;
+         bool            required = true;
+         BindDecoder     decode;
+         BindListDecoder decodeList;
+      };
+
+      /// \internal the compiled \ref PathBinding. The selectors of the steps refer to the paths of the fields
+      struct BindTable
+      {
+         std::vector<BindField> fields;
+         std::vector<BindStep>  steps;      // steps[0] is the node bound, and has no selector
+      };
+
+      std::shared_ptr<BindTable const> CompileBindTable(BindFieldSpec const * fields, size_t count)
+      {
+         auto table = std::make_shared<BindTable>();
+         table->fields.resize(count);   // not resized later: the selectors refer to the paths
+         for (size_t i = 0; i < count; ++i)
+         {
+            table->fields[i].path.assign(fields[i].path);
+            table->fields[i].required = fields[i].required;
+            table->fields[i].decode = fields[i].decode;
+            table->fields[i].decodeList = fields[i].decodeList;
+         }
+
+         auto & steps = table->steps;
+         steps.emplace_back();
+         SelectorList selectors;
+         for (size_t i = 0; i < count; ++i)
+         {
+            PathErrorInfo info;
+            if (ScanSelectors(selectors, table->fields[i].path, {}, &info) != EPathError::OK)
+               throw PathException(info, fields[i].path);
+
+            size_t step = 0;
+            for (auto & sel : selectors)
+            {
+               auto & children = steps[step].children;
+               auto it = std::find_if(children.begin(), children.end(), [&](size_t child) { return IsSameSelector(steps[child].selector, sel); });
+               if (it != children.end())
+               {
+                  step = *it;
+                  continue;
+               }
+
+               size_t child = steps.size();
+               steps.emplace_back();
+               steps[child].selector = sel;
+               steps[step].children.push_back(child);
+               if (sel.selector == ESelector::Key)
+                  steps[step].keys.emplace(std::get<ArgKey>(sel.data).key, child);
+               step = child;
+            }
+            steps[step].fields.push_back(i);
+         }
+         return table;
+      }
+
+      /// \internal state of one \ref PathBinding::Bind
+      class Binder
+      {
+      public:
+         Binder(BindTable const & table, void * target, PathBindResult & result) :
+            m_table(table), m_target(target), m_result(result), m_values(table.steps.size()), m_found(table.steps.size())
+         {
+            m_ctx.readOnly = true;
+         }
+
+         void Apply(size_t step, EvalNodes const & nodes);
+
+      private:
+         BindTable const &  m_table;
+         void *             m_target;
+         PathBindResult &   m_result;
+         EvalContext        m_ctx;
+         std::vector<Node>  m_values;   // by step: the value matched by the scan of the parent's map
+         std::vector<bool>  m_found;
+
+         void Decode(size_t field, EvalNodes const & nodes);
+         void Missing(size_t step);
+         void Report(size_t field, EBindError error) { m_result.issues.push_back({ field, m_table.fields[field].path, error }); }
+      };
+
+      void Binder::Decode(size_t field, EvalNodes const & nodes)
+      {
+         auto & f = m_table.fields[field];
+         if (!nodes.isList && (!nodes.node || nodes.node.IsNull()))
+         {
+            if (f.required)
+               Report(field, EBindError::Missing);
+            return;
+         }
+
+         bool ok = false;
+         try
+         {
+            ok = nodes.isList ? f.decodeList(nodes.list, m_target) : f.decode(nodes.node, m_target);   // a list is not materialized: that would modify the document
+         }
+         catch (YAML::Exception const &)   // conversions of containers call as<T>() for their elements
+         {
+         }
+         if (ok)
+            ++m_result.bound;
+         else
+            Report(field, EBindError::Malformed);
+      }
+
+      /// \internal reports the required fields at \c step and after it as missing
+      void Binder::Missing(size_t step)
+      {
+         auto & s = m_table.steps[step];
+         for (auto field : s.fields)
+            if (m_table.fields[field].required)
+               Report(field, EBindError::Missing);
+         for (auto child : s.children)
+            Missing(child);
+      }
+
+      /// \internal decodes the fields ending at \c step from \c nodes, and continues with the steps after it
+      void Binder::Apply(size_t step, EvalNodes const & nodes)
+      {
+         auto & s = m_table.steps[step];
+         for (auto field : s.fields)
+            Decode(field, nodes);
+
+         // the keys selected from a map by all children are matched in a single scan of its keys
+         auto impl = nodes.isList ? nullptr : NodeAccess::Impl(nodes.node);
+         const bool scanKeys = !s.keys.empty() && impl && impl->type() == NodeType::Map;
+         if (scanKeys)
+         {
+            size_t pending = s.keys.size();
+            for (auto it = impl->begin(); it != impl->end() && pending; ++it)
+            {
+               auto kv = *it;
+               if (kv.first->type() != NodeType::Scalar)
+                  continue;
+               auto key = s.keys.find(kv.first->scalar());
+               if (key == s.keys.end() || m_found[key->second])
+                  continue;   // like FindKey, the first of duplicate keys wins
+               m_values[key->second].reset(NodeAccess::Make(*kv.second, nodes.node));
+               m_found[key->second] = true;
+               --pending;
+            }
+         }
+
+         for (auto child : s.children)
+         {
+            auto & sel = m_table.steps[child].selector;
+            if (scanKeys && sel.selector == ESelector::Key)
+            {
+               if (m_found[child])
+                  Apply(child, EvalNodes{ m_values[child] });
+               else
+                  Missing(child);
+               continue;
+            }
+
+            EvalNodes next(nodes);   // note: assigning EvalNodes would assign the nodes
+            if ((!next.isList && !next.node) || ApplySelector(next, sel.selector, sel.data, m_ctx) != EPathError::OK)
+               Missing(child);
+            else
+               Apply(child, next);
+         }
+      }
+
+      PathBindResult BindFields(BindTable const & table, Node const & node, void * target)
+      {
+         PathBindResult result;
+         Binder binder(table, target, result);
+         binder.Apply(0, EvalNodes{ node });
+         std::sort(result.issues.begin(), result.issues.end(), [](PathBindIssue const & a, PathBindIssue const & b) { return a.field < b.field; });
+         return result;
+      }
+   }
+}
@@ -0,0 +1,214 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <yaml-cpp/node/convert.h>
+#include <charconv>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      struct BindTable;
+
+      /// \internal decodes the value of a field into the struct at \c target
+      using BindDecoder = std::function<bool(Node const & value, void * target)>;
+
+      /// \internal decodes the values of a field whose path selected several nodes into the struct at \c target
+      using BindListDecoder = std::function<bool(std::vector<Node> const & values, void * target)>;
+
+      /// \internal type-independent part of \ref PathBindField
+      struct BindFieldSpec
+      {
+         PathArg         path;
+         bool            required = true;
+         BindDecoder     decode;
+         BindListDecoder decodeList;
+      };
+
+      std::shared_ptr<BindTable const> CompileBindTable(BindFieldSpec const * fields, size_t count);
+
+      /** \internal decodes \c value like \c YAML::convert<T>. Decimal numbers are parsed without the stream \c convert uses;
+          other notations (e.g. <code>0x1F</code>, <code>010</code> or <code>.inf</code>) are left to \c convert.
+      */
+      template <typename T>
+      bool DecodeValue(Node const & value, T & result)
+      {
+         constexpr bool isInteger = std::is_integral_v<T> && !std::is_same_v<T, bool> && sizeof(T) > 1;   // convert decodes char types as characters
+         if constexpr (isInteger || std::is_floating_point_v<T>)
+         {
+            if (value.IsScalar())
+            {
+               auto & s = value.Scalar();
+               size_t digit = !s.empty() && s[0] == '-';
+               if (digit < s.size() && s[digit] >= '0' && s[digit] <= '9' && (!isInteger || s[digit] != '0' || s.size() == digit + 1))
+               {
+                  auto end = s.data() + s.size();
+                  auto parsed = std::from_chars(s.data(), end, result);
+                  if (parsed.ec == std::errc() && parsed.ptr == end)
+                     return true;
+               }
+            }
+         }
+         return convert<T>::decode(value, result);
+      }
+
+      /// \internal true for containers that \c convert decodes from a sequence by appending its elements, e.g. \c std::vector
+      template <typename T, typename = void>
+      struct IsBindSequence : std::false_type {};
+
+      template <typename T>
+      struct IsBindSequence<T, std::void_t<decltype(std::declval<T &>().push_back(std::declval<typename T::value_type>()))>>
+         : std::bool_constant<!std::is_same_v<T, std::basic_string<typename T::value_type>>> {};
+
+      /// \internal decodes \c values like \c YAML::convert<T> decodes a sequence of them, without building the sequence
+      template <typename T>
+      bool DecodeValues(std::vector<Node> const & values, T & result)
+      {
+         if constexpr (IsBindSequence<T>::value)
+         {
+            for (auto & value : values)
+            {
+               typename T::value_type element;
+               if (!DecodeValue(value, element))
+                  return false;
+               result.push_back(std::move(element));
+            }
+            return true;
+         }
+         return false;
+      }
+   }
+
+   /// why a field of a \ref PathBinding was not bound
+   enum class EBindError
+   {
+      Missing,       ///< the path of a required field selects no node, or a null node
+      Malformed,     ///< the node selected cannot be decoded as the type of the member (see \c YAML::convert)
+   };
+
+   /// a field that was not bound by \ref PathBinding::Bind
+   struct PathBindIssue
+   {
+      size_t     field = 0;                 ///< index of the field in the binding
+      PathArg    path;                      ///< path of the field. Refers to the \ref PathBinding
+      EBindError error = EBindError::Missing;
+   };
+
+   /// result of \ref PathBinding::Bind
+   struct PathBindResult
+   {
+      size_t bound = 0;                     ///< number of members assigned
+      std::vector<PathBindIssue> issues;    ///< fields missing or malformed, in the order of the fields
+
+      explicit operator bool() const { return issues.empty(); }   ///< true if all required fields were bound
+   };
+
+   namespace YamlPathDetail
+   {
+      PathBindResult BindFields(BindTable const & table, Node const & node, void * target);
+   }
+
+   /** A field of a \ref PathBinding: a path, relative to the node bound, and the member of \c TStruct it is decoded into.
+       The member is decoded by \c YAML::convert<T>, like <code>node.as<T>()</code>.
+       If \c required is false, the field may be missing (or null), and the member keeps its value.
+       A path selecting several nodes (e.g. <code>servers.name</code>) is decoded like a sequence of them, into a member that
+       \c convert decodes from a sequence by appending the elements (e.g. \c std::vector). The sequence is not built.
+   */
+   template <typename TStruct>
+   struct PathBindField : YamlPathDetail::BindFieldSpec
+   {
+      template <typename T>
+      PathBindField(PathArg path, T TStruct::* member, bool required = true)
+      {
+         this->path = path;
+         this->required = required;
+         this->decode = [member](Node const & value, void * target)
+         {
+            T decoded;   // a failed conversion may have modified its target
+            if (!YamlPathDetail::DecodeValue(value, decoded))
+               return false;
+            static_cast<TStruct *>(target)->*member = std::move(decoded);
+            return true;
+         };
+         this->decodeList = [member](std::vector<Node> const & values, void * target)
+         {
+            T decoded;
+            if (!YamlPathDetail::DecodeValues(values, decoded))
+               return false;
+            static_cast<TStruct *>(target)->*member = std::move(decoded);
+            return true;
+         };
+      }
+   };
+
+   /** Decodes nodes into the members of \c TStruct, each member from the node selected by a path.
+
+      The paths are scanned once, when the binding is constructed, into a tree of their selectors. Paths sharing a prefix
+      share the nodes of the tree, so \ref Bind resolves each prefix once, and matches all keys selected from a map in
+      a single scan over its keys. Missing and malformed fields do not stop \ref Bind: all fields are decoded in one pass,
+      and the fields that were not bound are reported in the result.
+
+      The constructor throws a \ref PathException if a path is malformed. Bound arguments are not supported.
+      A \c PathBinding is immutable: copies share the tree, and it can be used by many threads concurrently.
+      \ref Bind does not modify the document, so threads may also bind from the same document concurrently.
+
+      \code
+      struct Server { std::string host; int port = 80; std::vector<std::string> tags; };
+
+      static const PathBinding<Server> serverBinding = {
+         { "server.host", &Server::host },
+         { "server.port", &Server::port, false },
+         { "server.tags", &Server::tags, false },
+      };
+
+      Server server;
+      if (auto result = serverBinding.Bind(root, server); !result)
+         for (auto & issue : result.issues)
+            Report(issue.path, issue.error);
+      \endcode
+   */
+   template <typename TStruct>
+   class PathBinding
+   {
+   public:
+      PathBinding(std::initializer_list<PathBindField<TStruct>> fields)
+      {
+         std::vector<YamlPathDetail::BindFieldSpec> specs(fields.begin(), fields.end());
+         m_table = YamlPathDetail::CompileBindTable(specs.data(), specs.size());
+      }
+
+      /// decodes the fields from \c node into \c target. Members of fields that are not bound keep their value
+      PathBindResult Bind(Node const & node, TStruct & target) const { return YamlPathDetail::BindFields(*m_table, node, &target); }
+
+   private:
+      std::shared_ptr<YamlPathDetail::BindTable const> m_table;
+   };
+}
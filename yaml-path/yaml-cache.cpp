@@ -0,0 +1,177 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-cache.h"
+#include "yaml-path-internals.h"
+#include <mutex>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      /** \internal generation counters of documents that have a \ref QueryCache, by the memory holder of the root of the cache.
+          A counter exists as long as a cache refers to it.
+      */
+      struct GenerationRegistry
+      {
+         std::mutex lock;
+         std::unordered_map<detail::memory_holder const *, std::weak_ptr<std::atomic<uint64_t>>> documents;
+         std::atomic<size_t> count { 0 };    // size of documents, checked without locking
+      };
+
+      GenerationRegistry & Generations()
+      {
+         static GenerationRegistry * registry = new GenerationRegistry;    // not destroyed: caches may be destroyed during static destruction
+         return *registry;
+      }
+
+      std::shared_ptr<std::atomic<uint64_t>> AttachGeneration(Node const & root)
+      {
+         auto & r = Generations();
+         std::lock_guard<std::mutex> lock(r.lock);
+         auto & slot = r.documents[NodeAccess::Memory(root)];
+         auto generation = slot.lock();
+         if (!generation)
+         {
+            generation = std::make_shared<std::atomic<uint64_t>>(1);
+            slot = generation;
+         }
+         r.count = r.documents.size();
+         return generation;
+      }
+
+      void DetachGeneration(Node const & root, std::shared_ptr<std::atomic<uint64_t>> & generation)
+      {
+         auto & r = Generations();
+         std::lock_guard<std::mutex> lock(r.lock);
+         generation.reset();
+         auto it = r.documents.find(NodeAccess::Memory(root));
+         if (it != r.documents.end() && it->second.expired())
+            r.documents.erase(it);
+         r.count = r.documents.size();
+      }
+
+      /** \internal called before a document is modified. Costs one atomic load if no document has a \ref QueryCache.
+          The node may have another memory holder than the roots of the caches of its document, see \ref DocumentPool.
+      */
+      void BumpGeneration(Node const & node)
+      {
+         auto & r = Generations();
+         if (!r.count.load(std::memory_order_relaxed))
+            return;
+
+         std::lock_guard<std::mutex> lock(r.lock);
+         auto holder = NodeAccess::Memory(node);
+         for (auto & [root, slot] : r.documents)
+            if (SameDocument(root, holder))
+               if (auto generation = slot.lock())
+                  ++*generation;
+      }
+   }
+
+   using namespace YamlPathDetail;
+
+   /** Invalidates the results of all \ref QueryCache "QueryCaches" of the document that \c node belongs to.
+       Call after modifying the document other than through \ref Ensure.
+   */
+   void TouchDocument(Node const & node)
+   {
+      BumpGeneration(node);
+   }
+
+   QueryCache::QueryCache(Node const & root, size_t maxEntries) : m_root(root), m_maxEntries(maxEntries)
+   {
+      m_generation = AttachGeneration(m_root);
+   }
+
+   QueryCache::~QueryCache()
+   {
+      DetachGeneration(m_root, m_generation);
+   }
+
+   void QueryCache::Clear()
+   {
+      m_entries.clear();
+   }
+
+   /// \internal returns the entry for the query, or \c nullptr if the query needs to be evaluated; then \c m_key is set up for the new entry
+   QueryCache::Entry * QueryCache::Find(PathArg path, PathBoundArgs args)
+   {
+      // key: the path, followed by the bound arguments. '\0' does not occur in a path, and separates the arguments
+      m_key.assign(path);
+      for (auto & arg : args)
+      {
+         m_key += '\0';
+         if (auto index = std::get_if<size_t>(&arg))
+            m_key.append(1, 'i').append(std::to_string(*index));
+         else
+            m_key.append(1, 's').append(std::get<PathArg>(arg));
+      }
+
+      const uint64_t generation = m_generation->load(std::memory_order_acquire);
+      auto it = m_entries.find(m_key);
+      if (it != m_entries.end() && it->second.generation == generation)
+      {
+         ++m_hits;
+         return &it->second;
+      }
+
+      ++m_misses;
+      if (it == m_entries.end() && m_entries.size() >= m_maxEntries)
+         m_entries.clear();
+      return nullptr;
+   }
+
+   /** Returns the result of \ref SelectNodes for \c path and \c args, evaluating the path only if the result is not cached,
+       or the document was modified since.
+       The reference remains valid until the next call of \c SelectNodes or \ref Clear.
+       Throws a \ref PathException if \c path is malformed.
+   */
+   std::vector<Node> const & QueryCache::SelectNodes(PathArg path, PathBoundArgs args)
+   {
+      if (auto entry = Find(path, args))
+         return entry->nodes;
+
+      const uint64_t generation = m_generation->load(std::memory_order_acquire);
+      auto nodes = YAML::SelectNodes(m_root, path, args);
+      auto & entry = m_entries[m_key];
+      entry.nodes.swap(nodes);
+      entry.generation = generation;
+      return entry.nodes;
+   }
+
+   /// \copydoc QueryCache::SelectNodes(PathArg, PathBoundArgs)
+   std::vector<Node> const & QueryCache::SelectNodes(CompiledPath const & path)
+   {
+      if (auto entry = Find(path.Path(), {}))
+         return entry->nodes;
+
+      const uint64_t generation = m_generation->load(std::memory_order_acquire);
+      auto nodes = YAML::SelectNodes(m_root, path);
+      auto & entry = m_entries[m_key];
+      entry.nodes.swap(nodes);
+      entry.generation = generation;
+      return entry.nodes;
+   }
+}
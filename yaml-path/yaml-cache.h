@@ -0,0 +1,83 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+namespace YAML
+{
+   /** Remembers the results of \ref SelectNodes for one document, so repeated queries become lookups.
+
+      Results are keyed by path and bound arguments. They are discarded when the document is modified through
+      \ref Ensure, \ref EnsureExists or \ref EnsureBatch on any node of the document. After modifying the document
+      directly (e.g. through <code>Node::operator=</code>), call \ref TouchDocument.
+
+      A \c QueryCache is meant to be used by one thread, e.g. for the duration of a request.
+      When it holds \c maxEntries results, it is cleared.
+
+      \code
+      QueryCache cache(config);
+      auto & replicas = cache.SelectNodes("services.{name=%}.replicas", { service });
+      \endcode
+   */
+   class QueryCache
+   {
+   public:
+      explicit QueryCache(Node const & root, size_t maxEntries = 1024);
+      ~QueryCache();
+      QueryCache(QueryCache const &) = delete;
+      QueryCache & operator=(QueryCache const &) = delete;
+
+      std::vector<Node> const & SelectNodes(PathArg path, PathBoundArgs args = {});
+      std::vector<Node> const & SelectNodes(CompiledPath const & path);
+
+      void Clear();
+      size_t Size() const     { return m_entries.size(); }
+      size_t Hits() const     { return m_hits; }
+      size_t Misses() const   { return m_misses; }
+
+   private:
+      struct Entry
+      {
+         uint64_t generation = 0;
+         std::vector<Node> nodes;
+      };
+
+      Node                                      m_root;
+      std::shared_ptr<std::atomic<uint64_t>>    m_generation;   // shared by all caches of the document, see TouchDocument
+      std::unordered_map<std::string, Entry>    m_entries;
+      std::string                               m_key;          // reused to build the key of a query
+      size_t m_maxEntries;
+      size_t m_hits = 0;
+      size_t m_misses = 0;
+
+      Entry * Find(PathArg path, PathBoundArgs args);
+   };
+
+   void TouchDocument(Node const & node);
+}
@@ -0,0 +1,233 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-columns.h"
+#include "yaml-path-internals.h"
+#include <yaml-cpp/yaml.h>
+#include <charconv>
+#include <limits>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      /** \internal parses a YAML scalar as number.
+          Supports decimal and floating point notation, and the YAML 1.2 core schema specials <code>.inf, -.inf, .nan</code>
+      */
+      bool ParseNumber(std::string_view s, double & value)
+      {
+         if (s.empty())
+            return false;
+
+         if (s[0] == '+')
+            s.remove_prefix(1);
+         if (s.empty())
+            return false;
+
+         const bool neg = s[0] == '-';
+         auto special = neg ? s.substr(1) : s;
+         if (special == ".inf" || special == ".Inf" || special == ".INF")
+            return value = neg ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity(), true;
+         if (!neg && (special == ".nan" || special == ".NaN" || special == ".NAN"))
+            return value = std::numeric_limits<double>::quiet_NaN(), true;
+
+         auto end = s.data() + s.size();
+         auto result = std::from_chars(s.data(), end, value);
+         return result.ec == std::errc() && result.ptr == end;
+      }
+
+      /// \internal evaluation plan for one field of \ref ExtractColumns
+      struct ColumnPlan
+      {
+         SelectorList selectors;
+         bool         byKey = false;     // first selector is a key, and is matched in the single pass over the element's map
+      };
+
+      /// \internal stores the leaf value of a field in its column
+      void SetColumnValue(PathColumn & col, size_t row, Node const & value)
+      {
+         if (!value || !value.IsScalar())
+            return;
+
+         std::string const & scalar = value.Scalar();
+         if (col.type == EColumnType::Number)
+         {
+            if (!ParseNumber(scalar, col.number[row]))
+               return;
+         }
+         else
+            col.text[row] = scalar;
+
+         col.valid[row / 64] |= uint64_t(1) << (row % 64);
+      }
+   }
+
+   using namespace YamlPathDetail;
+
+   size_t PathColumn::ValidCount() const
+   {
+      size_t count = 0;
+      for (auto bits : valid)
+         for (; bits; bits &= bits - 1)
+            ++count;
+      return count;
+   }
+
+   /** Extracts multiple fields from each element of a sequence in a single pass.
+
+      \c seqPath selects the rows (see \ref Select). If it selects a sequence, each element is a row,
+      otherwise the single node selected is the only row. \c args are bound to \c seqPath.
+
+      Each field path is evaluated relative to the row, and must select a scalar. Fields starting with a key selector
+      (e.g. \c "name" or \c "resources.cpu") are matched together in a single scan over the keys of the row's map, instead of
+      a separate lookup per field.
+
+      Text columns contain <code>std::string_view</code>s into the scalars of the document. They remain valid as long as the
+      document is not modified or destroyed.
+
+      Throws a \ref PathException if \c seqPath or any of the field paths are malformed.
+
+      \code
+      auto cols = ExtractColumns(root, "pods", { "name", { "cpu", EColumnType::Number }, { "mem", EColumnType::Number } });
+      for (size_t row = 0; row < cols.rows; ++row)
+         if (cols[1].IsValid(row))
+            totalCpu += cols[1].number[row];
+      \endcode
+   */
+   PathColumns ExtractColumns(Node const & node, PathArg seqPath, std::initializer_list<PathField> fields, PathBoundArgs args)
+   {
+      PathColumns result;
+
+      std::vector<ColumnPlan> plans(fields.size());
+      size_t byKeyCount = 0;
+      for (size_t i = 0; i < fields.size(); ++i)
+      {
+         auto & field = fields.begin()[i];
+         PathErrorInfo info;
+         if (ScanSelectors(plans[i].selectors, field.path, {}, &info) != EPathError::OK)
+            throw PathException(info, field.path);
+         plans[i].byKey = !plans[i].selectors.empty() && plans[i].selectors[0].selector == ESelector::Key;
+         byKeyCount += plans[i].byKey;
+      }
+
+      // --- rows: elements of the sequence selected, or the nodes of a fan-out
+      EvalContext ctx;
+      ctx.readOnly = true;
+      EvalNodes rows{ node };
+      {
+         PathArg fullPath = seqPath;
+         PathErrorInfo info;
+         auto err = EvalPath(rows, seqPath, args, &info, ctx);
+         if (PathException::IsPathError(err))
+            throw PathException(info, fullPath);
+         if (err == EPathError::OK)
+            result.rows = rows.isList ? rows.list.size() : rows.node.IsSequence() ? rows.node.size() : rows.node ? 1 : 0;
+      }
+
+      result.columns.resize(fields.size());
+      for (size_t i = 0; i < fields.size(); ++i)
+      {
+         auto & col = result.columns[i];
+         col.path = fields.begin()[i].path;
+         col.type = fields.begin()[i].type;
+         if (col.type == EColumnType::Number)
+            col.number.resize(result.rows);
+         else
+            col.text.resize(result.rows);
+         col.valid.resize((result.rows + 63) / 64);
+      }
+
+      if (!result.rows)
+         return result;
+
+      std::vector<Node> found(fields.size());      // value of the first key of byKey fields, for the current row
+      std::vector<bool> isFound(fields.size());
+
+      auto ProcessRow = [&](size_t row, Node const & el)
+      {
+         // --- single scan over the keys of the element for all fields starting with a key
+         std::fill(isFound.begin(), isFound.end(), false);
+         auto impl = NodeAccess::Impl(el);
+         if (byKeyCount && impl && impl->type() == NodeType::Map)
+         {
+            size_t pending = byKeyCount;
+            for (auto it = impl->begin(); it != impl->end() && pending; ++it)
+            {
+               auto kv = *it;
+               if (kv.first->type() != NodeType::Scalar)
+                  continue;
+               PathArg key = kv.first->scalar();
+               for (size_t i = 0; i < plans.size(); ++i)
+               {
+                  if (!plans[i].byKey || isFound[i] || std::get<ArgKey>(plans[i].selectors[0].data).key != key)
+                     continue;
+                  found[i].reset(NodeAccess::Make(*kv.second, el));
+                  isFound[i] = true;
+                  --pending;
+               }
+            }
+         }
+
+         // --- apply remaining selectors
+         for (size_t i = 0; i < plans.size(); ++i)
+         {
+            auto & plan = plans[i];
+            EvalNodes value;
+            size_t first = 0;
+            if (plan.byKey)
+            {
+               if (!isFound[i])
+                  continue;
+               value.node.reset(found[i]);
+               first = 1;
+            }
+            else
+               value.node.reset(el);
+
+            bool ok = true;
+            for (size_t s = first; s < plan.selectors.size() && ok; ++s)
+               ok = ApplySelector(value, plan.selectors[s].selector, plan.selectors[s].data, ctx) == EPathError::OK;
+
+            if (ok && !value.isList)
+               SetColumnValue(result.columns[i], row, value.node);
+         }
+      };
+
+      if (rows.isList)
+      {
+         for (size_t row = 0; row < rows.list.size(); ++row)
+            ProcessRow(row, rows.list[row]);
+      }
+      else if (rows.node.IsSequence())
+      {
+         size_t row = 0;
+         for (auto && el : static_cast<Node const &>(rows.node))
+            ProcessRow(row++, el);
+      }
+      else
+         ProcessRow(0, rows.node);
+
+      return result;
+   }
+}
@@ -0,0 +1,81 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <vector>
+#include <cstdint>
+
+namespace YAML
+{
+   /// value type of a column extracted by \ref ExtractColumns
+   enum class EColumnType
+   {
+      Text,       ///< scalar text, see \ref PathColumn::text
+      Number,     ///< scalar parsed as number, see \ref PathColumn::number
+   };
+
+   /** field specification for \ref ExtractColumns: a path relative to a sequence element, and the column type to extract.
+       Implicitly constructible from a path, so <code>{ "name", { "cpu", EColumnType::Number } }</code> works as field list.
+   */
+   struct PathField
+   {
+      PathArg     path;
+      EColumnType type = EColumnType::Text;
+
+      PathField(PathArg path, EColumnType type = EColumnType::Text) : path(path), type(type) {}
+      PathField(char const * path, EColumnType type = EColumnType::Text) : path(path), type(type) {}
+   };
+
+   /** One column extracted by \ref ExtractColumns.
+
+      Only the vector matching \c type is filled, with one entry per row.
+      Rows where the field is missing, is not a scalar, or (for \c EColumnType::Number) cannot be parsed are <i>invalid</i>:
+      their validity bit is cleared, and their value is empty or 0.
+   */
+   struct PathColumn
+   {
+      PathArg     path;                         ///< field path this column was extracted for
+      EColumnType type = EColumnType::Text;
+
+      std::vector<std::string_view> text;       ///< \c EColumnType::Text: views into the scalars of the document
+      std::vector<double>           number;     ///< \c EColumnType::Number: parsed values
+      std::vector<uint64_t>         valid;      ///< validity bitmap: bit <code>row % 64</code> of <code>valid[row / 64]</code> is set for valid rows
+
+      bool IsValid(size_t row) const { return (valid[row / 64] >> (row % 64)) & 1; }   ///< true if \c row holds a value
+      size_t ValidCount() const;                                                        ///< number of valid rows
+   };
+
+   /// result of \ref ExtractColumns. Columns are in the same order as the fields passed
+   struct PathColumns
+   {
+      size_t rows = 0;
+      std::vector<PathColumn> columns;
+
+      PathColumn const & operator[](size_t idx) const { return columns[idx]; }
+   };
+
+   PathColumns ExtractColumns(Node const & node, PathArg seqPath, std::initializer_list<PathField> fields, PathBoundArgs args = {});
+}
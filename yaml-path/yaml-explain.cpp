@@ -0,0 +1,114 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-explain.h"
+#include "yaml-path-internals.h"
+#include <yaml-cpp/yaml.h>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      std::atomic<size_t (*)()> g_allocationCounter = nullptr;
+
+      /// \internal current value of the counter installed by \ref SetPathAllocationCounter, 0 if none is installed
+      size_t PathAllocationCount()
+      {
+         auto counter = g_allocationCounter.load(std::memory_order_relaxed);
+         return counter ? counter() : 0;
+      }
+   }
+
+   using namespace YamlPathDetail;
+
+   /** Installs a function that returns the number of heap allocations made so far, e.g. counted by a replaced <code>operator new</code>.
+       \ref PathExplain reports the difference for each selector. The counter should count allocations of the calling thread only.
+       Pass \c nullptr to remove the counter.
+   */
+   void SetPathAllocationCounter(size_t (*counter)())
+   {
+      g_allocationCounter = counter;
+   }
+
+   /** Evaluates \c path like \ref SelectNodes, and reports statistics for each selector.
+
+      Use this to find which selector of a slow path is responsible. For each selector, the report contains the number of nodes
+      the selector was applied to and selected, the nodes visited, the maps whose keys had to be scanned one-by-one
+      (e.g. for <code>{name*=web}</code>), heap allocations (see \ref SetPathAllocationCounter) and the time taken.
+
+      Unlike \ref Select, a malformed path does not throw, the error is recorded in the report.
+      \ref PathExplainReport::Text renders the report as a table:
+
+      \code
+      std::cout << PathExplain(root, "pods.{phase=Pending}.name").Text();
+      \endcode
+   */
+   PathExplainReport PathExplain(Node node, PathArg path, PathBoundArgs args)
+   {
+      PathExplainReport report;
+      report.path = path;
+      report.allocationsCounted = g_allocationCounter.load() != nullptr;
+
+      auto start = std::chrono::steady_clock::now();
+      EvalContext ctx;
+      ctx.readOnly = true;    // a diagnostic must not grow the document
+      ctx.explain = &report;
+      EvalNodes nodes{ node };
+      report.error = EvalPath(nodes, path, args, &report.errorInfo, ctx);
+      report.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+      return report;
+   }
+
+   /** renders the report as text: a header line, and a table with one line for each selector */
+   std::string PathExplainReport::Text() const
+   {
+      std::stringstream str;
+      str << "path: " << path << "\n"
+          << "result: " << (error == EPathError::OK ? "OK" : PathException(errorInfo, path).What(false)) << ", " << nanoseconds << " ns\n";
+
+      str << "  " << std::left << std::setw(12) << "selector" << std::setw(24) << "text" << std::right
+          << std::setw(8) << "in" << std::setw(10) << "visited" << std::setw(10) << "scanned" << std::setw(8) << "out"
+          << std::setw(8) << "allocs" << std::setw(12) << "ns" << "\n";
+
+      for (auto & step : steps)
+      {
+         str << "  " << std::left << std::setw(12) << MapValue(step.selector, MapESelectorName, "?") << std::setw(24) << step.text << std::right
+             << std::setw(8) << step.nodesIn << std::setw(10) << step.nodesVisited << std::setw(10) << step.mapsScanned << std::setw(8) << step.nodesEmitted
+             << std::setw(8);
+         if (allocationsCounted)
+            str << step.allocations;
+         else
+            str << "-";
+         str << std::setw(12) << step.nanoseconds;
+         if (step.error != EPathError::OK)
+            str << "  " << PathException::GetErrorMessage(step.error);
+         str << "\n";
+      }
+      return str.str();
+   }
+}
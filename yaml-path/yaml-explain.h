@@ -0,0 +1,66 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace YAML
+{
+   namespace YamlPathDetail { enum class ESelector; }
+
+   /// statistics for one selector of a path, see \ref PathExplain
+   struct PathExplainStep
+   {
+      YamlPathDetail::ESelector selector {};
+      std::string text;                   ///< the selector as specified in the path
+      EPathError  error = EPathError::OK; ///< error applying the selector. Evaluation stops at the first error
+
+      size_t      nodesIn = 0;            ///< number of nodes the selector was applied to
+      size_t      nodesVisited = 0;       ///< nodes inspected: the nodes the selector was applied to, and the sequence elements it was applied to one-by-one
+      size_t      mapsScanned = 0;        ///< maps whose keys were compared one-by-one, because the key is starry or case insensitive
+      size_t      nodesEmitted = 0;       ///< number of nodes selected
+      size_t      allocations = 0;        ///< heap allocations. Always 0 if no counter is installed, see \ref SetPathAllocationCounter
+      uint64_t    nanoseconds = 0;        ///< time for scanning and applying the selector
+   };
+
+   /// result of \ref PathExplain
+   struct PathExplainReport
+   {
+      std::string    path;
+      EPathError     error = EPathError::OK;
+      PathErrorInfo  errorInfo;
+      bool           allocationsCounted = false;   ///< an allocation counter was installed
+      uint64_t       nanoseconds = 0;              ///< total time
+      std::vector<PathExplainStep> steps;
+
+      std::string Text() const;
+   };
+
+   PathExplainReport PathExplain(Node node, PathArg path, PathBoundArgs args = {});
+   void SetPathAllocationCounter(size_t (*counter)());
+}
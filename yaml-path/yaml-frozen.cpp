@@ -0,0 +1,634 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-frozen.h"
+#include "yaml-path-internals.h"
+#include <yaml-cpp/yaml.h>
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      constexpr uint32_t NoNode = std::numeric_limits<uint32_t>::max();
+      constexpr uint32_t LinearKeys = 8;     // maps with up to this many pairs are searched linearly
+
+      /// \internal process-wide table of interned keys. Ids start at 1
+      class KeyTable
+      {
+      public:
+         uint32_t Intern(PathArg key)
+         {
+            if (auto id = Find(key); id != NoKeyId)
+               return id;
+
+            std::unique_lock<std::shared_mutex> lock(m_lock);
+            if (auto it = m_ids.find(key); it != m_ids.end())
+               return it->second;
+            if (m_keys.size() >= NoKeyId - 1)
+               throw std::length_error("too many distinct keys");
+
+            PathArg stored = m_keys.emplace_back(key);
+            return m_ids.emplace(stored, uint32_t(m_keys.size())).first->second;
+         }
+
+         uint32_t Find(PathArg key) const
+         {
+            std::shared_lock<std::shared_mutex> lock(m_lock);
+            auto it = m_ids.find(key);
+            return it != m_ids.end() ? it->second : NoKeyId;
+         }
+
+      private:
+         mutable std::shared_mutex m_lock;
+         std::deque<std::string> m_keys;                   // storage for the keys of m_ids
+         std::unordered_map<PathArg, uint32_t> m_ids;
+      };
+
+      KeyTable & Keys()
+      {
+         static KeyTable * keys = new KeyTable;    // not destroyed: may be used during static destruction
+         return *keys;
+      }
+
+      uint32_t InternKey(PathArg key) { return Keys().Intern(key); }
+      uint32_t FindKeyId(PathArg key) { return Keys().Find(key); }
+
+      /** \internal sets the key ids of key selectors and of map filter keys that can be looked up (i.e. not starry or case insensitive).
+          With \c intern, keys are added to the table; otherwise, keys not in the table get \c NoKeyId.
+      */
+      void ResolveKeyIds(SelectorList & selectors, bool intern)
+      {
+         auto Resolve = [&](PathArg key) { return intern ? InternKey(key) : FindKeyId(key); };
+         for (auto & sel : selectors)
+         {
+            if (sel.selector == ESelector::Key)
+            {
+               auto & arg = std::get<ArgKey>(sel.data);
+               arg.keyId = Resolve(arg.key);
+            }
+            else if (sel.selector == ESelector::MapFilter)
+            {
+               for (auto & kvp : std::get<ArgMapFilter>(sel.data))
+                  if (!kvp.key.starry && !kvp.key.noCase)
+                     kvp.keyId = Resolve(kvp.key.token);
+            }
+         }
+      }
+
+      /** \internal the selectors of a \ref CompiledPath, with key ids. The keys are interned the first time the path is evaluated
+          on a \ref FrozenDocument, so paths that are never evaluated on one don't add keys to the table.
+      */
+      SelectorList const & FrozenSelectors(CompiledSelectors const & compiled)
+      {
+         std::call_once(compiled.frozenResolved, [&]
+         {
+            compiled.frozenSelectors = compiled.selectors;
+            ResolveKeyIds(compiled.frozenSelectors, true);
+         });
+         return compiled.frozenSelectors;
+      }
+
+      /// \internal nodes matched while evaluating a path on a \ref FrozenDocument, like \ref EvalNodes
+      struct FrozenNodes
+      {
+         uint32_t node = 0;
+         std::vector<uint32_t> list;
+         bool isList = false;
+      };
+
+      /// \internal building and evaluating a \ref FrozenDocument
+      struct FrozenAccess
+      {
+         using Record = FrozenDocument::Record;
+
+         // ----- building
+
+         struct Builder
+         {
+            FrozenDocument & doc;
+            std::unordered_map<detail::node const *, uint32_t> added;     // nodes shared through aliases are stored once
+            std::unordered_map<PathArg, std::pair<uint32_t, uint32_t>> keys;   // key (in the source document) -> key id, offset in doc.m_strings
+
+            static uint32_t Offset(size_t offset)
+            {
+               if (offset >= NoNode)
+                  throw std::length_error("document too large to freeze");
+               return uint32_t(offset);
+            }
+
+            uint32_t Add(detail::node const & node)
+            {
+               if (auto it = added.find(&node); it != added.end())
+                  return it->second;
+
+               const uint32_t index = Offset(doc.m_nodes.size());
+               doc.m_nodes.emplace_back();
+               added.emplace(&node, index);
+
+               // doc.m_nodes may be reallocated while adding children, so the record is accessed through index
+               switch (node.type())
+               {
+                  case NodeType::Scalar:
+                  {
+                     auto & scalar = node.scalar();
+                     doc.m_nodes[index] = { Offset(doc.m_strings.size()), Offset(scalar.size()), 0, NodeType::Scalar };
+                     doc.m_strings += scalar;
+                     break;
+                  }
+
+                  case NodeType::Sequence:
+                  {
+                     const uint32_t count = Offset(std::distance(node.begin(), node.end()));
+                     const uint32_t first = Offset(doc.m_items.size());
+                     doc.m_nodes[index] = { first, count, 0, NodeType::Sequence };
+                     doc.m_items.resize(first + count);
+
+                     uint32_t i = first;
+                     for (auto && el : node)
+                     {
+                        const uint32_t child = Add(*el);
+                        doc.m_items[i++] = child;
+                     }
+                     break;
+                  }
+
+                  case NodeType::Map:
+                  {
+                     const uint32_t count = Offset(std::distance(node.begin(), node.end()));
+                     const uint32_t first = Offset(doc.m_items.size());
+                     doc.m_nodes[index] = { first, count, 0, NodeType::Map };
+                     doc.m_items.resize(first + 2 * size_t(count));
+
+                     uint32_t i = first;
+                     for (auto && kv : node)
+                     {
+                        const uint32_t key = AddKey(*kv.first);
+                        doc.m_items[i++] = key;
+                        const uint32_t value = Add(*kv.second);
+                        doc.m_items[i++] = value;
+                     }
+
+                     if (count > LinearKeys)
+                        doc.m_nodes[index].aux = SortKeys(first, count);
+                     break;
+                  }
+
+                  default:
+                     doc.m_nodes[index].type = NodeType::Null;
+               }
+               return index;
+            }
+
+            /// adds a key of a map. Scalar keys are interned, and each distinct key is stored once in doc.m_strings
+            uint32_t AddKey(detail::node const & key)
+            {
+               if (key.type() != NodeType::Scalar)
+                  return Add(key);
+
+               uint32_t index;
+               if (auto it = added.find(&key); it != added.end())
+                  index = it->second;
+               else
+               {
+                  index = Offset(doc.m_nodes.size());
+                  doc.m_nodes.emplace_back();
+                  added.emplace(&key, index);
+               }
+
+               auto & rec = doc.m_nodes[index];
+               if (rec.aux)
+                  return index;        // already added as key
+
+               PathArg scalar = key.scalar();
+               auto it = keys.find(scalar);
+               if (it == keys.end())
+               {
+                  it = keys.emplace(scalar, std::make_pair(InternKey(scalar), Offset(doc.m_strings.size()))).first;
+                  doc.m_strings += scalar;
+               }
+               rec = { it->second.second, Offset(scalar.size()), it->second.first, NodeType::Scalar };
+               return index;
+            }
+
+            /// adds the key table for a map: (key id, pair index), sorted. Non-scalar keys have id \c NoKeyId, and are sorted last
+            uint32_t SortKeys(uint32_t first, uint32_t count)
+            {
+               const uint32_t sorted = Offset(doc.m_sortedKeys.size());
+               for (uint32_t i = 0; i < count; ++i)
+                  doc.m_sortedKeys.emplace_back(KeyIdOf(doc, doc.m_items[first + 2 * i]), i);
+
+               std::sort(doc.m_sortedKeys.begin() + sorted, doc.m_sortedKeys.end());
+               return sorted;
+            }
+         };
+
+         // ----- access
+
+         static PathArg ScalarOf(FrozenDocument const & doc, uint32_t node)
+         {
+            auto & rec = doc.m_nodes[node];
+            return rec.type == NodeType::Scalar ? PathArg(doc.m_strings.data() + rec.first, rec.count) : PathArg();
+         }
+
+         static uint32_t KeyIdOf(FrozenDocument const & doc, uint32_t key)
+         {
+            auto & rec = doc.m_nodes[key];
+            return rec.type == NodeType::Scalar && rec.aux ? rec.aux : NoKeyId;
+         }
+
+         /// returns the value for the key with id \c keyId in the map \c map, or \c NoNode
+         static uint32_t FindKey(FrozenDocument const & doc, uint32_t map, uint32_t keyId)
+         {
+            auto & rec = doc.m_nodes[map];
+            if (rec.type != NodeType::Map || keyId == NoKeyId)
+               return NoNode;
+
+            uint32_t const * pairs = doc.m_items.data() + rec.first;
+            if (rec.count <= LinearKeys)
+            {
+               for (uint32_t i = 0; i < rec.count; ++i)
+                  if (KeyIdOf(doc, pairs[2 * i]) == keyId)
+                     return pairs[2 * i + 1];
+               return NoNode;
+            }
+
+            auto begin = doc.m_sortedKeys.begin() + rec.aux, end = begin + rec.count;
+            auto it = std::lower_bound(begin, end, std::make_pair(keyId, uint32_t(0)));
+            if (it != end && it->first == keyId)
+               return pairs[2 * it->second + 1];
+            return NoNode;
+         }
+
+         // ----- evaluation, see the Node versions in yaml-path.cpp
+
+         static bool IsSupported(SelectorList const & selectors)
+         {
+            for (auto & sel : selectors)
+            {
+               if (sel.selector == ESelector::Sort)
+                  return false;
+               if (sel.selector != ESelector::MapFilter)
+                  continue;
+               for (auto & kvp : std::get<ArgMapFilter>(sel.data))
+                  if (kvp.op == EKVOp::Select && !kvp.key.IsAllStar())
+                     return false;
+            }
+            return true;
+         }
+
+         template <typename TFunc>
+         static void ForEachItem(FrozenDocument const & doc, FrozenNodes const & nodes, TFunc f)
+         {
+            if (nodes.isList)
+            {
+               for (auto el : nodes.list)
+                  f(el);
+               return;
+            }
+
+            auto & rec = doc.m_nodes[nodes.node];
+            for (uint32_t i = 0; i < rec.count; ++i)
+               f(doc.m_items[rec.first + i]);
+         }
+
+         static EPathError SetFanOutResult(FrozenNodes & nodes, std::vector<uint32_t> & scratch)
+         {
+            if (scratch.empty())
+               return EPathError::NodeNotFound;
+
+            nodes.list.swap(scratch);
+            nodes.isList = true;
+            scratch.clear();
+            return EPathError::OK;
+         }
+
+         static EPathError ApplyKey(FrozenDocument const & doc, FrozenNodes & nodes, uint32_t key, std::vector<uint32_t> & scratch)
+         {
+            if (!nodes.isList)
+            {
+               auto type = doc.m_nodes[nodes.node].type;
+               if (type == NodeType::Map)
+               {
+                  auto value = FindKey(doc, nodes.node, key);
+                  if (value == NoNode)
+                     return EPathError::NodeNotFound;
+                  nodes.node = value;
+                  return EPathError::OK;
+               }
+
+               if (type != NodeType::Sequence)
+                  return EPathError::InvalidNodeType;
+            }
+
+            scratch.clear();
+            ForEachItem(doc, nodes, [&](uint32_t el)
+            {
+               auto value = FindKey(doc, el, key);
+               if (value != NoNode)
+                  scratch.push_back(value);
+            });
+            return SetFanOutResult(nodes, scratch);
+         }
+
+         static EPathError ApplyIndex(FrozenDocument const & doc, FrozenNodes & nodes, size_t index)
+         {
+            if (nodes.isList)
+            {
+               if (index >= nodes.list.size())
+                  return EPathError::NodeNotFound;
+
+               nodes.node = nodes.list[index];
+               nodes.list.clear();
+               nodes.isList = false;
+               return EPathError::OK;
+            }
+
+            auto & rec = doc.m_nodes[nodes.node];
+            if (rec.type == NodeType::Scalar || rec.type == NodeType::Map)
+               return index == 0 ? EPathError::OK : EPathError::NodeNotFound;
+
+            if (rec.type == NodeType::Sequence)
+            {
+               if (index >= rec.count)
+                  return EPathError::NodeNotFound;
+               nodes.node = doc.m_items[rec.first + index];
+               return EPathError::OK;
+            }
+            return EPathError::InvalidNodeType;
+         }
+
+         static bool ValueIsMatch(FrozenDocument const & doc, ArgKVPair const & arg, uint32_t value)
+         {
+            if (arg.op == EKVOp::Exists)
+               return true;
+            if (IsRangeOp(arg.op))
+               return doc.m_nodes[value].type == NodeType::Scalar && RangeIsMatch(arg.op, arg.value.token, ScalarOf(doc, value));
+
+            bool eq = doc.m_nodes[value].type == NodeType::Scalar && StrIsMatch(arg.value, ScalarOf(doc, value));
+            return arg.op == EKVOp::NotEqual ? !eq : eq;
+         }
+
+         /// checks the conditions of a map filter on a single map. Selecting keys is not supported (see \ref IsSupported)
+         static bool MapFilterIsMatch(FrozenDocument const & doc, uint32_t map, ArgMapFilter const & arg)
+         {
+            auto & rec = doc.m_nodes[map];
+            if (rec.type != NodeType::Map)
+               return false;
+
+            uint32_t const * pairs = doc.m_items.data() + rec.first;
+            bool anyMatch = false;
+            bool anyCondition = false;
+            for (auto & kvp : arg)
+            {
+               if (kvp.op == EKVOp::Select)
+                  break;      // selects are sorted to the end of the list
+               anyCondition = true;
+
+               KVToken const & key = kvp.key;
+               if (key.starry || key.noCase)
+               {
+                  for (uint32_t i = 0; i < rec.count; ++i)
+                  {
+                     auto k = pairs[2 * i];
+                     if (doc.m_nodes[k].type != NodeType::Scalar || !StrIsMatch(key, ScalarOf(doc, k)))
+                        continue;
+                     if (ValueIsMatch(doc, kvp, pairs[2 * i + 1]))
+                     {
+                        anyMatch = true;
+                        break;
+                     }
+                  }
+               }
+               else
+               {
+                  auto value = FindKey(doc, map, kvp.keyId);
+                  if (value == NoNode && key.required)
+                     return false;
+                  if (value != NoNode && ValueIsMatch(doc, kvp, value))
+                     anyMatch = true;
+               }
+
+               if (key.required && !anyMatch)
+                  return false;
+            }
+            return anyMatch || !anyCondition;
+         }
+
+         static EPathError ApplyMapFilter(FrozenDocument const & doc, FrozenNodes & nodes, ArgMapFilter const & arg, std::vector<uint32_t> & scratch)
+         {
+            if (!nodes.isList)
+            {
+               auto type = doc.m_nodes[nodes.node].type;
+               if (type == NodeType::Map)
+                  return MapFilterIsMatch(doc, nodes.node, arg) ? EPathError::OK : EPathError::NodeNotFound;
+
+               if (type != NodeType::Sequence)
+                  return EPathError::InvalidNodeType;
+            }
+
+            scratch.clear();
+            ForEachItem(doc, nodes, [&](uint32_t el)
+            {
+               if (MapFilterIsMatch(doc, el, arg))
+                  scratch.push_back(el);
+            });
+            return SetFanOutResult(nodes, scratch);
+         }
+
+         static std::vector<FrozenNode> Select(FrozenDocument const & doc, SelectorList const & selectors, PathArg path)
+         {
+            if (!IsSupported(selectors))
+            {
+               PathErrorInfo info;
+               info.error = EPathError::SelectorNotSupported;
+               throw PathException(info, path);
+            }
+
+            FrozenNodes nodes;
+            std::vector<uint32_t> scratch;
+            for (auto & sel : selectors)
+            {
+               EPathError err = EPathError::OK;
+               switch (sel.selector)
+               {
+                  case ESelector::Key:       err = ApplyKey(doc, nodes, std::get<ArgKey>(sel.data).keyId, scratch); break;
+                  case ESelector::Index:     err = ApplyIndex(doc, nodes, std::get<ArgIndex>(sel.data).index); break;
+                  case ESelector::MapFilter: err = ApplyMapFilter(doc, nodes, std::get<ArgMapFilter>(sel.data), scratch); break;
+                  default: break;
+               }
+               if (err != EPathError::OK)
+                  return {};
+            }
+
+            std::vector<FrozenNode> result;
+            if (!nodes.isList)
+               result.push_back(FrozenNode(&doc, nodes.node));
+            else
+            {
+               result.reserve(nodes.list.size());
+               for (auto el : nodes.list)
+                  result.push_back(FrozenNode(&doc, el));
+            }
+            return result;
+         }
+      };
+   }
+
+   using namespace YamlPathDetail;
+
+   // ----- FrozenNode
+
+   NodeType::value FrozenNode::Type() const
+   {
+      return m_doc ? m_doc->m_nodes[m_index].type : NodeType::Undefined;
+   }
+
+   std::string_view FrozenNode::Scalar() const
+   {
+      return m_doc ? FrozenAccess::ScalarOf(*m_doc, m_index) : PathArg();
+   }
+
+   size_t FrozenNode::size() const
+   {
+      auto type = Type();
+      return type == NodeType::Sequence || type == NodeType::Map ? m_doc->m_nodes[m_index].count : 0;
+   }
+
+   FrozenNode FrozenNode::operator[](size_t index) const
+   {
+      if (!IsSequence() || index >= size())
+         return {};
+      return FrozenNode(m_doc, m_doc->m_items[m_doc->m_nodes[m_index].first + index]);
+   }
+
+   FrozenNode FrozenNode::operator[](PathArg key) const
+   {
+      if (!m_doc)
+         return {};
+      auto value = FrozenAccess::FindKey(*m_doc, m_index, FindKeyId(key));
+      return value != NoNode ? FrozenNode(m_doc, value) : FrozenNode();
+   }
+
+   FrozenNode FrozenNode::Key(size_t index) const
+   {
+      if (!IsMap() || index >= size())
+         return {};
+      return FrozenNode(m_doc, m_doc->m_items[m_doc->m_nodes[m_index].first + 2 * index]);
+   }
+
+   FrozenNode FrozenNode::Value(size_t index) const
+   {
+      if (!IsMap() || index >= size())
+         return {};
+      return FrozenNode(m_doc, m_doc->m_items[m_doc->m_nodes[m_index].first + 2 * index + 1]);
+   }
+
+   /// returns a copy of this node as yaml-cpp node. Nodes shared through aliases are copied separately
+   Node FrozenNode::ToNode() const
+   {
+      switch (Type())
+      {
+         case NodeType::Scalar:
+            return Node(std::string(Scalar()));
+
+         case NodeType::Sequence:
+         {
+            Node result(NodeType::Sequence);
+            for (size_t i = 0; i < size(); ++i)
+               result.push_back((*this)[i].ToNode());
+            return result;
+         }
+
+         case NodeType::Map:
+         {
+            Node result(NodeType::Map);
+            for (size_t i = 0; i < size(); ++i)
+               result.force_insert(Key(i).ToNode(), Value(i).ToNode());
+            return result;
+         }
+
+         case NodeType::Null:
+            return Node(NodeType::Null);
+
+         default:
+            return NodeAccess::Invalid();
+      }
+   }
+
+   // ----- FrozenDocument
+
+   /// copies \c root into the frozen layout. An invalid or undefined \c root results in a document with a null root
+   FrozenDocument::FrozenDocument(Node const & root)
+   {
+      auto impl = NodeAccess::Impl(root);
+      if (!impl || !impl->is_defined())
+      {
+         m_nodes.emplace_back();
+         return;
+      }
+
+      FrozenAccess::Builder builder{ *this };
+      builder.Add(*impl);
+
+      m_nodes.shrink_to_fit();
+      m_items.shrink_to_fit();
+      m_sortedKeys.shrink_to_fit();
+      m_strings.shrink_to_fit();
+   }
+
+   FrozenNode FrozenDocument::Root() const
+   {
+      return FrozenNode(this, 0);
+   }
+
+   /** Selects nodes like \ref SelectNodes. Returns an empty list if no node can be matched.
+       Throws a \ref PathException if \c path is malformed, or contains a map filter selecting keys.
+   */
+   std::vector<FrozenNode> FrozenDocument::Select(PathArg path, PathBoundArgs args) const
+   {
+      SelectorList selectors;
+      PathErrorInfo info;
+      if (ScanSelectors(selectors, path, args, &info) != EPathError::OK)
+         throw PathException(info, path);
+      ResolveKeyIds(selectors, false);
+      return FrozenAccess::Select(*this, selectors, path);
+   }
+
+   /// \copydoc FrozenDocument::Select(PathArg, PathBoundArgs) const
+   std::vector<FrozenNode> FrozenDocument::Select(CompiledPath const & path) const
+   {
+      return FrozenAccess::Select(*this, FrozenSelectors(path.Selectors()), path.Path());
+   }
+
+   size_t FrozenDocument::MemoryUsage() const
+   {
+      return m_nodes.capacity() * sizeof(Record) + m_items.capacity() * sizeof(uint32_t) + m_sortedKeys.capacity() * sizeof(m_sortedKeys[0]) + m_strings.capacity();
+   }
+}
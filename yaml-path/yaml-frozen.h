@@ -0,0 +1,124 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <string>
+#include <vector>
+
+namespace YAML
+{
+   class FrozenDocument;
+   namespace YamlPathDetail { struct FrozenAccess; }
+
+   /** A node of a \ref FrozenDocument. A lightweight handle that is valid as long as the document exists.
+       A default-constructed \c FrozenNode is invalid, and evaluates to \c false.
+   */
+   class FrozenNode
+   {
+   public:
+      FrozenNode() = default;
+
+      explicit operator bool() const { return m_doc != nullptr; }
+      NodeType::value Type() const;
+      bool IsNull() const      { return Type() == NodeType::Null; }
+      bool IsScalar() const    { return Type() == NodeType::Scalar; }
+      bool IsSequence() const  { return Type() == NodeType::Sequence; }
+      bool IsMap() const       { return Type() == NodeType::Map; }
+
+      std::string_view Scalar() const;          ///< the scalar, or an empty string if this is not a scalar
+      size_t size() const;                      ///< number of elements of a sequence, or pairs of a map
+      FrozenNode operator[](size_t index) const;    ///< element of a sequence
+      FrozenNode operator[](PathArg key) const;     ///< value for \c key of a map
+      FrozenNode Key(size_t index) const;           ///< key of the pair \c index of a map, in document order
+      FrozenNode Value(size_t index) const;         ///< value of the pair \c index of a map, in document order
+
+      Node ToNode() const;
+
+      bool operator==(FrozenNode const & other) const { return m_doc == other.m_doc && m_index == other.m_index; }
+      bool operator!=(FrozenNode const & other) const { return !(*this == other); }
+
+   private:
+      friend class FrozenDocument;
+      friend struct YamlPathDetail::FrozenAccess;
+      FrozenNode(FrozenDocument const * doc, uint32_t index) : m_doc(doc), m_index(index) {}
+
+      FrozenDocument const * m_doc = nullptr;
+      uint32_t m_index = 0;
+   };
+
+   /** An immutable copy of a document, laid out in contiguous arrays for fast read-only lookups.
+
+      yaml-cpp nodes are individually allocated, reference counted and linked by pointers; maps are lists of pairs,
+      and each scalar is a separate \c std::string. A \c FrozenDocument stores all nodes in one array,
+      the elements of sequences and the pairs of maps in a second, and all scalars in a single string.
+      Keys are interned: each distinct key is stored once, and identified by an id that is shared by all frozen documents.
+      A \ref CompiledPath resolves its keys to ids when it is first evaluated on a frozen document, so matching a key compares integers.
+      Keys of larger maps are looked up in a table sorted by id.
+      Interned keys are kept for the lifetime of the process.
+
+      \ref Select supports the path language of \ref SelectNodes, except map filters selecting keys (e.g. \c "{a,b}"),
+      which would need to create new maps, and the \c sort and \c top stages. Tags and styles are not kept. Nodes shared through aliases are stored once.
+
+      The document does not refer to the source \c Node after construction.
+      Any number of threads may read a \c FrozenDocument concurrently.
+
+      \code
+      FrozenDocument config(LoadFile("config.yaml"));
+      CompiledPath replicas("services.{name=web}.replicas");
+      for (auto & r : config.Select(replicas))
+         Use(r.Scalar());
+      \endcode
+   */
+   class FrozenDocument
+   {
+   public:
+      explicit FrozenDocument(Node const & root);
+
+      FrozenNode Root() const;
+      std::vector<FrozenNode> Select(PathArg path, PathBoundArgs args = {}) const;
+      std::vector<FrozenNode> Select(CompiledPath const & path) const;
+
+      size_t NodeCount() const { return m_nodes.size(); }
+      size_t MemoryUsage() const;      ///< bytes allocated by the document
+
+   private:
+      friend class FrozenNode;
+      friend struct YamlPathDetail::FrozenAccess;
+
+      struct Record
+      {
+         uint32_t first = 0;     // scalar: offset in m_strings. sequence, map: offset in m_items
+         uint32_t count = 0;     // scalar: length. sequence: elements. map: pairs
+         uint32_t aux = 0;       // map with more than LinearKeys pairs: offset of its key table in m_sortedKeys. scalar key: key id
+         NodeType::value type = NodeType::Null;
+      };
+
+      std::vector<Record>     m_nodes;          // [0] is the root
+      std::vector<uint32_t>   m_items;          // sequence elements, and map pairs as (key, value)
+      std::vector<std::pair<uint32_t, uint32_t>> m_sortedKeys;    // for maps with more than LinearKeys pairs: (key id, pair index), sorted
+      std::string             m_strings;        // all scalars
+   };
+}
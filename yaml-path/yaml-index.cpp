@@ -0,0 +1,318 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-index.h"
+#include "yaml-path-internals.h"
+#include <algorithm>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      /// \internal FNV-1a hash of \c s folded to lower case. Only ASCII letters are folded, like \c _strnicmp in the C locale
+      uint64_t FoldedHash(PathArg s)
+      {
+         uint64_t hash = 14695981039346656037ull;
+         for (unsigned char c : s)
+         {
+            if (c >= 'A' && c <= 'Z')
+               c += 'a' - 'A';
+            hash = (hash ^ c) * 1099511628211ull;
+         }
+         return hash;
+      }
+
+      bool IsAscii(PathArg s)
+      {
+         return std::all_of(s.begin(), s.end(), [](char c) { return (unsigned char)c < 0x80; });
+      }
+
+      /// \internal the folded key index of \c map, built on first use. Empty if the map is not indexed
+      std::vector<MapIndexes::FoldedKey> const & MapIndexes::Folded(detail::node const & map)
+      {
+         auto [it, isNew] = m_folded.try_emplace(&map);
+         if (isNew && map.type() == NodeType::Map && map.size() >= m_options.minMapSize)
+         {
+            auto & keys = it->second;
+            uint32_t order = 0;
+            for (auto && kv : map)
+            {
+               if (kv.first->type() == NodeType::Scalar)      // other keys never match a string token
+                  keys.push_back({ FoldedHash(kv.first->scalar()), order, { kv.first, kv.second } });
+               ++order;
+            }
+            std::sort(keys.begin(), keys.end());
+         }
+         return it->second;
+      }
+
+      /// \internal the sorted key index of \c map, built on first use. Empty if the map is not indexed
+      std::vector<MapIndexes::SortedKey> const & MapIndexes::Sorted(detail::node const & map)
+      {
+         auto [it, isNew] = m_sorted.try_emplace(&map);
+         if (isNew && map.type() == NodeType::Map && map.size() >= m_options.minMapSize)
+         {
+            auto & keys = it->second;
+            uint32_t order = 0;
+            for (auto && kv : map)
+            {
+               if (kv.first->type() == NodeType::Scalar)
+                  keys.push_back({ kv.first->scalar(), order, { kv.first, kv.second } });
+               ++order;
+            }
+            std::sort(keys.begin(), keys.end());
+         }
+         return it->second;
+      }
+
+      /** \internal finds the pairs of \c map that may match \c key, in document order, to be checked with \ref KeyIsMatch.
+          Returns \c nullptr if there is no suitable index, then all keys of the map need to be checked.
+          The result is valid until the next call.
+      */
+      std::vector<MapIndexes::Pair> const * MapIndexes::FindKeys(detail::node const & map, KVToken const & key)
+      {
+         if (key.starry && !key.noCase && !key.token.empty() && m_options.sortedKeys)
+         {
+            auto & keys = Sorted(map);
+            if (keys.empty())
+               return nullptr;
+
+            // keys starting with the prefix, restored to document order
+            auto first = std::lower_bound(keys.begin(), keys.end(), key.token, [](SortedKey const & k, PathArg prefix) { return k.key < prefix; });
+            m_range.clear();
+            for (; first != keys.end() && first->key.substr(0, key.token.size()) == key.token; ++first)
+               m_range.push_back(&*first);
+            std::sort(m_range.begin(), m_range.end(), [](SortedKey const * a, SortedKey const * b) { return a->order < b->order; });
+
+            m_candidates.clear();
+            for (auto k : m_range)
+               m_candidates.push_back(k->pair);
+            return &m_candidates;
+         }
+
+         if (!m_options.foldedKeys || !key.noCase || key.starry || !IsAscii(key.token))
+            return nullptr;
+
+         auto & keys = Folded(map);
+         if (keys.empty())
+            return nullptr;
+
+         const uint64_t hash = FoldedHash(key.token);
+         auto first = std::lower_bound(keys.begin(), keys.end(), hash, [](FoldedKey const & k, uint64_t h) { return k.hash < h; });
+         m_candidates.clear();
+         for (; first != keys.end() && first->hash == hash; ++first)
+            m_candidates.push_back(first->pair);
+         return &m_candidates;
+      }
+
+      /// \internal the bits set for \c key in a key signature: two bits of a 64 bit Bloom filter
+      uint64_t KeySignature(PathArg key)
+      {
+         uint64_t hash = 14695981039346656037ull;     // FNV-1a
+         for (unsigned char c : key)
+            hash = (hash ^ c) * 1099511628211ull;
+         return (uint64_t(1) << (hash & 63)) | (uint64_t(1) << ((hash >> 6) & 63));
+      }
+
+      /// \internal maps with more keys are not signed: their signature would have most bits set
+      constexpr size_t MaxSignedKeys = 32;
+
+      /// \internal the slot of \c map in \c m_signatures, or of the empty slot where it would be inserted
+      size_t MapIndexes::SignatureSlot(detail::node const * map) const
+      {
+         const size_t mask = m_signatures.size() - 1;
+         size_t slot = size_t((uintptr_t(map) * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+         while (m_signatures[slot].first && m_signatures[slot].first != map)
+            slot = (slot + 1) & mask;
+         return slot;
+      }
+
+      /// \internal builds the key signatures of all maps reachable from \c root, in a single pass
+      void MapIndexes::BuildSignatures(detail::node const & root)
+      {
+         m_signed = true;
+         std::vector<std::pair<detail::node const *, uint64_t>> signatures;
+         std::vector<detail::node const *> pending = { &root };
+         while (!pending.empty())
+         {
+            auto & node = *pending.back();
+            pending.pop_back();
+            if (node.type() == NodeType::Sequence)
+            {
+               for (auto el : node)
+                  pending.push_back(&*el);
+            }
+            else if (node.type() == NodeType::Map)
+            {
+               uint64_t signature = 0;
+               for (auto && kv : node)
+               {
+                  if (kv.first->type() == NodeType::Scalar)
+                     signature |= KeySignature(kv.first->scalar());
+                  pending.push_back(kv.second);
+               }
+               if (node.size() <= MaxSignedKeys)
+                  signatures.emplace_back(&node, signature);
+            }
+         }
+
+         // at most half full, so that probing ends after few slots
+         size_t size = 16;
+         while (size < 2 * signatures.size())
+            size *= 2;
+         m_signatures.assign(signatures.empty() ? 0 : size, { nullptr, 0 });
+         for (auto & entry : signatures)
+            m_signatures[SignatureSlot(entry.first)] = entry;
+      }
+
+      /// \internal builds the indexes that are built for the entire document at once
+      void MapIndexes::Prepare(detail::node const & root)
+      {
+         if (m_options.keySignatures && !m_signed)
+            BuildSignatures(root);
+      }
+
+      /// \internal false if \c map certainly does not contain \c key. Maps not signed may contain any key
+      bool MapIndexes::MayContainKey(detail::node const & map, PathArg key) const
+      {
+         auto & entry = m_signatures[SignatureSlot(&map)];
+         if (!entry.first)
+            return true;
+         const uint64_t bits = KeySignature(key);
+         return (entry.second & bits) == bits;
+      }
+
+      size_t MapIndexes::IndexedMaps() const
+      {
+         size_t count = std::count_if(m_folded.begin(), m_folded.end(), [](auto const & entry) { return !entry.second.empty(); });
+         for (auto & [map, keys] : m_sorted)
+         {
+            auto folded = m_folded.find(map);
+            count += !keys.empty() && (folded == m_folded.end() || folded->second.empty());
+         }
+         return count;
+      }
+
+      void MapIndexes::Clear()
+      {
+         m_folded.clear();
+         m_sorted.clear();
+         m_signatures.clear();
+         m_signed = false;
+      }
+
+      size_t MapIndexes::MemoryUsage() const
+      {
+         size_t bytes = (m_folded.bucket_count() + m_sorted.bucket_count()) * sizeof(void *);
+         for (auto & [map, keys] : m_folded)
+            bytes += sizeof(*m_folded.begin()) + sizeof(void *) + keys.capacity() * sizeof(FoldedKey);
+         for (auto & [map, keys] : m_sorted)
+            bytes += sizeof(*m_sorted.begin()) + sizeof(void *) + keys.capacity() * sizeof(SortedKey);
+         bytes += m_signatures.capacity() * sizeof(m_signatures[0]);
+         return bytes;
+      }
+   }
+
+   using namespace YamlPathDetail;
+
+   IndexedDocument::IndexedDocument(Node const & root, IndexOptions const & options)
+      : m_root(root), m_indexes(std::make_unique<MapIndexes>(options))
+   {
+      m_generation = AttachGeneration(m_root);
+      m_indexedGeneration = m_generation->load(std::memory_order_acquire);
+   }
+
+   IndexedDocument::~IndexedDocument()
+   {
+      DetachGeneration(m_root, m_generation);
+   }
+
+   /// \internal discards the indexes if the document was modified since they were built. Builds the indexes for the entire document
+   void IndexedDocument::Validate()
+   {
+      const uint64_t generation = m_generation->load(std::memory_order_acquire);
+      if (generation != m_indexedGeneration)
+      {
+         m_indexes->Clear();
+         m_indexedGeneration = generation;
+      }
+      if (auto root = NodeAccess::Impl(m_root))
+         m_indexes->Prepare(*root);
+   }
+
+   void IndexedDocument::Clear()
+   {
+      m_indexes->Clear();
+   }
+
+   size_t IndexedDocument::IndexedMaps() const
+   {
+      return m_indexes->IndexedMaps();
+   }
+
+   size_t IndexedDocument::MemoryUsage() const
+   {
+      return m_indexes->MemoryUsage();
+   }
+
+   /** Returns the result of \ref SelectNodes for \c path and \c args, using and building indexes as needed.
+       Throws a \ref PathException if \c path is malformed.
+   */
+   std::vector<Node> IndexedDocument::SelectNodes(PathArg path, PathBoundArgs args)
+   {
+      Validate();
+      PathArg fullPath = path;
+      PathErrorInfo info;
+      EvalContext ctx;
+      ctx.readOnly = true;
+      ctx.indexes = m_indexes.get();
+      MetricsScope metrics(EPathOp::SelectNodes, fullPath, &ctx);
+      EvalNodes nodes{ m_root };
+      auto err = EvalPath(nodes, path, args, &info, ctx);
+      metrics.Result(err, nodes);
+      if (err == EPathError::OK)
+      {
+         if (nodes.isList)
+            return std::move(nodes.list);
+         if (nodes.node)
+            return { nodes.node };
+         return {};
+      }
+
+      if (PathException::IsNodeError(err))
+         return {};
+
+      throw PathException(info, fullPath);
+   }
+
+   /// \copydoc IndexedDocument::SelectNodes(PathArg, PathBoundArgs)
+   std::vector<Node> IndexedDocument::SelectNodes(CompiledPath const & path)
+   {
+      Validate();
+      EvalContext ctx;
+      ctx.readOnly = true;
+      ctx.indexes = m_indexes.get();
+      return YamlPathDetail::SelectNodes(m_root, path, ctx);
+   }
+}
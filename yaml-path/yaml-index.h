@@ -0,0 +1,93 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace YAML
+{
+   namespace YamlPathDetail { class MapIndexes; }
+
+   /// Selects the indexes built by \ref IndexedDocument
+   struct IndexOptions
+   {
+      size_t minMapSize = 8;        ///< maps with fewer pairs are not indexed: comparing their keys is as fast as a lookup
+      bool   foldedKeys = true;     ///< index keys folded to lower case, for case-insensitive keys (e.g. <code>{^name=x}</code>) in map filters
+      bool   sortedKeys = true;     ///< index keys in sorted order, for key prefixes (e.g. <code>{cpu*}</code> or <code>{env*=prod}</code>) in map filters
+      bool   keySignatures = false; ///< build a signature of the keys of each map, to skip maps that don't contain a key
+   };
+
+   /** Evaluates paths over one document using indexes of its maps, built on first use.
+
+      With \c IndexOptions::foldedKeys, a map filter with a case-insensitive key (e.g. <code>{^name=web}</code> or <code>{^Name}</code>)
+      looks up the key in a hash index of the map's keys folded to lower case, instead of comparing it with each key.
+      Case folding is ASCII only, like the comparison without index; keys with non-ASCII characters in the path
+      are compared with each key of the map.
+
+      With \c IndexOptions::sortedKeys, a key prefix (e.g. <code>{cpu*}</code>) is looked up by binary search in the sorted keys
+      of the map, and only the keys in the matching range are compared. Case-insensitive prefixes (<code>{^cpu*}</code>) are not indexed.
+
+      With \c IndexOptions::keySignatures, the first query walks the document once, and stores a 64 bit signature of the keys
+      of each map with up to 32 keys (about 32 bytes per map). Selecting a key (e.g. \c "items.owner") or filtering by a key
+      (e.g. <code>items.{owner=bob}</code>) skips most maps that don't contain the key without comparing their keys.
+
+      Results are those of \ref SelectNodes. The indexes are discarded when the document is modified through
+      \ref Ensure, \ref EnsureExists or \ref EnsureBatch. After modifying the document directly, call \ref TouchDocument.
+
+      An \c IndexedDocument is meant to be used by one thread.
+
+      \code
+      IndexedDocument doc(config);
+      for (auto & svc : services)
+         auto ports = doc.SelectNodes("services.{^Name=%}.ports", { svc });
+      \endcode
+   */
+   class IndexedDocument
+   {
+   public:
+      explicit IndexedDocument(Node const & root, IndexOptions const & options = {});
+      ~IndexedDocument();
+      IndexedDocument(IndexedDocument const &) = delete;
+      IndexedDocument & operator=(IndexedDocument const &) = delete;
+
+      std::vector<Node> SelectNodes(PathArg path, PathBoundArgs args = {});
+      std::vector<Node> SelectNodes(CompiledPath const & path);
+
+      void Clear();
+      size_t IndexedMaps() const;    ///< number of maps with an index
+      size_t MemoryUsage() const;    ///< approximate memory used by the indexes, in bytes
+
+   private:
+      Node                                      m_root;
+      std::shared_ptr<std::atomic<uint64_t>>    m_generation;   // see QueryCache
+      uint64_t                                  m_indexedGeneration = 0;
+      std::unique_ptr<YamlPathDetail::MapIndexes> m_indexes;
+
+      void Validate();
+   };
+}
@@ -0,0 +1,284 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-metrics.h"
+#include "yaml-path-internals.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      /// \internal error codes counted separately. Other codes are counted as \c EPathError::Internal
+      constexpr EPathError CountedErrors[] =
+      {
+         EPathError::OK, EPathError::Internal, EPathError::InvalidToken, EPathError::InvalidIndex, EPathError::UnexpectedEnd,
+         EPathError::SelectorNotSupported, EPathError::InvalidNodeType, EPathError::NodeNotFound,
+      };
+      constexpr size_t ErrorSlotCount = sizeof(CountedErrors) / sizeof(CountedErrors[0]);
+      constexpr size_t OpCount = size_t(EPathOp::Count_);
+
+      size_t ErrorSlot(EPathError error)
+      {
+         for (size_t i = 0; i < ErrorSlotCount; ++i)
+            if (CountedErrors[i] == error)
+               return i;
+         return 1;
+      }
+
+      /** \internal counter written by a single thread, and read by any thread.
+          Unlike \c fetch_add, incrementing does not need a locked instruction.
+      */
+      struct Counter
+      {
+         std::atomic<uint64_t> value { 0 };
+
+         void Add(uint64_t n)    { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+         uint64_t Get() const    { return value.load(std::memory_order_relaxed); }
+         void Reset()            { value.store(0, std::memory_order_relaxed); }
+      };
+
+      /// \internal metrics collected by one thread
+      struct ThreadMetrics
+      {
+         Counter calls[OpCount];
+         Counter visited[OpCount];
+         Counter results[OpCount];
+         Counter errors[OpCount][ErrorSlotCount];
+
+         std::mutex latencyLock;                                     // uncontended, except while metrics are read
+         std::deque<std::string> paths;                              // storage for the keys of latency
+         std::unordered_map<PathArg, PathLatencyHistogram> latency;  // by canonical path. Lookup by PathArg does not allocate
+         std::string canonical;                                      // reused for the canonical path of each evaluation
+
+         void AddTo(PathMetrics & m)
+         {
+            for (size_t op = 0; op < OpCount; ++op)
+            {
+               auto & counters = m.ops[op];
+               counters.calls += calls[op].Get();
+               counters.nodesVisited += visited[op].Get();
+               counters.resultNodes += results[op].Get();
+               for (size_t e = 1; e < ErrorSlotCount; ++e)
+                  if (auto n = errors[op][e].Get())
+                     counters.errors[CountedErrors[e]] += n;
+            }
+
+            std::lock_guard<std::mutex> lock(latencyLock);
+            for (auto & el : latency)
+               m.latency[std::string(el.first)].Add(el.second);
+         }
+
+         void Reset()
+         {
+            for (size_t op = 0; op < OpCount; ++op)
+            {
+               calls[op].Reset();
+               visited[op].Reset();
+               results[op].Reset();
+               for (auto & e : errors[op])
+                  e.Reset();
+            }
+            std::lock_guard<std::mutex> lock(latencyLock);
+            latency.clear();
+            paths.clear();
+         }
+      };
+
+      /// \internal all threads that collected metrics, and the metrics of threads that have ended
+      struct MetricsRegistry
+      {
+         std::mutex lock;
+         std::vector<ThreadMetrics *> threads;
+         PathMetrics retired;
+
+         std::atomic<uint64_t> slowNanoseconds { UINT64_MAX };
+         std::atomic<size_t>   slowNodes { SIZE_MAX };
+         std::shared_ptr<PathSlowQueryHandler> slowHandler;    // accessed through std::atomic_load / std::atomic_store
+      };
+
+      MetricsRegistry & Registry()
+      {
+         static MetricsRegistry * registry = new MetricsRegistry;    // not destroyed: threads may end after static destruction
+         return *registry;
+      }
+
+      /// \internal registers the metrics of the calling thread, and moves them to \c retired when the thread ends
+      struct ThreadMetricsHolder
+      {
+         ThreadMetrics * metrics = new ThreadMetrics;
+
+         ThreadMetricsHolder()
+         {
+            auto & r = Registry();
+            std::lock_guard<std::mutex> lock(r.lock);
+            r.threads.push_back(metrics);
+         }
+
+         ~ThreadMetricsHolder()
+         {
+            auto & r = Registry();
+            std::lock_guard<std::mutex> lock(r.lock);
+            metrics->AddTo(r.retired);
+            r.threads.erase(std::find(r.threads.begin(), r.threads.end(), metrics));
+            delete metrics;
+         }
+      };
+
+      ThreadMetrics & LocalMetrics()
+      {
+         thread_local ThreadMetricsHolder holder;
+         return *holder.metrics;
+      }
+
+      /// \internal records one evaluation, called by \ref MetricsScope
+      void RecordPathMetrics(EPathOp op, PathArg path, EPathError error, uint64_t nanoseconds, size_t nodesVisited, size_t resultNodes)
+      {
+         auto & m = LocalMetrics();
+         const size_t idx = size_t(op);
+         m.calls[idx].Add(1);
+         m.visited[idx].Add(nodesVisited);
+         m.results[idx].Add(resultNodes);
+         if (error != EPathError::OK)
+            m.errors[idx][ErrorSlot(error)].Add(1);
+
+         {
+            CanonicalPath(path, m.canonical);
+            std::lock_guard<std::mutex> lock(m.latencyLock);
+            auto it = m.latency.find(m.canonical);
+            if (it == m.latency.end())
+               it = m.latency.emplace(m.paths.emplace_back(m.canonical), PathLatencyHistogram()).first;
+            it->second.Add(nanoseconds);
+         }
+
+         auto & r = Registry();
+         if (nanoseconds >= r.slowNanoseconds.load(std::memory_order_relaxed) || nodesVisited >= r.slowNodes.load(std::memory_order_relaxed))
+         {
+            auto handler = std::atomic_load(&r.slowHandler);
+            if (handler && *handler)
+               (*handler)(PathSlowQuery{ op, path, error, nanoseconds, nodesVisited, resultNodes });
+         }
+      }
+   }
+
+   using namespace YamlPathDetail;
+
+   void PathLatencyHistogram::Add(uint64_t nanoseconds)
+   {
+      size_t bucket = 0;
+      for (uint64_t v = nanoseconds; v > 1 && bucket < BucketCount - 1; v >>= 1)
+         ++bucket;
+
+      ++buckets[bucket];
+      ++count;
+      totalNanoseconds += nanoseconds;
+      maxNanoseconds = std::max(maxNanoseconds, nanoseconds);
+   }
+
+   void PathLatencyHistogram::Add(PathLatencyHistogram const & other)
+   {
+      for (size_t i = 0; i < BucketCount; ++i)
+         buckets[i] += other.buckets[i];
+      count += other.count;
+      totalNanoseconds += other.totalNanoseconds;
+      maxNanoseconds = std::max(maxNanoseconds, other.maxNanoseconds);
+   }
+
+   /** returns an upper bound for the latency at percentile \c p (0..1): the upper end of the bucket containing it, 
+       but not more than the maximum latency recorded. Returns 0 if no evaluations were recorded.
+   */
+   uint64_t PathLatencyHistogram::Percentile(double p) const
+   {
+      if (!count)
+         return 0;
+
+      uint64_t rank = uint64_t(p * count + 0.5);
+      uint64_t seen = 0;
+      for (size_t i = 0; i < BucketCount; ++i)
+      {
+         seen += buckets[i];
+         if (seen >= rank && seen > 0)
+            return std::min(maxNanoseconds, (uint64_t(2) << i) - 1);
+      }
+      return maxNanoseconds;
+   }
+
+   /** Returns the metrics collected for yaml-path operations since the start of the process or the last call to \ref ResetPathMetrics.
+
+      Metrics are collected only if yaml-path is compiled with <code>YAML_PATH_METRICS=1</code>, otherwise the result is empty
+      and \ref PathMetrics::enabled is false.
+
+      Each thread collects metrics separately, so collecting them does not cause contention between threads.
+      This function sums them up. While other threads are evaluating paths, the counters may be slightly out of sync with each other.
+
+      \code
+      auto m = GetPathMetrics();
+      for (auto & [path, hist] : m.latency)
+         if (hist.Percentile(0.99) > 100'000)
+            std::cout << path << ": p99 " << hist.Percentile(0.99) << " ns\n";
+      \endcode
+   */
+   PathMetrics GetPathMetrics()
+   {
+      auto & r = Registry();
+      std::lock_guard<std::mutex> lock(r.lock);
+      PathMetrics result = r.retired;
+      for (auto t : r.threads)
+         t->AddTo(result);
+      result.enabled = YAML_PATH_METRICS != 0;
+      return result;
+   }
+
+   /// resets all metrics to zero. Evaluations running concurrently may be lost, or counted only partially
+   void ResetPathMetrics()
+   {
+      auto & r = Registry();
+      std::lock_guard<std::mutex> lock(r.lock);
+      r.retired = PathMetrics();
+      for (auto t : r.threads)
+         t->Reset();
+   }
+
+   /** Installs \c handler to be called for each evaluation that takes at least \c thresholdNanoseconds,
+      or visits at least \c thresholdNodesVisited nodes. Pass an empty \c handler to remove it.
+
+      The handler is called on the thread that evaluated the path, after the evaluation completed
+      (including evaluations that throw a \ref PathException). It must not throw.
+      Requires <code>YAML_PATH_METRICS=1</code>.
+   */
+   void SetPathSlowQueryHandler(PathSlowQueryHandler handler, uint64_t thresholdNanoseconds, size_t thresholdNodesVisited)
+   {
+      auto & r = Registry();
+      std::lock_guard<std::mutex> lock(r.lock);
+      const bool enable = bool(handler);
+      std::atomic_store(&r.slowHandler, enable ? std::make_shared<PathSlowQueryHandler>(std::move(handler)) : nullptr);
+      r.slowNanoseconds = enable ? thresholdNanoseconds : UINT64_MAX;
+      r.slowNodes = enable ? thresholdNodesVisited : SIZE_MAX;
+   }
+}
@@ -0,0 +1,103 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+/** Set to 1 (e.g. on the compiler command line) to collect metrics for \ref GetPathMetrics, and to enable \ref SetPathSlowQueryHandler.
+    With the default of 0, the instrumentation of yaml-path compiles to nothing. 
+    All sources of yaml-path must be compiled with the same setting.
+*/
+#ifndef YAML_PATH_METRICS
+#define YAML_PATH_METRICS 0
+#endif
+
+namespace YAML
+{
+   /// operations covered by \ref GetPathMetrics
+   enum class EPathOp
+   {
+      Select,        ///< \ref Select, \ref TrySelect
+      Require,       ///< \ref Require, \ref TryRequire
+      SelectNodes,   ///< \ref SelectNodes, \ref SelectDistinct
+      Ensure,        ///< \ref Ensure, \ref EnsureExists, \ref EnsureBatch
+      PathResolve,   ///< \ref PathResolve
+      Count_
+   };
+
+   /// counters for one operation, see \ref PathMetrics
+   struct PathOpCounters
+   {
+      uint64_t calls = 0;
+      uint64_t nodesVisited = 0;             ///< nodes the selectors were applied to (not counted for \c Ensure)
+      uint64_t resultNodes = 0;              ///< nodes selected
+      std::map<EPathError, uint64_t> errors; ///< number of calls failing with each error
+   };
+
+   /// latency distribution of the evaluations of one path, see \ref PathMetrics
+   struct PathLatencyHistogram
+   {
+      static constexpr size_t BucketCount = 40;
+      uint64_t buckets[BucketCount] = {};    ///< bucket \c i counts evaluations that took <code>[2^i, 2^(i+1))</code> nanoseconds (bucket 0 includes 0)
+      uint64_t count = 0;
+      uint64_t totalNanoseconds = 0;
+      uint64_t maxNanoseconds = 0;
+
+      void Add(uint64_t nanoseconds);
+      void Add(PathLatencyHistogram const & other);
+      uint64_t Percentile(double p) const;
+   };
+
+   /// snapshot of the metrics collected, see \ref GetPathMetrics
+   struct PathMetrics
+   {
+      bool enabled = false;                  ///< false if yaml-path was compiled with <code>YAML_PATH_METRICS == 0</code>
+      PathOpCounters ops[size_t(EPathOp::Count_)];
+      std::map<std::string, PathLatencyHistogram> latency;    ///< by canonical path: without whitespace, and with indices and values of map filter conditions written as \c %
+
+      PathOpCounters const & operator[](EPathOp op) const { return ops[size_t(op)]; }
+   };
+
+   /// information passed to the handler installed by \ref SetPathSlowQueryHandler
+   struct PathSlowQuery
+   {
+      EPathOp     op;
+      PathArg     path;
+      EPathError  error;
+      uint64_t    nanoseconds;
+      size_t      nodesVisited;
+      size_t      resultNodes;
+   };
+
+   using PathSlowQueryHandler = std::function<void(PathSlowQuery const &)>;
+
+   PathMetrics GetPathMetrics();
+   void ResetPathMetrics();
+   void SetPathSlowQueryHandler(PathSlowQueryHandler handler, uint64_t thresholdNanoseconds, size_t thresholdNodesVisited = SIZE_MAX);
+}
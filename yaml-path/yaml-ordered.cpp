@@ -0,0 +1,421 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-ordered.h"
+#include "yaml-path-internals.h"
+#include <algorithm>
+#include <assert.h>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      struct OrderedEntry
+      {
+         uint32_t               position;   // index of the element in the sequence
+         detail::node const *   element;
+      };
+
+      /** \internal entries of an \ref OrderedIndex sorted by value.
+          Entries added later are kept in a small sorted delta, which is merged when it exceeds 1/64 of the main list,
+          so that appending an element does not move half of the entries.
+      */
+      template <typename TEntry>
+      struct SortedEntries
+      {
+         std::vector<TEntry> main;
+         std::vector<TEntry> delta;
+
+         static bool ValueLess(TEntry const & a, TEntry const & b) { return a.value < b.value; }
+
+         size_t Size() const       { return main.size() + delta.size(); }
+         size_t Capacity() const   { return main.capacity() + delta.capacity(); }
+         void Clear()              { main.clear(); delta.clear(); }
+         void Sort()               { std::sort(main.begin(), main.end(), ValueLess); }
+
+         void Insert(TEntry const & e)
+         {
+            delta.insert(std::upper_bound(delta.begin(), delta.end(), e, ValueLess), e);
+            if (delta.size() > std::max<size_t>(64, main.size() / 64))
+            {
+               const size_t mid = main.size();
+               main.insert(main.end(), delta.begin(), delta.end());
+               std::inplace_merge(main.begin(), main.begin() + mid, main.end(), ValueLess);
+               delta.clear();
+            }
+         }
+
+         template <typename TPred>
+         void RemoveIf(TPred pred)
+         {
+            main.erase(std::remove_if(main.begin(), main.end(), pred), main.end());
+            delta.erase(std::remove_if(delta.begin(), delta.end(), pred), delta.end());
+         }
+
+         /// adds the entries matching the comparison \c op with \c value to \c matches
+         template <typename TValue>
+         void Collect(EKVOp op, TValue const & value, std::vector<OrderedEntry const *> & matches) const
+         {
+            for (auto entries : { &main, &delta })
+            {
+               auto lower = std::lower_bound(entries->begin(), entries->end(), value, [](TEntry const & e, TValue const & v) { return e.value < v; });
+               auto upper = std::upper_bound(lower, entries->end(), value, [](TValue const & v, TEntry const & e) { return v < e.value; });
+               auto first = entries->begin(), last = entries->end();
+               switch (op)
+               {
+                  case EKVOp::Less:          last = lower; break;
+                  case EKVOp::LessEqual:     last = upper; break;
+                  case EKVOp::Greater:       first = upper; break;
+                  case EKVOp::GreaterEqual:  first = lower; break;
+                  default:                   assert(false); return;
+               }
+               for (; first != last; ++first)
+                  matches.push_back(&*first);
+            }
+         }
+      };
+
+      /// \internal implementation of \ref OrderedIndex. All members after \c lock are guarded by it. Readers of an index that is up to date share the lock
+      struct OrderedIndexState
+      {
+         using Entry = OrderedEntry;
+         struct NumberEntry : Entry { double value; };
+         struct StringEntry : Entry { PathArg value; };    // view of the scalar in the document
+
+         Node           root;
+         std::string    seqPath;
+         std::string    field;
+         SelectorList   seqSelectors;     // refers to seqPath
+         std::shared_ptr<std::atomic<uint64_t>> generation;    // see QueryCache
+
+         std::shared_mutex lock;
+         bool           stale = true;     // rebuild on next use
+         uint64_t       synced = 0;       // generation the index is up to date with, except for dirty
+         Node           seq;              // sequence indexed, null if seqPath does not select a sequence
+         size_t         seqSize = 0;      // elements of seq seen when indexing
+         std::vector<uint32_t>    dirty;  // positions modified since
+         SortedEntries<NumberEntry> numbers;
+         SortedEntries<StringEntry> strings;
+         size_t         rebuilds = 0;
+
+         bool IsSynced() const { return !stale && dirty.empty() && generation->load(std::memory_order_acquire) == synced; }
+         void Sync();
+         void Rebuild();
+         void Reindex();
+         template <typename TAddNumber, typename TAddString>
+         void Add(uint32_t position, detail::node const & element, TAddNumber addNumber, TAddString addString);
+         bool Find(Node const & seqNode, ArgKVPair const & cond, std::vector<Node> & result);
+         bool FindSynced(Node const & seqNode, ArgKVPair const & cond, std::vector<Node> & result) const;
+         void OnEnsure(Node const & node, PathArg path, PathBoundArgs args, bool modified);
+      };
+
+      /// \internal adds the entry for the value of \c field of \c element, if it is a scalar. See \ref RangeIsMatch for the types
+      template <typename TAddNumber, typename TAddString>
+      void OrderedIndexState::Add(uint32_t position, detail::node const & element, TAddNumber addNumber, TAddString addString)
+      {
+         auto value = element.type() == NodeType::Map ? FindKey(element, field) : nullptr;
+         if (!value || value->type() != NodeType::Scalar)
+            return;
+
+         PathArg scalar = value->scalar();
+         double number = 0;
+         if (!ParseNumber(scalar, number))
+            addString(StringEntry{ { position, &element }, scalar });
+         else if (number == number)    // NaN does not match any comparison
+            addNumber(NumberEntry{ { position, &element }, number });
+      }
+
+      void OrderedIndexState::Rebuild()
+      {
+         numbers.Clear();
+         strings.Clear();
+         dirty.clear();
+         seq.reset();
+         seqSize = 0;
+         synced = generation->load(std::memory_order_acquire);
+         stale = false;
+         ++rebuilds;
+
+         EvalContext ctx;
+         ctx.readOnly = true;
+         EvalNodes nodes{ root };
+         if (EvalSelectors(nodes, seqSelectors, ctx) != EPathError::OK || nodes.isList || !nodes.node.IsSequence())
+            return;
+
+         seq.reset(nodes.node);
+         for (auto el : *NodeAccess::Impl(seq))
+            Add(uint32_t(seqSize++), *el, [&](NumberEntry const & e) { numbers.main.push_back(e); }, [&](StringEntry const & e) { strings.main.push_back(e); });
+         numbers.Sort();
+         strings.Sort();
+      }
+
+      /// \internal indexes the elements modified by Ensure again
+      void OrderedIndexState::Reindex()
+      {
+         std::sort(dirty.begin(), dirty.end());
+         dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+         if (dirty.front() < seqSize)
+         {
+            // remove the entries of modified elements. Their values may have changed: remove by position
+            std::vector<bool> modified(seqSize);
+            for (auto p : dirty)
+               if (p < seqSize)
+                  modified[p] = true;
+            auto IsModified = [&](Entry const & e) { return modified[e.position]; };
+            numbers.RemoveIf(IsModified);
+            strings.RemoveIf(IsModified);
+         }
+
+         Node const & s = seq;
+         for (auto p : dirty)
+         {
+            Node el = s[p];      // const access: does not extend the sequence
+            if (auto impl = NodeAccess::Impl(el))
+               Add(p, *impl, [&](NumberEntry const & e) { numbers.Insert(e); }, [&](StringEntry const & e) { strings.Insert(e); });
+         }
+         seqSize = seq.size();
+         dirty.clear();
+      }
+
+      void OrderedIndexState::Sync()
+      {
+         if (stale || generation->load(std::memory_order_acquire) != synced)
+            Rebuild();
+         else if (!dirty.empty())
+            Reindex();
+      }
+
+      /** \internal selects the elements of \c seqNode matching the comparison \c cond, in document order.
+          Returns false if this index is not for \c seqNode and the key of \c cond.
+      */
+      bool OrderedIndexState::Find(Node const & seqNode, ArgKVPair const & cond, std::vector<Node> & result)
+      {
+         if (cond.key.token != field)
+            return false;
+
+         {
+            std::shared_lock<std::shared_mutex> shared(lock);
+            if (IsSynced())
+               return FindSynced(seqNode, cond, result);
+         }
+
+         std::lock_guard<std::shared_mutex> guard(lock);
+         Sync();
+         return FindSynced(seqNode, cond, result);
+      }
+
+      /// \internal \ref Find on an index that is up to date
+      bool OrderedIndexState::FindSynced(Node const & seqNode, ArgKVPair const & cond, std::vector<Node> & result) const
+      {
+         if (!seq || NodeAccess::Impl(seq) != NodeAccess::Impl(seqNode))
+            return false;
+
+         std::vector<Entry const *> matches;
+         double number = 0;
+         if (!ParseNumber(cond.value.token, number))
+            strings.Collect(cond.op, cond.value.token, matches);
+         else if (number == number)
+            numbers.Collect(cond.op, number, matches);
+
+         std::sort(matches.begin(), matches.end(), [](Entry const * a, Entry const * b) { return a->position < b->position; });
+         for (auto m : matches)
+            result.push_back(NodeAccess::Make(*m->element, seqNode));
+         return true;
+      }
+
+      /** \internal called after \ref Ensure evaluated \c path from \c node.
+          Ensure changed the generation of the document once. If no other modification was missed, the elements that \c path
+          may have modified are marked as dirty. Paths that may have modified the sequence otherwise make the index stale.
+      */
+      void OrderedIndexState::OnEnsure(Node const & node, PathArg path, PathBoundArgs args, bool modified)
+      {
+         std::lock_guard<std::shared_mutex> guard(lock);
+         const uint64_t current = generation->load(std::memory_order_acquire);
+         if (stale || current > synced + 1)
+         {
+            stale = true;
+            return;
+         }
+         synced = current;
+         if (!modified)
+            return;
+
+         SelectorList edited;
+         if (!seq || NodeAccess::Impl(node) != NodeAccess::Impl(root) || ScanSelectors(edited, path, args) != EPathError::OK)
+         {
+            stale = true;
+            return;
+         }
+
+         // the sequence was found along seqSelectors. While edited follows them, it visits the same nodes
+         const size_t count = seqSelectors.size();
+         for (size_t i = 0; i < count; ++i)
+         {
+            if (i >= edited.size() || edited[i].selector != seqSelectors[i].selector)
+            {
+               stale = true;
+               return;
+            }
+            if (edited[i].selector == ESelector::Key && std::get<ArgKey>(edited[i].data).key != std::get<ArgKey>(seqSelectors[i].data).key)
+               return;     // other key of the same map
+            if (edited[i].selector == ESelector::Index && std::get<ArgIndex>(edited[i].data).index != std::get<ArgIndex>(seqSelectors[i].data).index)
+               return;     // other element of the same sequence, or padding after it
+         }
+
+         if (edited.size() == count || edited[count].selector != ESelector::Index)
+         {
+            stale = true;     // the sequence itself was created, or a selector fanned out over its elements
+            return;
+         }
+
+         if (edited.size() > count + 1 && edited[count + 1].selector == ESelector::Key && std::get<ArgKey>(edited[count + 1].data).key != field)
+            return;           // other key of the element
+
+         dirty.push_back(uint32_t(std::get<ArgIndex>(edited[count].data).index));
+      }
+
+      /** \internal \ref OrderedIndex "OrderedIndexes" by the memory holder of their root. Other nodes of the document may have
+          another holder, see \ref SameDocument. Evaluations only read the registry, and share the lock.
+      */
+      struct OrderedRegistry
+      {
+         std::shared_mutex lock;
+         std::unordered_multimap<detail::memory_holder const *, OrderedIndexState *> documents;
+         std::atomic<size_t> count { 0 };    // size of documents, checked without locking
+      };
+
+      OrderedRegistry & OrderedIndexes()
+      {
+         static OrderedRegistry * registry = new OrderedRegistry;    // not destroyed, like the registry of QueryCache generations
+         return *registry;
+      }
+
+      /** \internal selects the elements of the sequence \c seq matching the comparison \c cond, if an \ref OrderedIndex exists for them.
+          Returns false otherwise. Costs one atomic load if no document has an \c OrderedIndex. Concurrent readers don't block each other.
+      */
+      bool SelectByOrderedIndex(Node const & seq, ArgKVPair const & cond, std::vector<Node> & result)
+      {
+         auto & r = OrderedIndexes();
+         if (!r.count.load(std::memory_order_relaxed))
+            return false;
+
+         std::shared_lock<std::shared_mutex> lock(r.lock);
+         auto holder = NodeAccess::Memory(seq);
+         auto range = r.documents.equal_range(holder);
+         for (auto it = range.first; it != range.second; ++it)
+            if (it->second->Find(seq, cond, result))
+               return true;
+         if (range.first != range.second)
+            return false;
+
+         // seq may have been selected through a node with another holder. Only indexes of the field can match
+         for (auto & [root, state] : r.documents)
+            if (cond.key.token == state->field && SameDocument(root, holder) && state->Find(seq, cond, result))
+               return true;
+         return false;
+      }
+
+      /// \internal called after \ref Ensure evaluated \c path, modifying the document if \c modified is set
+      void NotifyOrderedIndexes(Node const & node, PathArg path, PathBoundArgs args, bool modified)
+      {
+         auto & r = OrderedIndexes();
+         if (!r.count.load(std::memory_order_relaxed))
+            return;
+
+         std::shared_lock<std::shared_mutex> lock(r.lock);
+         auto holder = NodeAccess::Memory(node);
+         for (auto & [root, state] : r.documents)
+            if (SameDocument(root, holder))
+               state->OnEnsure(node, path, args, modified);
+      }
+   }
+
+   using namespace YamlPathDetail;
+
+   OrderedIndex::OrderedIndex(Node const & root, PathArg seqPath, PathArg field) : m_state(std::make_unique<OrderedIndexState>())
+   {
+      auto & state = *m_state;
+      state.root.reset(root);
+      state.seqPath = seqPath;
+      state.field = field;
+
+      PathErrorInfo info;
+      if (ScanSelectors(state.seqSelectors, state.seqPath, {}, &info) != EPathError::OK)
+         throw PathException(info, seqPath);
+      for (auto & sel : state.seqSelectors)
+         if (sel.selector != ESelector::Key && sel.selector != ESelector::Index)
+         {
+            info.error = EPathError::SelectorNotSupported;
+            throw PathException(info, seqPath);
+         }
+
+      state.generation = AttachGeneration(state.root);
+      auto & r = OrderedIndexes();
+      std::lock_guard<std::shared_mutex> lock(r.lock);
+      r.documents.emplace(NodeAccess::Memory(state.root), &state);
+      r.count = r.documents.size();
+   }
+
+   OrderedIndex::~OrderedIndex()
+   {
+      auto & r = OrderedIndexes();
+      {
+         std::lock_guard<std::shared_mutex> lock(r.lock);
+         auto range = r.documents.equal_range(NodeAccess::Memory(m_state->root));
+         for (auto it = range.first; it != range.second; ++it)
+            if (it->second == m_state.get())
+            {
+               r.documents.erase(it);
+               break;
+            }
+         r.count = r.documents.size();
+      }
+      DetachGeneration(m_state->root, m_state->generation);
+   }
+
+   size_t OrderedIndex::Size() const
+   {
+      std::lock_guard<std::shared_mutex> guard(m_state->lock);
+      m_state->Sync();
+      return m_state->numbers.Size() + m_state->strings.Size();
+   }
+
+   size_t OrderedIndex::Rebuilds() const
+   {
+      std::lock_guard<std::shared_mutex> guard(m_state->lock);
+      return m_state->rebuilds;
+   }
+
+   size_t OrderedIndex::MemoryUsage() const
+   {
+      std::lock_guard<std::shared_mutex> guard(m_state->lock);
+      auto & s = *m_state;
+      return sizeof(s) + s.numbers.Capacity() * sizeof(OrderedIndexState::NumberEntry) + s.strings.Capacity() * sizeof(OrderedIndexState::StringEntry)
+         + s.dirty.capacity() * sizeof(uint32_t);
+   }
+}
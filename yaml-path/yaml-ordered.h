@@ -0,0 +1,76 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <memory>
+
+namespace YAML
+{
+   namespace YamlPathDetail { struct OrderedIndexState; }
+
+   /** An index of the values of one field over the elements of a sequence, sorted for comparisons in map filters.
+
+      While the index exists, a map filter with a single comparison on \c field (e.g. <code>{load>'0.8'}</code> or
+      <code>{ts>=%}</code>) applied to the sequence selected by \c seqPath is answered by binary search in the sorted values,
+      in O(log n + k) for k matches, instead of checking each element. This applies to all evaluations on the document:
+      \ref Select, \ref SelectNodes, \ref PathResolve and \ref CompiledPath. Results are the same as without the index, in document order.
+      Several comparisons are combined by chaining filters, e.g. <code>events.{ts>='2024-05-01'}.{ts<'2024-06-01'}</code>:
+      the second filter is checked only for the elements matched by the first.
+
+      Like the comparison, the index keeps numbers and other scalars apart: a number is compared with numbers, any other
+      value with the scalars that are not numbers, as strings.
+
+      The index is built on first use. When elements are appended or modified through \ref Ensure, \ref EnsureExists or \ref EnsureBatch
+      (e.g. <code>Ensure(root, "events.[%].{ts=%}", { n, ts })</code>), only those elements are indexed again.
+      Other modifications through \c Ensure that may change the sequence, and \ref TouchDocument, rebuild the index on its next use.
+      After modifying the document directly, call \ref TouchDocument.
+
+      \c seqPath may contain only keys and indices. \c field is a key of the elements.
+      Throws a \ref PathException if \c seqPath is malformed, or contains other selectors (\c EPathError::SelectorNotSupported).
+
+      An \c OrderedIndex may be used by concurrent readers of the document; they don't block each other.
+
+      \code
+      OrderedIndex byLoad(root, "hosts", "load");
+      auto busy = SelectNodes(root, "hosts.{load>%}", { "0.8" });
+      \endcode
+   */
+   class OrderedIndex
+   {
+   public:
+      OrderedIndex(Node const & root, PathArg seqPath, PathArg field);
+      ~OrderedIndex();
+      OrderedIndex(OrderedIndex const &) = delete;
+      OrderedIndex & operator=(OrderedIndex const &) = delete;
+
+      size_t Size() const;          ///< number of elements indexed: elements with a scalar value for \c field, except NaN
+      size_t Rebuilds() const;      ///< number of times the index was built from all elements of the sequence
+      size_t MemoryUsage() const;   ///< approximate memory used by the index, in bytes
+
+   private:
+      std::unique_ptr<YamlPathDetail::OrderedIndexState> m_state;
+   };
+}
@@ -29,15 +29,56 @@ SOFTWARE.
 
 
 #include "yaml-path.h"
+#include "yaml-metrics.h"
+#include "yaml-index.h"
+#include <yaml-cpp/node/impl.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <sstream>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
 namespace YAML
 {
+   struct PathExplainReport;
+
+   namespace YamlPathDetail { struct NodeAccessTag {}; }
+
+   /** \internal access to the implementation of a \c Node.
+
+      Iterating a map through \c Node constructs three \c Node objects for each pair visited, looking up a key through the 
+      non-const \c Node::operator[] adds a pair to the map if the key does not exist. The evaluator instead 
+      reads the implementation nodes of yaml-cpp directly, and creates a \c Node only for the nodes it selects.
+      (\c as_if is a friend of \c Node, this specialization is not used for conversion.)
+   */
+   template <>
+   struct as_if<YamlPathDetail::NodeAccessTag, void>
+   {
+      static detail::node * Impl(Node const & node) { return node.m_isValid ? node.m_pNode : nullptr; }
+      static Node Make(detail::node const & impl, Node const & owner) { return Node(const_cast<detail::node &>(impl), owner.m_pMemory); }
+      static Node Make(detail::node const & impl, detail::shared_memory_holder const & memory) { return Node(const_cast<detail::node &>(impl), memory); }
+      static detail::memory_holder * Memory(Node const & node) { return node.m_pMemory.get(); }
+      static detail::shared_memory_holder const & SharedMemory(Node const & node) { return node.m_pMemory; }
+      static Node Invalid() { return Node(Node::ZombieNode); }
+
+      /// creates a node of type \c type in the memory of \c owner. Adding nodes of the same document to it does not merge memory
+      static Node Create(Node const & owner, NodeType::value type)
+      {
+         auto & node = owner.m_pMemory->create_node();
+         node.set_type(type);
+         return Node(node, owner.m_pMemory);
+      }
+   };
+
    namespace YamlPathDetail
    {
+      using NodeAccess = as_if<NodeAccessTag, void>;
+
       /// \internal basic parser helper: removes \c offset chars from \c path, and returns the removed chars
       PathArg SplitAt(PathArg & path, size_t offset);
 
@@ -73,6 +114,10 @@ namespace YAML
          Asterisk,
          Tilde, 
          Comma,
+         Less,
+         Greater,
+         OpenParen,
+         CloseParen,
       };
       /* when adding a new token, also add to:
             - MapETokenName
@@ -98,14 +143,54 @@ namespace YAML
          Key,
          Index,
          MapFilter,
+         Sort,
       };
 
       // Data for different selector types
       struct ArgNull {};
-      struct ArgKey { PathArg key; };
+      struct ArgKey { PathArg key; uint32_t keyId = 0; };    // keyId: interned key, see ResolveKeyIds
       struct ArgIndex { size_t index; };
-      struct ArgKVPair { KVToken key; KVToken value; EKVOp op = EKVOp::Equal; };
-      using ArgMapFilter = std::vector<ArgKVPair>;
+      struct ArgKVPair { KVToken key; KVToken value; EKVOp op = EKVOp::Equal; uint32_t keyId = 0; };
+      struct ArgSort { PathArg field; bool top = false; size_t count = 0; };   // "!sort(field)", or "!top(count,field)". An empty field sorts by the nodes' values
+
+      /** \internal minimal vector that stores up to \c N elements without allocating. 
+          Supports only what the scanner needs: appending, and random access iteration.
+      */
+      template <typename T, size_t N>
+      class SmallVector
+      {
+      public:
+         using iterator = T *;
+         using const_iterator = T const *;
+
+         void push_back(T const & value)
+         {
+            if (m_size < N)
+               m_inline[m_size] = value;
+            else
+            {
+               if (m_heap.empty())
+                  m_heap.assign(m_inline, m_inline + N);
+               m_heap.push_back(value);
+            }
+            ++m_size;
+         }
+
+         size_t size() const           { return m_size; }
+         bool empty() const            { return m_size == 0; }
+         iterator begin()              { return m_size > N ? m_heap.data() : m_inline; }
+         iterator end()                { return begin() + m_size; }
+         const_iterator begin() const  { return m_size > N ? m_heap.data() : m_inline; }
+         const_iterator end() const    { return begin() + m_size; }
+         T const & operator[](size_t idx) const { return begin()[idx]; }
+
+      private:
+         T              m_inline[N];
+         std::vector<T> m_heap;     // all elements, once there are more than N
+         size_t         m_size = 0;
+      };
+
+      using ArgMapFilter = SmallVector<ArgKVPair, 2>;    // most map filters have a single condition, or select one or two keys
 
       /** \internal progressive scanner/parser for a YAML path as specified by YAML::Select
          This class implements two layers of the scan: 
@@ -123,12 +208,12 @@ namespace YAML
       class PathScanner
       {
       public:
-         using tSelectorData = std::variant<ArgNull, ArgKey, ArgIndex, ArgMapFilter>;  ///< union of the selector data for all selector types
+         using tSelectorData = std::variant<ArgNull, ArgKey, ArgIndex, ArgMapFilter, ArgSort>;  ///< union of the selector data for all selector types
 
       private:
          PathArg    m_rpath;        // remainder of path to be scanned
          PathBoundArgs m_args;      // list of arguments that should be used as tokens
-         size_t     m_argIdx;       // next argument index to fetch
+         size_t     m_argIdx = 0;   // next argument index to fetch
          TokenData  m_curToken;
 
          ESelector      m_selector = ESelector::None;
@@ -139,7 +224,8 @@ namespace YAML
 
          EPathError     m_error = EPathError::OK;
          PathArg       m_fullPath;
-         PathException * m_diags = nullptr;
+         PathErrorInfo * m_diags = nullptr;
+         PathException * m_diagsEx = nullptr;         // receives the full path on error
 
          TokenData const & SetToken(EToken id, PathArg p);
          TokenData const & SetToken(EToken id, size_t index);
@@ -159,6 +245,7 @@ namespace YAML
 
       public:
          PathScanner(PathArg p, PathBoundArgs args = {}, PathException * diags = nullptr);
+         PathScanner(PathArg p, PathBoundArgs args, PathErrorInfo * diags);
 
          explicit operator bool() const { return !m_rpath.empty() && m_error == EPathError::OK; }
 
@@ -181,9 +268,268 @@ namespace YAML
          // for access by utility functions to record an error
          EPathError SetError(EPathError error, uint64_t validTypes = 0);
 
-         inline static const uint64_t ValidTokensAtStart = BitsOf({ EToken::FetchArg, EToken::None, EToken::OpenBracket, EToken::OpenBrace,  EToken::QuotedIdentifier, EToken::UnquotedIdentifier });
+         inline static const uint64_t ValidTokensAtStart = BitsOf({ EToken::FetchArg, EToken::None, EToken::OpenBracket, EToken::OpenBrace,  EToken::QuotedIdentifier, EToken::UnquotedIdentifier, EToken::Exclamation });
       };
 
+      /// \internal a selector retrieved by \ref PathScanner, stored to be applied repeatedly (see \ref ScanSelectors)
+      struct SelectorRecord
+      {
+         ESelector selector = ESelector::None;
+         PathScanner::tSelectorData data;
+      };
+      using SelectorList = std::vector<SelectorRecord>;
+
+      EPathError ScanSelectors(SelectorList & result, PathArg path, PathBoundArgs args = {}, PathErrorInfo * px = nullptr);
+      void CanonicalPath(PathArg path, std::string & result);
+      bool IsSameSelector(SelectorRecord const & a, SelectorRecord const & b);
+
+      /** \internal ids of interned keys, used by \ref FrozenDocument to match keys by comparing integers.
+          A key id of 0 is not resolved, \c NoKeyId is a key that was never interned (and therefore is not a key of any frozen document)
+      */
+      constexpr uint32_t NoKeyId = 0xFFFFFFFF;
+      uint32_t InternKey(PathArg key);
+      uint32_t FindKeyId(PathArg key);
+      void ResolveKeyIds(SelectorList & selectors, bool intern);
+
+      void const * DocumentPool(detail::memory_holder const * holder);
+
+      /// \internal true if nodes with the memory holders \c a and \c b belong to the same document, see \ref DocumentPool
+      inline bool SameDocument(detail::memory_holder const * a, detail::memory_holder const * b) { return a == b || (a && b && DocumentPool(a) == DocumentPool(b)); }
+      void BumpGeneration(Node const & node);   // see QueryCache
+      std::shared_ptr<std::atomic<uint64_t>> AttachGeneration(Node const & root);
+      void DetachGeneration(Node const & root, std::shared_ptr<std::atomic<uint64_t>> & generation);
+      void NotifyMutation(Node const & node, PathArg path, PathBoundArgs args);   // see PathSubscriptions
+      void NotifyOrderedIndexes(Node const & node, PathArg path, PathBoundArgs args, bool modified);   // see OrderedIndex
+      bool SelectByOrderedIndex(Node const & seq, ArgKVPair const & cond, std::vector<Node> & result);
+
+      /// \internal implementation of \ref CompiledPath. The selectors refer to \c path
+      struct CompiledSelectors
+      {
+         std::string  path;
+         SelectorList selectors;
+
+         mutable std::once_flag frozenResolved;    // the keys are interned when the path is first evaluated on a FrozenDocument
+         mutable SelectorList   frozenSelectors;   // selectors with key ids, see FrozenSelectors
+      };
+
+      SelectorList const & FrozenSelectors(CompiledSelectors const & compiled);
+
+      /** \internal nodes matched by the evaluator: a single node, or a list of nodes after a selector fanned out over a sequence.
+
+         The evaluator only reads from the document: the list refers to nodes of the document, instead of
+         a sequence node being built (which would merge the document's memory into the new sequence, see \ref Materialize).
+      */
+      struct EvalNodes
+      {
+         Node              node;             // the matched node, if !isList
+         std::vector<Node> list;             // the matched nodes, if isList
+         bool              isList = false;
+      };
+
+      /// \internal statistics collected during evaluation, see \ref EvalContext::stats
+      struct EvalStats
+      {
+         size_t nodesVisited = 0;
+         size_t mapsScanned = 0;
+      };
+
+      /// \internal the limit of \ref PathLimits that stopped an evaluation, recorded in \ref PathErrorInfo::errorType
+      enum class ELimit
+      {
+         None,
+         NodesVisited,
+         ResultNodes,
+         Bytes,
+         Deadline,
+      };
+
+      /** \internal checks \ref PathLimits during one evaluation, see \ref EvalContext::limits.
+          Once a limit is exceeded, all further checks fail, so that a selector that ignores a failure of a single item stops at the next.
+      */
+      class LimitState
+      {
+      public:
+         explicit LimitState(PathLimits const & limits) : m_limits(limits) {}
+
+         /// counts a visited node. The clock is read only every few nodes
+         bool Visit()
+         {
+            if (m_exceeded != ELimit::None)
+               return false;
+            if (++m_nodesVisited > m_limits.maxNodesVisited)
+               return Exceed(ELimit::NodesVisited);
+            if (m_nodesVisited % DeadlineCheckInterval == 1 && m_limits.deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= m_limits.deadline)
+               return Exceed(ELimit::Deadline);
+            return true;
+         }
+
+         /// checks the number of nodes a selector matched so far
+         bool Matched(size_t count)
+         {
+            if (m_exceeded != ELimit::None)
+               return false;
+            if (count > m_limits.maxResultNodes)
+               return Exceed(ELimit::ResultNodes);
+            if (count * sizeof(Node) + m_createdBytes > m_limits.maxBytes)
+               return Exceed(ELimit::Bytes);
+            return true;
+         }
+
+         /// adds the estimated size of nodes created by the evaluation
+         bool Created(size_t bytes)
+         {
+            m_createdBytes += bytes;
+            return Matched(0);
+         }
+
+         size_t RemainingBytes() const { return m_limits.maxBytes > m_createdBytes ? m_limits.maxBytes - m_createdBytes : 0; }
+         ELimit Exceeded() const { return m_exceeded; }
+
+      private:
+         static constexpr size_t DeadlineCheckInterval = 64;
+
+         PathLimits const &   m_limits;
+         size_t               m_nodesVisited = 0;
+         size_t               m_createdBytes = 0;
+         ELimit               m_exceeded = ELimit::None;
+
+         bool Exceed(ELimit limit) { m_exceeded = limit; return false; }
+      };
+
+      /** \internal indexes of the maps of an \ref IndexedDocument, built on first use. See \ref EvalContext::indexes
+
+         Folded keys: the pairs of a map sorted by the hash of their key folded to lower case (ASCII only, like \c _strnicmp),
+         so that a case-insensitive key (<code>^key</code>) is found by binary search instead of comparing every key.
+
+         Sorted keys: the pairs of a map sorted by key, so that the keys starting with a prefix (<code>key*</code>) are a range.
+
+         Key signatures: a 64 bit Bloom filter of the keys of each map, built in one pass over the document,
+         so that a map that does not contain a key is rejected without comparing its keys (see \ref FindKey).
+      */
+      class MapIndexes
+      {
+      public:
+         using Pair = std::pair<detail::node const *, detail::node const *>;
+
+         explicit MapIndexes(IndexOptions const & options) : m_options(options) {}
+
+         std::vector<Pair> const * FindKeys(detail::node const & map, KVToken const & key);
+         bool MayContainKey(detail::node const & map, PathArg key) const;
+         bool HasSignatures() const { return !m_signatures.empty(); }
+         void Prepare(detail::node const & root);
+         void Clear();
+         size_t IndexedMaps() const;
+         size_t MemoryUsage() const;
+
+      private:
+         struct FoldedKey
+         {
+            uint64_t hash;
+            uint32_t order;      // position in the map, to keep matches in document order
+            Pair     pair;
+            bool operator<(FoldedKey const & other) const { return hash < other.hash || (hash == other.hash && order < other.order); }
+         };
+
+         struct SortedKey
+         {
+            PathArg  key;        // view of the key scalar
+            uint32_t order;
+            Pair     pair;
+            bool operator<(SortedKey const & other) const { return key < other.key || (key == other.key && order < other.order); }
+         };
+
+         IndexOptions   m_options;
+         std::unordered_map<detail::node const *, std::vector<FoldedKey>> m_folded;    // empty: map is too small to index
+         std::unordered_map<detail::node const *, std::vector<SortedKey>> m_sorted;
+         std::vector<Pair> m_candidates;     // result of FindKeys
+         std::vector<SortedKey const *> m_range;
+         std::vector<std::pair<detail::node const *, uint64_t>> m_signatures;    // open addressing by map, size is a power of 2
+         bool m_signed = false;              // m_signatures was built (it is empty if the document has no maps to sign)
+
+         std::vector<FoldedKey> const & Folded(detail::node const & map);
+         std::vector<SortedKey> const & Sorted(detail::node const & map);
+         void BuildSignatures(detail::node const & root);
+         size_t SignatureSlot(detail::node const * map) const;
+      };
+
+      /// \internal state shared by the selectors of one evaluation
+      struct EvalContext
+      {
+         bool              readOnly = false; // don't modify the document in any way. Maps created by selecting keys with a map filter contain copies
+         std::vector<Node> scratch;          // reused to collect fan-out results
+
+         PathExplainReport * explain = nullptr;    // PathExplain: receives a step for each selector
+         EvalStats *         stats = nullptr;      // if set, receives statistics (for PathExplain and metrics)
+         LimitState *        limits = nullptr;     // if set, evaluation stops with EPathError::LimitExceeded when a limit is reached
+         MapIndexes *        indexes = nullptr;    // if set, map filters look up keys in these indexes (see IndexedDocument)
+      };
+
+#if YAML_PATH_METRICS
+      void RecordPathMetrics(EPathOp op, PathArg path, EPathError error, uint64_t nanoseconds, size_t nodesVisited, size_t resultNodes);
+
+      /** \internal records the metrics of one evaluation when it goes out of scope, see \ref GetPathMetrics.
+          If \c Result isn't called (i.e. an exception was thrown), the evaluation is counted as \c EPathError::Internal.
+      */
+      class MetricsScope
+      {
+      public:
+         MetricsScope(EPathOp op, PathArg path, EvalContext * ctx = nullptr) : m_op(op), m_path(path), m_start(std::chrono::steady_clock::now())
+         {
+            if (ctx && !ctx->stats)
+            {
+               ctx->stats = &m_stats;
+               m_ctx = ctx;
+            }
+         }
+
+         ~MetricsScope()
+         {
+            if (m_ctx)
+               m_ctx->stats = nullptr;     // the context may be reused
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+            try { RecordPathMetrics(m_op, m_path, m_error, uint64_t(ns), m_stats.nodesVisited, m_resultNodes); }
+            catch (...) {}
+         }
+
+         void Result(EPathError error, size_t resultNodes = 0) { m_error = error; m_resultNodes = resultNodes; }
+         void Result(EPathError error, EvalNodes const & nodes) { Result(error, error != EPathError::OK ? 0 : nodes.isList ? nodes.list.size() : nodes.node ? 1 : 0); }
+
+      private:
+         EPathOp     m_op;
+         PathArg     m_path;
+         EvalContext * m_ctx = nullptr;
+         std::chrono::steady_clock::time_point m_start;
+         EvalStats   m_stats;
+         EPathError  m_error = EPathError::Internal;
+         size_t      m_resultNodes = 0;
+      };
+#else
+      struct MetricsScope
+      {
+         MetricsScope(EPathOp, PathArg, EvalContext * = nullptr) {}
+         void Result(EPathError, size_t = 0) {}
+         void Result(EPathError, EvalNodes const &) {}
+      };
+#endif
+
+      EPathError ApplySelector(EvalNodes & nodes, ESelector selector, PathScanner::tSelectorData const & data, EvalContext & ctx);
+      EPathError EvalPath(EvalNodes & nodes, PathArg & path, PathBoundArgs args, PathErrorInfo * px, EvalContext & ctx);
+      EPathError EvalSelectors(EvalNodes & nodes, SelectorList const & selectors, EvalContext & ctx);
+      EPathError ApplyMapFilterToMap(Node const & node, ArgMapFilter const & arg, Node & result, EvalContext & ctx);
+      std::vector<Node> SelectNodes(Node const & node, CompiledPath const & path, EvalContext & ctx);
+      size_t PathAllocationCount();
+      Node Materialize(EvalNodes const & nodes);
+      size_t HashNode(detail::node const & n);
+      bool IsEqualNode(detail::node const & a, detail::node const & b);
+      void RemoveDuplicates(std::vector<Node> & nodes);
+      bool FindKey(Node const & map, PathArg key, Node & value);
+      detail::node const * FindKey(detail::node const & map, PathArg key);
+      detail::node const * FindKey(detail::node const & map, PathArg key, EvalContext const & ctx);
+      bool StrIsMatch(KVToken const & tok, PathArg scalar);
+      bool RangeIsMatch(EKVOp op, PathArg token, PathArg scalar);
+      bool ParseNumber(std::string_view s, double & value);
+      inline bool IsRangeOp(EKVOp op) { return op >= EKVOp::Less; }
+
       template <typename T2, typename TEnum>
       T2 MapValue(TEnum value, std::initializer_list<std::pair<TEnum, T2>> values, T2 dflt = T2());
 
@@ -191,6 +537,7 @@ namespace YAML
       extern std::initializer_list<std::pair<NodeType::value, char const *>> MapNodeTypeName;
       extern std::initializer_list<std::pair<ESelector, char const *>> MapESelectorName;
       extern std::initializer_list<std::pair<EPathError, char const *>> MapEPathErrorName;
+      extern std::initializer_list<std::pair<ELimit, char const *>> MapELimitName;
    }
 }
 
@@ -235,5 +582,50 @@ namespace YAML
       }
 
 
+
+      /// \internal implements \ref Ensure, \ref EnsureExists and \ref EnsureBatch
+      class EnsureState
+      {
+      public:
+         explicit EnsureState(bool batch) : m_batch(batch) {}
+         void Apply(Node & root, PathArg path, PathBoundArgs args, std::vector<Node> * result);
+
+      private:
+         using KeyIndex = std::unordered_map<PathArg, Node>;    // views into the key scalars of the map
+
+         struct Prefix
+         {
+            size_t offset = 0;         // path offset after the selector
+            std::vector<Node> nodes;   // working set after the selector
+         };
+
+         /// elements of a sequence by the value of one key, for upserts (see \ref UpsertElement)
+         struct ElementIndex
+         {
+            std::unordered_map<PathArg, Node> byValue;   // views into the value scalars of the elements
+            std::vector<size_t> unkeyed;                 // positions of elements without a scalar value for the key
+            size_t indexed = 0;                          // elements of the sequence indexed
+         };
+
+         bool                 m_batch;
+         bool                 m_modified = false;  // the current path added or assigned nodes
+         std::vector<Node>    m_next, m_result, m_assignTo, m_upserted;    // scratch buffers
+
+         // batch only:
+         std::unordered_map<detail::node const *, KeyIndex> m_keys;
+         std::map<std::pair<detail::node const *, std::string>, ElementIndex> m_elements;   // by sequence and key
+         std::string          m_prevPath;
+         std::vector<Prefix>  m_prefixes;
+
+         void ApplyPath(Node & root, PathArg path, PathBoundArgs args, std::vector<Node> * result);
+         Node ApplyKeyToMapOrNothing(Node & start, PathArg key);
+         KeyIndex & IndexKeys(Node const & map);
+         bool FindElement(Node const & seq, ArgKVPair const & cond, Node & element);
+         Node UpsertElement(Node & seq, ArgKVPair const & cond);
+         void ApplyKey(std::vector<Node> & result, Node & start, PathArg key, bool recurse);
+         void ApplyKey(std::vector<Node> & result, std::vector<Node> & start, PathArg key);
+         size_t ResumePrefix(PathArg path);
+         void AddPrefix(size_t offset);
+      };
    }
 }
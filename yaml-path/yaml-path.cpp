@@ -24,59 +24,40 @@ SOFTWARE.
 
 #include "yaml-path.h"
 #include "yaml-path-internals.h"
+#include "yaml-explain.h"
 #include <yaml-cpp/yaml.h>
 #include <assert.h>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <cmath>
 
 /// namspace shared by yaml-cpp and yaml-path
 namespace YAML
 {
 
+   /** Selects the value for \c key from a map, or the values for \c key from all maps in a sequence. 
+       See \ref Select for details. If no node can be matched, \c node remains unchanged.
+   */
    EPathError SelectByKey(Node & node, PathArg key)
    {
-      // possible optimizations: reserve for a node sequence, node[string_view] without copy-to-string
-      if (node.IsMap())
-      {
-         Node result = node[std::string(key)];
-         if (!result)
-            return EPathError::NodeNotFound;
-
-         node.reset(result);
-         return EPathError::OK;
-      }
-      else if (node.IsSequence())
-      {
-         Node result;
-         for (auto && el : node)
-         {
-            Node val = el[std::string(key)];
-            if (val)
-               result.push_back(val);
-         }
-         if (!result.IsSequence())    // first call to push-back turns this into a sequence
-            return EPathError::NodeNotFound;
-         node.reset(result);
-         return EPathError::OK;
-      }
-      return EPathError::InvalidNodeType;
+      YamlPathDetail::EvalContext ctx;
+      YamlPathDetail::EvalNodes nodes{ node };
+      auto err = YamlPathDetail::ApplySelector(nodes, YamlPathDetail::ESelector::Key, YamlPathDetail::ArgKey{ key }, ctx);
+      if (err == EPathError::OK)
+         node.reset(YamlPathDetail::Materialize(nodes));
+      return err;
    }
 
+   /** Selects the element at \c index from a sequence. See \ref Select for details. If no node can be matched, \c node remains unchanged. */
    EPathError SelectByIndex(Node & node, size_t index)
    {
-      if (node.IsScalar() || node.IsMap())
-      {
-         if (index != 0)
-            return EPathError::NodeNotFound;
-         return EPathError::OK;     // for scalar node and map, [0] remains at the same node
-      }
-      if (node.IsSequence())
-      {
-         if (index >= node.size())
-            return EPathError::NodeNotFound;
-
-         node.reset(node[index]);
-         return EPathError::OK;
-      }
-      return EPathError::InvalidNodeType;
+      YamlPathDetail::EvalContext ctx;
+      YamlPathDetail::EvalNodes nodes{ node };
+      auto err = YamlPathDetail::ApplySelector(nodes, YamlPathDetail::ESelector::Index, YamlPathDetail::ArgIndex{ index }, ctx);
+      if (err == EPathError::OK)
+         node.reset(YamlPathDetail::Materialize(nodes));
+      return err;
    }
 
 
@@ -122,6 +103,10 @@ namespace YAML
          { EToken::Asterisk, "asterisk" },
          { EToken::Tilde, "tilde" },
          { EToken::Comma, "comma" },
+         { EToken::Less, "less than" },
+         { EToken::Greater, "greater than" },
+         { EToken::OpenParen, "open parenthesis" },
+         { EToken::CloseParen, "close parenthesis" },
       };
 
       /// \internal name mapping for yaml-cpp node type
@@ -140,6 +125,7 @@ namespace YAML
          { ESelector::Index,  "index" },
          { ESelector::Key,    "key" },
          { ESelector::MapFilter, "map filter" },
+         { ESelector::Sort, "sort" },
          { ESelector::None, "(none)" },
          { ESelector::Invalid, "(invalid)" },
       };
@@ -155,15 +141,26 @@ namespace YAML
          { EPathError::NodeNotFound,      "no node matches selector" },
          { EPathError::UnexpectedEnd,     "unexpected end of path" },
          { EPathError::SelectorNotSupported, "selector not supported by this operation" },
+         { EPathError::LimitExceeded,     "evaluation limit exceeded" },
+      };
+
+      /// \internal name mapping for ELimit
+      std::initializer_list<std::pair<ELimit, char const *>> MapELimitName =
+      {
+         { ELimit::None,         "(none)" },
+         { ELimit::NodesVisited, "nodes visited" },
+         { ELimit::ResultNodes,  "result nodes" },
+         { ELimit::Bytes,        "bytes" },
+         { ELimit::Deadline,     "deadline" },
       };
 
       // ----- Utility functions
 
-      /// C\internal reates an undefined YAML node (<code>(bool)UndefinedNode() == false</code>)
+      /// \internal creates an undefined YAML node (<code>(bool)UndefinedNode() == false</code>)
       Node UndefinedNode()
       {
-         static auto undefinedNode = Node()["x"];
-         return undefinedNode;
+         // a new node for each call: a shared instance would be modified by assigning to any node returned from here
+         return Node(NodeType::Undefined);
       }
 
       /// \internal result = target; target = newValue
@@ -199,7 +196,7 @@ namespace YAML
          m_curToken = { id, std::move(p) };
 
          if (id != EToken::Invalid && m_diags)
-            m_diags->m_offsTokenScan = ScanOffset();
+            m_diags->errorOffset = ScanOffset();
 
          /* skipping whitespace after token, so that if this was the last token,
             we get to the end of the string and operator bool becomes false */
@@ -213,7 +210,7 @@ namespace YAML
          m_curToken = { id, {}, index };
 
          if (id != EToken::Invalid && m_diags)
-            m_diags->m_offsTokenScan = ScanOffset();
+            m_diags->errorOffset = ScanOffset();
 
          SkipWS();
          return m_curToken;
@@ -226,10 +223,17 @@ namespace YAML
          Split(m_rpath, [](char c) { return isascii(c) && isspace(c); });
       }
 
-      inline PathScanner::PathScanner(PathArg p, PathBoundArgs args, PathException * diags) : m_rpath(p), m_args(args), m_diags(diags), m_fullPath(p)
+      inline PathScanner::PathScanner(PathArg p, PathBoundArgs args, PathException * diags) : PathScanner(p, args, diags ? &diags->m_info : nullptr)
+      {
+         m_diagsEx = diags;
+         if (m_diagsEx)
+            *m_diagsEx = PathException();
+      }
+
+      PathScanner::PathScanner(PathArg p, PathBoundArgs args, PathErrorInfo * diags) : m_rpath(p), m_args(args), m_diags(diags), m_fullPath(p)
       {
          if (m_diags)
-            *m_diags = PathException();
+            *m_diags = PathErrorInfo();
          SkipWS();
       }
 
@@ -258,6 +262,10 @@ namespace YAML
             { '*', EToken::Asterisk },
             { '~', EToken::Tilde },
             { ',', EToken::Comma },
+            { '<', EToken::Less },
+            { '>', EToken::Greater },
+            { '(', EToken::OpenParen },
+            { ')', EToken::CloseParen },
             }, EToken::None);
 
          if (t != EToken::None)
@@ -291,16 +299,16 @@ namespace YAML
          m_error = error;
          if (m_diags)
          {
-            m_diags->m_fullPath = m_fullPath;
-            m_diags->m_error = error;
-            m_diags->m_validTypes = validTypes;
+            m_diags->error = error;
+            m_diags->validTypes = validTypes;
 
             if (PathException::IsPathError(error))
-               m_diags->m_errorType = (decltype(m_diags->m_errorType))m_curToken.id;
+               m_diags->errorType = (decltype(m_diags->errorType))m_curToken.id;
             else if (PathException::IsNodeError(error))
-               m_diags->m_errorType = (decltype(m_diags->m_errorType))m_selector;
-
+               m_diags->errorType = (decltype(m_diags->errorType))m_selector;
          }
+         if (m_diagsEx)
+            m_diagsEx->m_fullPath = m_fullPath;
          m_curToken = { EToken::Invalid };
          SetSelector(ESelector::Invalid, ArgNull{});
          return error;
@@ -362,9 +370,12 @@ namespace YAML
          // Fetch argument from argument list if required
          if (m_curToken.id == EToken::FetchArg)
          {
+            if (m_argIdx >= m_args.size())
+               return SetError(EPathError::InvalidToken, validTokens), false;    // more '%' than bound arguments
+
             auto & v = m_args.begin()[m_argIdx];
             if (m_diags)
-               m_diags->m_fromBoundArg = m_argIdx;
+               m_diags->boundArg = m_argIdx;
             ++m_argIdx;
 
             switch (v.index())
@@ -449,7 +460,7 @@ namespace YAML
             return ESelector::Invalid;
 
          if (m_diags)
-            m_diags->m_offsSelectorScan = ScanOffset();
+            m_diags->resolvedLength = ScanOffset();
 
          // skip period if allowed at this point
          if (m_periodAllowed)
@@ -500,14 +511,15 @@ namespace YAML
 
             case EToken::OpenBrace:
             {
-               ArgMapFilter arg; /// \todo optimization: a std::vector replacement with a small buffer optimization of length 1 would be pretty useful here
+               ArgMapFilter arg;
                while (true)
                {
                   ArgKVPair kvp;
-                  if (!ReadKVToken(kvp.key, BitsOf({ EToken::Tilde, EToken::Equal, EToken::Comma, EToken::CloseBrace })))
+                  const uint64_t opTokens = BitsOf({ EToken::Tilde, EToken::Equal, EToken::Less, EToken::Greater, EToken::Comma, EToken::CloseBrace });
+                  if (!ReadKVToken(kvp.key, opTokens))
                      return ESelector::Invalid;
 
-                  if (!NextSelectorToken(BitsOf({ EToken::Tilde, EToken::Equal, EToken::Comma, EToken::CloseBrace})))
+                  if (!NextSelectorToken(opTokens))
                      return ESelector::Invalid;
 
 
@@ -524,6 +536,17 @@ namespace YAML
                         kvp.op = EKVOp::Equal;
                         break;
 
+                     case EToken::Less:
+                     case EToken::Greater:
+                     {
+                        const bool less = m_curToken.id == EToken::Less;
+                        if (PeekSelectorToken(BitsOf({ EToken::Equal })))
+                           kvp.op = less ? EKVOp::LessEqual : EKVOp::GreaterEqual;
+                        else
+                           kvp.op = less ? EKVOp::Less : EKVOp::Greater;
+                        break;
+                     }
+
                      case EToken::Comma:
                         kvp.op = EKVOp::Select;
                         arg.push_back(kvp);
@@ -542,14 +565,18 @@ namespace YAML
                   {
                      m_tokenPending = true;
                      if (kvp.op == EKVOp::Equal) kvp.op = EKVOp::Exists;
-                     else if (kvp.op == EKVOp::NotEqual)
-                        return SetError(EPathError::InvalidToken), ESelector::Invalid;    // not equal must have value
+                     else if (kvp.op == EKVOp::NotEqual || IsRangeOp(kvp.op))
+                        return SetError(EPathError::InvalidToken), ESelector::Invalid;    // not equal and comparisons must have value
                      else 
                         return SetError(EPathError::Internal), ESelector::Invalid;
                   }
                   else
+                  {
                      if (!ReadKVToken(kvp.value, BitsOf({ EToken::Comma, EToken::CloseBrace })))
                         return ESelector::Invalid;
+                     if (IsRangeOp(kvp.op) && (kvp.value.starry || kvp.value.noCase))
+                        return SetError(EPathError::InvalidToken), ESelector::Invalid;    // comparisons take a plain value
+                  }
 
                   if (!NextSelectorToken(BitsOf({ EToken::Comma, EToken::CloseBrace })))
                      return ESelector::Invalid;
@@ -567,6 +594,46 @@ namespace YAML
                m_periodAllowed = true;
                return SetSelector(ESelector::MapFilter, std::move(arg));
             }
+
+            case EToken::Exclamation:
+            {
+               // stages: "!sort(field)", "!top(count,field)"
+               if (!NextSelectorToken(BitsOf({ EToken::UnquotedIdentifier })))
+                  return ESelector::Invalid;
+
+               ArgSort arg;
+               if (m_curToken.value == "top")
+                  arg.top = true;
+               else if (m_curToken.value != "sort")
+                  return SetError(EPathError::SelectorNotSupported), ESelector::Invalid;
+
+               if (!NextSelectorToken(BitsOf({ EToken::OpenParen })))
+                  return ESelector::Invalid;
+
+               bool fieldRequired = false;      // after the comma of "!top(count,"
+               if (arg.top)
+               {
+                  if (!NextSelectorToken(BitsOf({ EToken::Index }), EPathError::InvalidIndex))
+                     return ESelector::Invalid;
+                  arg.count = m_curToken.index;
+                  if (!NextSelectorToken(BitsOf({ EToken::Comma, EToken::CloseParen })))
+                     return ESelector::Invalid;
+                  fieldRequired = m_curToken.id == EToken::Comma;
+                  m_tokenPending = !fieldRequired;
+               }
+
+               if (fieldRequired || !PeekSelectorToken(BitsOf({ EToken::CloseParen })))
+               {
+                  if (!NextSelectorToken(BitsOf({ EToken::QuotedIdentifier, EToken::UnquotedIdentifier })))
+                     return ESelector::Invalid;
+                  arg.field = m_curToken.value;
+                  if (!NextSelectorToken(BitsOf({ EToken::CloseParen })))
+                     return ESelector::Invalid;
+               }
+
+               m_periodAllowed = true;
+               return SetSelector(ESelector::Sort, arg);
+            }
          }
          return ESelector::Invalid;
       }
@@ -578,12 +645,14 @@ namespace YAML
    /** determines and caches one small part of the diagnostic message on demand */
    std::string PathException::ErrorItem() const
    {
-      if (!m_errorItem.length() && m_errorType)
+      if (!m_errorItem.length() && m_info.errorType)
       {
          if (IsNodeError())
-            m_errorItem = MapValue((ESelector)m_errorType, MapESelectorName, "");
+            m_errorItem = MapValue((ESelector)m_info.errorType, MapESelectorName, "");
          else if (IsPathError())
-            m_errorItem = MapValue((EToken)m_errorType, MapETokenName, "");
+            m_errorItem = MapValue((EToken)m_info.errorType, MapETokenName, "");
+         else if (IsLimitError())
+            m_errorItem = MapValue((ELimit)m_info.errorType, MapELimitName, "");
       }
       return m_errorItem;
    }
@@ -595,9 +664,9 @@ namespace YAML
    std::string const & PathException::What(bool detailed) const
    {
       if (!m_short.length())
-         m_short = GetErrorMessage(m_error);
+         m_short = GetErrorMessage(Error());
 
-      if (!detailed || m_error == EPathError::OK)
+      if (!detailed || Error() == EPathError::OK)
          return m_short;
 
       if (m_detailed.length())
@@ -606,25 +675,30 @@ namespace YAML
       std::stringstream str;
       str << m_short << "\n";
 
-      str << "  error at path offset: " << m_offsTokenScan << "\n";
+      str << "  error at path offset: " << m_info.errorOffset << "\n";
 
-      if (m_fromBoundArg)
-         str << "  token taken from bound arg #" << *m_fromBoundArg << "\n";
+      if (m_info.boundArg)
+         str << "  token taken from bound arg #" << *m_info.boundArg << "\n";
 
       if (IsPathError())
       {
-         if (m_validTypes)
-            str << "  allowed tokens: " << MapBitMask(m_validTypes, MapETokenName) << "\n";
-         if (m_errorType)
+         if (m_info.validTypes)
+            str << "  allowed tokens: " << MapBitMask(m_info.validTypes, MapETokenName) << "\n";
+         if (m_info.errorType)
             str << "  token found: " << ErrorItem() << "\n";
       }
       else if (IsNodeError())
       {
-         if (m_validTypes)
-            str << "  supported node type: " << MapBitMask(m_validTypes, MapNodeTypeName) << "\n";
-         if (m_errorType)
+         if (m_info.validTypes)
+            str << "  supported node type: " << MapBitMask(m_info.validTypes, MapNodeTypeName) << "\n";
+         if (m_info.errorType)
             str << "  for selector: " << ErrorItem() << "\n";
       }
+      else if (IsLimitError())
+      {
+         if (m_info.errorType)
+            str << "  limit: " << ErrorItem() << "\n";
+      }
 
       if (m_fullPath.length())
          str << "  path to parse: " << m_fullPath << "\n";
@@ -644,34 +718,74 @@ namespace YAML
    /** validates the syntax of a YAML path. returns an error for invalid path, or EPathError::None, if the path is valid */
    EPathError PathValidate(PathArg p, std::string * valid, size_t * errorOffs)
    {
-      PathException x;
-      PathScanner scan(p, {}, &x);
+      PathErrorInfo info;
+      PathScanner scan(p, {}, &info);
       while (scan)
          scan.NextSelector();
 
-      if (valid)
-         *valid = x.ResolvedPath();
+      if (valid)     // like PathException::ResolvedPath, which is empty if no error occurred
+         *valid = scan.Error() == EPathError::OK ? std::string() : std::string(p.substr(0, info.resolvedLength));
 
       if (errorOffs)
-         *errorOffs = x.ErrorOffset();
+         *errorOffs = info.errorOffset;
       return scan.Error(); 
    }
 
 
    namespace YamlPathDetail
    {
-      bool StrIsMatch(KVToken const & tok, Node const & node)
+      /** \internal finds the value for \c key in the map \c map. Returns \c nullptr if the key does not exist.
+
+         Unlike the non-const <code>Node::operator[]</code>, this does not add an (undefined) key-value pair to the map
+         if the key does not exist, and does not copy the key or the node's scalars.
+      */
+      detail::node const * FindKey(detail::node const & map, PathArg key)
+      {
+         if (map.type() != NodeType::Map)
+            return nullptr;
+
+         for (auto && kv : map)
+            if (kv.first->type() == NodeType::Scalar && kv.first->scalar() == key)
+               return kv.second;
+         return nullptr;
+      }
+
+      /// \internal \ref FindKey that first checks the key signature of \c map, if \c ctx has indexes with key signatures (see \ref IndexedDocument)
+      detail::node const * FindKey(detail::node const & map, PathArg key, EvalContext const & ctx)
+      {
+         if (ctx.indexes && ctx.indexes->HasSignatures() && !ctx.indexes->MayContainKey(map, key))
+            return nullptr;
+         return FindKey(map, key);
+      }
+
+      /// \internal \ref FindKey for a \c Node. \c value receives the value found.
+      bool FindKey(Node const & map, PathArg key, Node & value)
+      {
+         auto impl = NodeAccess::Impl(map);
+         auto found = impl ? FindKey(*impl, key) : nullptr;
+         if (!found)
+            return false;
+
+         value.reset(NodeAccess::Make(*found, map));
+         return true;
+      }
+
+      bool StrIsMatch(KVToken const & tok, detail::node const & node)
       {
-         if (!node.IsScalar())
+         if (node.type() != NodeType::Scalar)
             return false;
 
+         return StrIsMatch(tok, node.scalar());
+      }
+
+      /// \internal matches the scalar \c snode against a string token of a map filter
+      bool StrIsMatch(KVToken const & tok, PathArg snode)
+      {
          if (tok.IsAllStar())
             return true;
 
-         std::string snode = node.as<std::string>();
-
          // length checks that allow to skip comparisons
-         // Unicode: the length checks would be applicable only on case sensitive comparison after normalization. 
+         // Unicode: the length checks would be applicable only on case sensitive comparison after normalization.
          if (!tok.starry && snode.length() != tok.token.length())    // non-starry equality requires identical length
             return false;
 
@@ -681,21 +795,58 @@ namespace YAML
 
          // Unicode: some assumptions here don't hold. It's strcoll, stricoll, and I'm not sure how to implement no-case starry matches
          size_t cmpLen = std::min(tok.token.length(), snode.length());
-         int result = tok.noCase ? _strnicmp(&tok.token[0], snode.c_str(), cmpLen) : strncmp(&tok.token[0], snode.c_str(), cmpLen);
+         int result = tok.noCase ? _strnicmp(tok.token.data(), snode.data(), cmpLen) : strncmp(tok.token.data(), snode.data(), cmpLen);
 
          return result == 0; // under assumption of above length-based shortcuts
       }
 
-      bool KeyIsMatch(ArgKVPair const & arg, Node const & key)
+      /** \internal matches the scalar \c snode against the value of a comparison (e.g. <code>{load>0.8}</code>, with \c op \c EKVOp::Greater).
+          If \c token is a number, only scalars that are numbers match, and are compared as numbers.
+          Otherwise, only scalars that are not numbers match, and are compared as strings (byte by byte), which orders ISO 8601 timestamps by time.
+          NaN does not match any comparison.
+      */
+      bool RangeIsMatch(EKVOp op, PathArg token, PathArg snode)
+      {
+         double tokenValue = 0, nodeValue = 0;
+         int cmp = 0;
+         if (ParseNumber(token, tokenValue))
+         {
+            if (!ParseNumber(snode, nodeValue) || tokenValue != tokenValue || nodeValue != nodeValue)
+               return false;
+            cmp = nodeValue < tokenValue ? -1 : nodeValue > tokenValue;
+         }
+         else
+         {
+            if (ParseNumber(snode, nodeValue))
+               return false;
+            cmp = snode.compare(token);
+         }
+
+         switch (op)
+         {
+            case EKVOp::Less:          return cmp < 0;
+            case EKVOp::LessEqual:     return cmp <= 0;
+            case EKVOp::Greater:       return cmp > 0;
+            case EKVOp::GreaterEqual:  return cmp >= 0;
+            default:
+               assert(false);
+               return false;
+         }
+      }
+
+      bool KeyIsMatch(ArgKVPair const & arg, detail::node const & key)
       {
          return StrIsMatch(arg.key, key);
       }
 
-      bool ValueIsMatch(ArgKVPair const & arg, Node const & value)
+      bool ValueIsMatch(ArgKVPair const & arg, detail::node const & value)
       {
          if (arg.op == EKVOp::Exists)
             return true;      // any value, including non-scalars and null, is a match
 
+         if (IsRangeOp(arg.op))
+            return value.type() == NodeType::Scalar && RangeIsMatch(arg.op, arg.value.token, value.scalar());
+
          bool eq = StrIsMatch(arg.value, value);
          if (arg.op == EKVOp::Equal)
             return eq;
@@ -707,8 +858,110 @@ namespace YAML
          return false;
       }
 
-      EPathError ApplyMapFilterToMap(Node & node, ArgMapFilter const & arg)
+      /** \internal estimated memory of a copy of \c node, for \ref PathLimits::maxBytes.
+          Stops counting when \c limit is exceeded, so that the estimate does not take longer than copying would.
+      */
+      size_t EstimateBytes(detail::node const & node, size_t limit)
+      {
+         size_t bytes = sizeof(detail::node) + sizeof(detail::node_ref) + sizeof(detail::node_data);
+         if (node.type() == NodeType::Scalar)
+            bytes += node.scalar().size();
+         else if (node.type() == NodeType::Sequence)
+         {
+            for (auto it = node.begin(); it != node.end() && bytes <= limit; ++it)
+               bytes += EstimateBytes(**it, limit - bytes);
+         }
+         else if (node.type() == NodeType::Map)
+         {
+            for (auto it = node.begin(); it != node.end() && bytes <= limit; ++it)
+            {
+               bytes += EstimateBytes(*it->first, limit - bytes);
+               if (bytes <= limit)
+                  bytes += EstimateBytes(*it->second, limit - bytes);
+            }
+         }
+         return bytes;
+      }
+
+      /** \internal adds a key-value pair of \c map to a map created by a map filter. In a read-only evaluation, copies are added.
+          \c distinct: the key is known not to be in \c result yet, and is appended without lookup.
+          Returns false if the copies would exceed \ref PathLimits::maxBytes.
+      */
+      bool AddSelectedPair(Node & result, Node const & map, detail::node const & key, detail::node const & value, EvalContext const & ctx, bool distinct)
+      {
+         Node k = NodeAccess::Make(key, map);
+         Node v = NodeAccess::Make(value, map);
+         if (!ctx.readOnly)
+         {
+            if (!result.IsMap())
+               result.reset(NodeAccess::Create(map, NodeType::Map));
+            if (distinct)
+               result.force_insert(k, v);
+            else
+               result[k] = v;
+            return true;
+         }
+
+         if (ctx.limits)
+         {
+            size_t remaining = ctx.limits->RemainingBytes();
+            size_t bytes = EstimateBytes(key, remaining);
+            if (bytes <= remaining)
+               bytes += EstimateBytes(value, remaining - bytes);
+            if (!ctx.limits->Created(bytes))
+               return false;
+         }
+
+         if (k.IsScalar() && !distinct)
+            result[k.Scalar()] = Clone(v);
+         else
+            result.force_insert(Clone(k), Clone(v));
+         return true;
+      }
+
+      /** \internal calls \c f(key, value) for the pairs of \c map whose key matches the starry or case-insensitive key of \c arg,
+          until \c f returns false. With \c ctx.indexes, only the candidates found in an index of the map are compared.
+          Returns false if stopped by \c ctx.limits.
+      */
+      template <typename TFunc>
+      bool ScanKeys(detail::node const & map, ArgKVPair const & arg, EvalContext & ctx, TFunc f)
+      {
+         if (ctx.indexes)
+         {
+            if (auto pairs = ctx.indexes->FindKeys(map, arg.key))
+            {
+               for (auto & [key, value] : *pairs)
+               {
+                  if (ctx.limits && !ctx.limits->Visit())
+                     return false;
+                  if (KeyIsMatch(arg, *key) && !f(*key, *value))
+                     break;
+               }
+               return true;
+            }
+         }
+
+         if (ctx.stats)
+            ++ctx.stats->mapsScanned;
+         for (auto && kv : map)
+         {
+            if (ctx.limits && !ctx.limits->Visit())
+               return false;
+            if (KeyIsMatch(arg, *kv.first) && !f(*kv.first, *kv.second))
+               break;
+         }
+         return true;
+      }
+
+      /** \internal applies a map filter to a single map.
+          \c result receives either \c node, or a new map that contains the selected keys.
+      */
+      EPathError ApplyMapFilterToMap(Node const & node, ArgMapFilter const & arg, Node & result, EvalContext & ctx)
       {
+         detail::node const * impl = NodeAccess::Impl(node);
+         if (!impl || impl->type() != NodeType::Map)
+            return EPathError::InvalidNodeType;
+
          ArgMapFilter::const_iterator argit = arg.begin();
 
          // --- for each condition (they are in the beginning of the list):
@@ -716,29 +969,27 @@ namespace YAML
          for (; argit != arg.end() && argit->op != EKVOp::Select; ++argit) // selects are already sorted to the end of the list
          {
             KVToken const & key = argit->key;
-            const bool scanKeys = key.starry || key.noCase; // cannot use the index operator, need to check keys one-by-one
+            const bool scanKeys = key.starry || key.noCase; // cannot look up the key, need to check keys one-by-one
 
             if (scanKeys)
             {
-               for (auto keyit = node.begin(); keyit != node.end(); ++keyit)
+               bool complete = ScanKeys(*impl, *argit, ctx, [&](detail::node const &, detail::node const & value)
                {
-                  if (!KeyIsMatch(*argit, keyit->first))
-                     continue;
-
-                  if (ValueIsMatch(*argit, keyit->second))
-                  {
-                     anyMatch = true;
-                     break; // don't scan further keys if we have a match in this map already
-                  }
-               }
+                  if (!ValueIsMatch(*argit, value))
+                     return true;
+                  anyMatch = true;
+                  return false;  // don't scan further keys if we have a match in this map already
+               });
+               if (!complete)
+                  return EPathError::LimitExceeded;
             }
             else
             {
-               Node el = node[std::string(key.token)];
+               auto el = FindKey(*impl, key.token, ctx);
                if (!el && key.required)
                   return EPathError::NodeNotFound;    // required key was not present
 
-               if (el && ValueIsMatch(*argit, el))
+               if (el && ValueIsMatch(*argit, *el))
                   anyMatch = true;
                // still have to test further conditions, since there may be other required keys
             }
@@ -753,138 +1004,798 @@ namespace YAML
          // --- select specified keys
 
          if (argit == arg.end())    // no selector follows the conditions - entire node is selected
-            return EPathError::OK;
+            return result.reset(node), EPathError::OK;
 
-         Node result;
-         for (; argit != arg.end(); ++argit)
+         Node selected;
+         for (auto firstSelect = argit; argit != arg.end(); ++argit)
          {
             assert(argit->op == EKVOp::Select);
             KVToken const & key = argit->key;
+            const bool distinct = argit == firstSelect;     // keys of the first token are not in selected yet
 
             if (key.IsAllStar())      // entire node is selected
-               return EPathError::OK;
+               return result.reset(node), EPathError::OK;
 
-            const bool scanKeys = key.starry || key.noCase;
+            if (key.starry || key.noCase)
+            {
+               bool added = true;
+               bool complete = ScanKeys(*impl, *argit, ctx, [&](detail::node const & k, detail::node const & v)
+               {
+                  return added = AddSelectedPair(selected, node, k, v, ctx, distinct);
+               });
+               if (!complete || !added)
+                  return EPathError::LimitExceeded;
+               continue;
+            }
 
-            if (scanKeys)
+            for (auto && kv : *impl)
             {
-               for (auto keyit = node.begin(); keyit != node.end(); ++keyit)
+               if (kv.first->type() == NodeType::Scalar && kv.first->scalar() == key.token)
                {
-                  if (KeyIsMatch(*argit, keyit->first))
-                     result[keyit->first] = keyit->second;
+                  if (!AddSelectedPair(selected, node, *kv.first, *kv.second, ctx, distinct))
+                     return EPathError::LimitExceeded;
+                  break;
                }
             }
+         }
+         if (!selected.IsMap())
+            return EPathError::NodeNotFound;
+
+         result.reset(selected);
+         return EPathError::OK;
+      }
+
+      /** \internal calls \c f for each node in \c nodes.list, or each element of the sequence \c nodes.node.
+          Returns false if a limit of \c ctx.limits stopped the iteration. \c f collects its matches in \c ctx.scratch
+      */
+      template <typename TFunc>
+      bool ForEachItem(EvalNodes const & nodes, EvalContext & ctx, TFunc f)
+      {
+         if (ctx.limits)
+         {
+            auto Check = [&]
+            {
+               if (!ctx.limits->Visit() || !ctx.limits->Matched(ctx.scratch.size()))
+                  return false;
+               if (ctx.stats)
+                  ++ctx.stats->nodesVisited;
+               return true;
+            };
+            if (nodes.isList)
+            {
+               for (auto & el : nodes.list)
+                  if (!Check())
+                     return false;
+                  else
+                     f(el);
+            }
             else
             {
-               auto value = node[std::string(key.token)];
-               if (value)
-                  result[std::string(key.token)] = value;
+               for (auto && el : nodes.node)
+                  if (!Check())
+                     return false;
+                  else
+                     f(el);
+            }
+            return ctx.limits->Matched(ctx.scratch.size());
+         }
+
+         if (nodes.isList)
+         {
+            for (auto & el : nodes.list)
+               f(el);
+            if (ctx.stats)
+               ctx.stats->nodesVisited += nodes.list.size();
+         }
+         else
+         {
+            for (auto && el : nodes.node)
+            {
+               f(el);
+               if (ctx.stats)
+                  ++ctx.stats->nodesVisited;
             }
          }
-         if (!result.IsMap())
+         return true;
+      }
+
+      /// \internal replaces \c nodes with the fan-out result collected in \c ctx.scratch
+      EPathError SetFanOutResult(EvalNodes & nodes, EvalContext & ctx)
+      {
+         if (ctx.scratch.empty())
             return EPathError::NodeNotFound;
 
-         node.reset(result);
+         nodes.list.swap(ctx.scratch);
+         nodes.isList = true;
+         ctx.scratch.clear();
          return EPathError::OK;
       }
-   }
 
-   
-   /** Match a YAML path as far as possible
+      EPathError ApplyKey(EvalNodes & nodes, PathArg key, EvalContext & ctx)
+      {
+         if (!nodes.isList)
+         {
+            if (nodes.node.IsMap())
+            {
+               auto found = FindKey(*NodeAccess::Impl(nodes.node), key, ctx);
+               if (!found)
+                  return EPathError::NodeNotFound;
+               nodes.node.reset(NodeAccess::Make(*found, nodes.node));
+               return EPathError::OK;
+            }
 
-      Matches nodes as long as a valid selector can be removed from the head of \c path and nodes can be matched.
-      See \ref Select for an introduction and documentation of YAML paths and selector matching.
+            if (!nodes.node.IsSequence())
+               return EPathError::InvalidNodeType;
+         }
 
-      \param node 
-        [in] the node where to start to match \c path \n
-        [out] the last node that could be matched
+         ctx.scratch.clear();
+         bool complete = ForEachItem(nodes, ctx, [&](Node const & el)
+         {
+            auto impl = NodeAccess::Impl(el);
+            if (auto found = impl ? FindKey(*impl, key, ctx) : nullptr)
+               ctx.scratch.push_back(NodeAccess::Make(*found, el));
+         });
+         if (!complete)
+            return ctx.scratch.clear(), EPathError::LimitExceeded;
+         return SetFanOutResult(nodes, ctx);
+      }
 
-      \param path
-        [in]  the path to match \n
-        [out] the remainder of the path that could not be matched
+      EPathError ApplyIndex(EvalNodes & nodes, size_t index)
+      {
+         if (nodes.isList)
+         {
+            if (index >= nodes.list.size())
+               return EPathError::NodeNotFound;
 
-      \param args
-        List of bound arguments, see the respective paragraph in \ref Select
+            nodes.node.reset(nodes.list[index]);
+            nodes.list.clear();
+            nodes.isList = false;
+            return EPathError::OK;
+         }
 
-      \param  px
-        If not \c nullptr: receives detailed diagnostics if an error occurs.
+         Node const & node = nodes.node;
+         if (node.IsScalar() || node.IsMap())
+            return index == 0 ? EPathError::OK : EPathError::NodeNotFound;  // for scalar node and map, [0] remains at the same node
 
-      \returns Error code that occurred during matching. \c EPathError::None if the entire path could be matched. 
-      You can uses \ref PathException::IsNodeError and \ref PathException::IsPathError to check what kind of error occurred.
-   */
-   EPathError PathResolve(Node & node, PathArg & path, PathBoundArgs args, PathException * px)
-   {
-      PathScanner scan(path, args, px);
+         if (node.IsSequence())
+         {
+            Node el = node[index];     // const access: does not extend the sequence
+            if (!el)
+               return EPathError::NodeNotFound;
 
-      while (scan)
+            nodes.node.reset(el);
+            return EPathError::OK;
+         }
+         return EPathError::InvalidNodeType;
+      }
+
+      /// \internal true if \c arg is a single condition on an exact key (e.g. <code>{status=Running}</code>), see \ref ApplyMapFilterBlocks
+      bool IsBlockFilter(ArgMapFilter const & arg)
       {
-         if (!node)      // should not trigger except on initial node being undefined (and then only if there is a path given)
-            return scan.SetError(EPathError::NodeNotFound);
+         return arg.size() == 1 && arg[0].op != EKVOp::Select && !IsRangeOp(arg[0].op) && !arg[0].key.starry && !arg[0].key.noCase;
+      }
 
-         path = scan.Right(); // path is updated only when both the selector is valid, and it selects a valid node. 
-            
-         switch (scan.NextSelector())
+      /** \internal evaluates \c cond for a block of up to 64 values gathered by \ref ApplyMapFilterBlocks. Returns the bitmap of matches.
+          \c found and \c scalar are bitmaps of the elements that contain the key, and where its value is a scalar.
+      */
+      uint64_t MatchBlock(ArgKVPair const & cond, PathArg const * values, uint64_t found, uint64_t scalar, size_t count)
+      {
+         if (cond.op == EKVOp::Exists)
+            return found;
+
+         KVToken const & tok = cond.value;
+         uint64_t eq = scalar;
+         if (!tok.IsAllStar())
          {
-            case ESelector::Key:
-               if (auto err = SelectByKey(node, scan.SelectorData<ArgKey>().key); err != EPathError::OK)
-                  return scan.SetError(err);
-            continue;
+            // length filter over the block first, see StrIsMatch. Compare only the candidates left
+            const size_t len = tok.token.size();
+            uint64_t candidates = 0;
+            if (tok.starry)
+               for (size_t i = 0; i < count; ++i)
+                  candidates |= uint64_t(values[i].size() >= len) << i;
+            else
+               for (size_t i = 0; i < count; ++i)
+                  candidates |= uint64_t(values[i].size() == len) << i;
+            candidates &= scalar;
 
-            case ESelector::Index:
+            eq = 0;
+            for (size_t i = 0; i < count; ++i)
             {
-               size_t index = scan.SelectorData<ArgIndex>().index;
-               if (auto err = SelectByIndex(node, index); err != EPathError::OK)
-                  return scan.SetError(err);
-               continue;
+               if (!(candidates >> i & 1))
+                  continue;
+               int cmp = tok.noCase ? _strnicmp(tok.token.data(), values[i].data(), len) : memcmp(tok.token.data(), values[i].data(), len);
+               eq |= uint64_t(cmp == 0) << i;
             }
+         }
+         return cond.op == EKVOp::Equal ? eq : found & ~eq;    // NotEqual: the key exists, and its value is different or not a scalar
+      }
+
+      /** \internal applies a map filter accepted by \ref IsBlockFilter to the nodes of a fan-out.
+
+         Same result as \ref ApplyMapFilterToMap for each element, but processed in blocks of 64 elements:
+         the value of the key is gathered for each element of the block, \ref MatchBlock evaluates the condition
+         for the block, and only the matching elements are added to the result.
+         Unlike the element-wise evaluation, no \c Node is created for elements that don't match,
+         which avoids updating the reference count of the document's memory twice per element.
+      */
+      EPathError ApplyMapFilterBlocks(EvalNodes & nodes, ArgKVPair const & cond, EvalContext & ctx)
+      {
+         constexpr size_t BlockSize = 64;
+         detail::node const * elements[BlockSize];
+         PathArg values[BlockSize];
+         size_t count = 0;
+         size_t first = 0;       // index of elements[0] in nodes.list
 
-            case ESelector::MapFilter:
+         auto Flush = [&]
+         {
+            uint64_t found = 0, scalar = 0;
+            for (size_t i = 0; i < count; ++i)
             {
-               auto && arg = scan.SelectorData<ArgMapFilter>();
-               EPathError err = EPathError::OK;
-               if (node.IsMap())
-               {
-                  if (auto err = ApplyMapFilterToMap(node, arg); err != EPathError::OK)
-                     return scan.SetError(err);
+               values[i] = PathArg();
+               auto value = elements[i] ? FindKey(*elements[i], cond.key.token, ctx) : nullptr;
+               if (!value)
                   continue;
-               }
-
-               if (node.IsSequence())
+               found |= uint64_t(1) << i;
+               if (value->type() == NodeType::Scalar)
                {
-                  Node result;
-                  for (auto && el : node)
-                  {
-                     if (!el.IsMap())
-                        continue;
-                     auto err = ApplyMapFilterToMap(el, arg);
-                     if (err != EPathError::OK)
-                        continue;
-                     result.push_back(el);
-                  }
-                  if (!result.IsSequence())    // node didn't become a sequence if nothing did match
-                     return scan.SetError(EPathError::NodeNotFound);
-                  node.reset(result);
-                  continue;
+                  values[i] = value->scalar();
+                  scalar |= uint64_t(1) << i;
                }
-
-               return scan.SetError(EPathError::InvalidNodeType);
             }
 
-            case ESelector::Invalid:
-               return scan.Error();
+            uint64_t match = MatchBlock(cond, values, found, scalar, count);
+            for (size_t i = 0; match; ++i, match >>= 1)
+               if (match & 1)
+                  ctx.scratch.push_back(nodes.isList ? nodes.list[first + i] : NodeAccess::Make(*elements[i], nodes.node));
+            first += count;
+            count = 0;
+         };
 
-            default:
-               assert(false);    // no other selectors supported right now
-               return scan.Error();
+         ctx.scratch.clear();
+         if (nodes.isList)
+         {
+            for (auto & el : nodes.list)
+            {
+               elements[count++] = NodeAccess::Impl(el);
+               if (count == BlockSize)
+                  Flush();
+            }
+         }
+         else
+         {
+            for (auto el : *NodeAccess::Impl(nodes.node))
+            {
+               elements[count++] = &*el;
+               if (count == BlockSize)
+                  Flush();
+            }
          }
+         Flush();
+
+         if (ctx.stats)
+            ctx.stats->nodesVisited += first;
+         return SetFanOutResult(nodes, ctx);
       }
-      path = scan.Right();
-      return EPathError::OK;
-   }
 
-   /** Selects one or more sub nodes from \c node, according to the specification in \c path
+      EPathError ApplyMapFilter(EvalNodes & nodes, ArgMapFilter const & arg, EvalContext & ctx)
+      {
+         if (!nodes.isList)
+         {
+            if (nodes.node.IsMap())
+            {
+               Node result;
+               if (auto err = ApplyMapFilterToMap(nodes.node, arg, result, ctx); err != EPathError::OK)
+                  return err;
+               nodes.node.reset(result);
+               return EPathError::OK;
+            }
 
-      \par Error Handling
+            if (!nodes.node.IsSequence())
+               return EPathError::InvalidNodeType;
+         }
+
+         if (!ctx.limits && IsBlockFilter(arg))
+            return ApplyMapFilterBlocks(nodes, arg[0], ctx);
+
+         // a single comparison on a sequence may be answered by an OrderedIndex
+         if (!nodes.isList && !ctx.limits && arg.size() == 1 && IsRangeOp(arg[0].op) && !arg[0].key.starry && !arg[0].key.noCase)
+         {
+            ctx.scratch.clear();
+            if (SelectByOrderedIndex(nodes.node, arg[0], ctx.scratch))
+            {
+               if (ctx.stats)
+                  ctx.stats->nodesVisited += ctx.scratch.size();
+               return SetFanOutResult(nodes, ctx);
+            }
+         }
+
+         ctx.scratch.clear();
+         Node result;
+         bool complete = ForEachItem(nodes, ctx, [&](Node const & el)
+         {
+            if (el.IsMap() && ApplyMapFilterToMap(el, arg, result, ctx) == EPathError::OK)
+               ctx.scratch.push_back(result);
+         });
+         if (!complete)
+            return ctx.scratch.clear(), EPathError::LimitExceeded;
+         return SetFanOutResult(nodes, ctx);
+      }
+
+      /// \internal sort key of a node for \ref ApplySort, parsed once
+      struct SortEntry
+      {
+         int                  kind = 2;        // 0: number, 1: other scalar, 2: no scalar value (or NaN)
+         double               number = 0;
+         std::string_view     text;
+         size_t               position = 0;    // in the nodes sorted. Breaks ties, so equal values keep their order
+         detail::node const * node = nullptr;
+      };
+
+      /** \internal applies <code>!sort(field)</code> and <code>!top(count,field)</code> to a sequence, or the nodes of a fan-out.
+
+         Numbers are ordered as numbers, other scalars as strings, numbers first (like the comparisons of a map filter, see \ref RangeIsMatch).
+         \c sort orders ascending, and keeps the nodes without a value for \c field at the end. \c top selects the \c count nodes
+         with the highest values, in descending order, using a heap of \c count entries: O(n log count) for n nodes.
+      */
+      EPathError ApplySort(EvalNodes & nodes, ArgSort const & arg, EvalContext & ctx)
+      {
+         if (!nodes.isList && !nodes.node.IsSequence())
+            return EPathError::InvalidNodeType;
+
+         auto Before = [&](SortEntry const & a, SortEntry const & b)
+         {
+            if (a.kind != b.kind)
+               return a.kind < b.kind;
+            if (a.kind == 0 && a.number != b.number)
+               return arg.top ? a.number > b.number : a.number < b.number;
+            if (a.kind == 1 && a.text != b.text)
+               return arg.top ? a.text > b.text : a.text < b.text;
+            return a.position < b.position;
+         };
+
+         std::vector<SortEntry> entries;
+         if (!arg.top)
+            entries.reserve(nodes.isList ? nodes.list.size() : nodes.node.size());
+         else if (arg.count == 0)
+            return EPathError::NodeNotFound;
+
+         size_t position = 0;
+         bool complete = true;
+         auto Add = [&](detail::node const * el)
+         {
+            if (ctx.limits && !(complete = ctx.limits->Visit()))
+               return;
+
+            SortEntry entry;
+            entry.position = position++;
+            entry.node = el;
+            auto value = !el ? nullptr : arg.field.empty() ? el : el->type() == NodeType::Map ? FindKey(*el, arg.field, ctx) : nullptr;
+            if (value && value->type() == NodeType::Scalar)
+            {
+               entry.text = value->scalar();
+               entry.kind = !ParseNumber(entry.text, entry.number) ? 1 : std::isnan(entry.number) ? 2 : 0;
+            }
+
+            if (!arg.top)
+               entries.push_back(entry);
+            else if (entry.kind == 2)
+               return;
+            else if (entries.size() < arg.count)
+            {
+               entries.push_back(entry);
+               std::push_heap(entries.begin(), entries.end(), Before);    // the front is the entry sorted last
+            }
+            else if (Before(entry, entries.front()))
+            {
+               std::pop_heap(entries.begin(), entries.end(), Before);
+               entries.back() = entry;
+               std::push_heap(entries.begin(), entries.end(), Before);
+            }
+         };
+
+         if (nodes.isList)
+         {
+            for (size_t i = 0; i < nodes.list.size() && complete; ++i)
+               Add(NodeAccess::Impl(nodes.list[i]));
+         }
+         else
+         {
+            for (auto it = NodeAccess::Impl(nodes.node)->begin(), end = NodeAccess::Impl(nodes.node)->end(); it != end && complete; ++it)
+               Add(&**it);
+         }
+         if (!complete)
+            return EPathError::LimitExceeded;
+         if (ctx.stats)
+            ctx.stats->nodesVisited += position;
+
+         if (arg.top)
+            std::sort_heap(entries.begin(), entries.end(), Before);
+         else
+            std::sort(entries.begin(), entries.end(), Before);
+
+         ctx.scratch.clear();
+         for (auto & entry : entries)
+         {
+            if (nodes.isList)
+               ctx.scratch.push_back(nodes.list[entry.position]);
+            else
+               ctx.scratch.push_back(NodeAccess::Make(*entry.node, nodes.node));
+         }
+         if (ctx.limits && !ctx.limits->Matched(ctx.scratch.size()))
+            return ctx.scratch.clear(), EPathError::LimitExceeded;
+         return SetFanOutResult(nodes, ctx);
+      }
+
+      /** \internal applies a single selector retrieved by \ref PathScanner to \c nodes.
+          On success, \c nodes is replaced by the selected node(s). On error, \c nodes remains unchanged.
+      */
+      EPathError ApplySelector(EvalNodes & nodes, ESelector selector, PathScanner::tSelectorData const & data, EvalContext & ctx)
+      {
+         if (ctx.stats && !nodes.isList)
+            ++ctx.stats->nodesVisited;
+         if (ctx.limits && !ctx.limits->Visit())
+            return EPathError::LimitExceeded;
+
+         switch (selector)
+         {
+            case ESelector::None:      return EPathError::OK;
+            case ESelector::Key:       return ApplyKey(nodes, std::get<ArgKey>(data).key, ctx);
+            case ESelector::Index:     return ApplyIndex(nodes, std::get<ArgIndex>(data).index);
+            case ESelector::MapFilter: return ApplyMapFilter(nodes, std::get<ArgMapFilter>(data), ctx);
+            case ESelector::Sort:      return ApplySort(nodes, std::get<ArgSort>(data), ctx);
+
+            default:
+               assert(false);    // no other selectors supported right now
+               return EPathError::Internal;
+         }
+      }
+
+      /// \internal records a \ref PathExplainStep for one selector evaluated by \ref EvalPath, if \c ctx.explain is set
+      class ExplainStep
+      {
+      public:
+         ExplainStep(EvalContext & ctx, EvalNodes const & nodes) : m_ctx(ctx)
+         {
+            if (!ctx.explain)
+               return;
+            m_step = &ctx.explain->steps.emplace_back();
+            m_step->nodesIn = nodes.isList ? nodes.list.size() : 1;
+            m_outer = Exchange(ctx.stats, &m_stats);
+            m_allocs = PathAllocationCount();
+            m_start = Clock::now();
+         }
+
+         /// completes the step. \c path is the path from the selector on, \c rest the path after it. Returns \c err
+         EPathError Done(EPathError err, ESelector selector, PathArg path, PathArg rest, EvalNodes const & nodes)
+         {
+            if (!m_step)
+               return err;
+
+            m_step->nanoseconds = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start).count();
+            m_step->allocations = PathAllocationCount() - m_allocs;
+            m_ctx.stats = m_outer;
+            if (m_outer)
+            {
+               m_outer->nodesVisited += m_stats.nodesVisited;
+               m_outer->mapsScanned += m_stats.mapsScanned;
+            }
+
+            PathArg text = path.substr(0, path.size() - rest.size());
+            Split(text, [](char c) { return c == '.' || (isascii(c) && isspace(c)); });
+            while (!text.empty() && isascii(text.back()) && isspace(text.back()))
+               text.remove_suffix(1);
+
+            m_step->selector = selector;
+            m_step->text = text;
+            m_step->nodesVisited = m_stats.nodesVisited;
+            m_step->mapsScanned = m_stats.mapsScanned;
+            if (err == EPathError::OK)
+               m_step->nodesEmitted = nodes.isList ? nodes.list.size() : 1;
+            m_step->error = err;
+            return err;
+         }
+
+      private:
+         using Clock = std::chrono::steady_clock;
+
+         EvalContext &       m_ctx;
+         PathExplainStep *   m_step = nullptr;
+         EvalStats           m_stats;
+         EvalStats *         m_outer = nullptr;
+         size_t              m_allocs = 0;
+         Clock::time_point   m_start;
+      };
+
+      /** \internal the selector loop shared by \ref PathResolve and \ref SelectNodes, see there. */
+      EPathError EvalPath(EvalNodes & nodes, PathArg & path, PathBoundArgs args, PathErrorInfo * px, EvalContext & ctx)
+      {
+         PathScanner scan(path, args, px);
+         while (scan)
+         {
+            if (!nodes.isList && !nodes.node)      // should not trigger except on initial node being undefined (and then only if there is a path given)
+               return scan.SetError(EPathError::NodeNotFound);
+
+            path = scan.Right(); // path is updated only when both the selector is valid, and it selects a valid node.
+
+            ExplainStep explain(ctx, nodes);
+            auto selector = scan.NextSelector();
+            if (selector == ESelector::Invalid)
+               return explain.Done(scan.Error(), selector, path, scan.Right(), nodes);
+
+            auto err = ApplySelector(nodes, selector, scan.SelectorDataV(), ctx);
+            if (explain.Done(err, selector, path, scan.Right(), nodes) != EPathError::OK)
+               return scan.SetError(err);
+         }
+         path = scan.Right();
+         return EPathError::OK;
+      }
+
+      /** \internal scans all selectors of \c path into \c result, so that they can be applied repeatedly without scanning the path again.
+          Note that the selectors refer to the characters of \c path and string arguments in \c args, which must remain valid as long as \c result is used.
+      */
+      EPathError ScanSelectors(SelectorList & result, PathArg path, PathBoundArgs args, PathErrorInfo * px)
+      {
+         result.clear();
+         PathScanner scan(path, args, px);
+         while (scan)
+         {
+            auto selector = scan.NextSelector();
+            if (selector == ESelector::Invalid)
+               return scan.Error();
+            if (selector != ESelector::None)
+               result.push_back({ selector, scan.SelectorDataV() });
+         }
+         return scan.Error();
+      }
+
+      /** \internal writes \c path to \c result without whitespace, and with indices and the values of map filter conditions
+          replaced by \c %, so that paths differing only in values written inline (e.g. <code>pods[3]</code> and <code>pods[%]</code>)
+          have the same form. A malformed remainder of \c path is copied as is.
+      */
+      void CanonicalPath(PathArg path, std::string & result)
+      {
+         result.clear();
+         EToken prev = EToken::None;
+         while (!path.empty())
+         {
+            PathScanner scan(path);    // skips whitespace before and after each token
+            path = scan.Right();
+            auto token = scan.NextToken().id;
+            if (token == EToken::Invalid || token == EToken::None)
+               break;
+
+            const bool isValue = prev == EToken::OpenBracket || prev == EToken::Equal || prev == EToken::Less || prev == EToken::Greater;
+            if (isValue && (token == EToken::QuotedIdentifier || token == EToken::UnquotedIdentifier))
+               result += '%';
+            else
+            {
+               PathArg text = path.substr(0, path.size() - scan.Right().size());
+               while (!text.empty() && isascii(text.back()) && isspace(text.back()))
+                  text.remove_suffix(1);
+               result.append(text);
+            }
+            prev = token;
+            path = scan.Right();
+         }
+         result.append(path);
+      }
+
+      /// \internal true if the selectors select the same nodes. Only keys and indices are compared, other selectors are never the same
+      bool IsSameSelector(SelectorRecord const & a, SelectorRecord const & b)
+      {
+         if (a.selector != b.selector)
+            return false;
+         if (a.selector == ESelector::Key)
+            return std::get<ArgKey>(a.data).key == std::get<ArgKey>(b.data).key;
+         if (a.selector == ESelector::Index)
+            return std::get<ArgIndex>(a.data).index == std::get<ArgIndex>(b.data).index;
+         return false;
+      }
+
+      /** \internal applies \c selectors retrieved by \ref ScanSelectors. Returns the first error (which is a node error).
+          On error, \c nodes contains the nodes matched by the selectors before.
+      */
+      EPathError EvalSelectors(EvalNodes & nodes, SelectorList const & selectors, EvalContext & ctx)
+      {
+         for (auto & sel : selectors)
+         {
+            if (!nodes.isList && !nodes.node)
+               return EPathError::NodeNotFound;
+            if (auto err = ApplySelector(nodes, sel.selector, sel.data, ctx); err != EPathError::OK)
+               return err;
+         }
+         return EPathError::OK;
+      }
+
+      /** \internal returns the node(s) in \c nodes as single node. A list is turned into a new sequence.
+
+         The sequence is created in the memory of the document: adding nodes of the document to a sequence in other memory
+         would merge the entire memory of the document into it. Either way the document's memory is modified,
+         the read-only API (\ref SelectNodes) therefore returns the list.
+      */
+      Node Materialize(EvalNodes const & nodes)
+      {
+         if (!nodes.isList)
+            return nodes.node;
+
+         if (nodes.list.empty() || !NodeAccess::Impl(nodes.list[0]))
+            return Node(NodeType::Sequence);
+
+         Node result = NodeAccess::Create(nodes.list[0], NodeType::Sequence);
+         for (auto & el : nodes.list)
+            result.push_back(el);
+         return result;
+      }
+
+      /// \internal hash of the subtree \c n, consistent with \ref IsEqualNode
+      size_t HashNode(detail::node const & n)
+      {
+         auto Combine = [](size_t h, size_t v) { return h ^ (v + size_t(0x9E3779B97F4A7C15ull) + (h << 6) + (h >> 2)); };
+         size_t h = size_t(n.is_defined() ? n.type() : NodeType::Undefined);
+         switch (h)
+         {
+            case size_t(NodeType::Scalar):
+               return Combine(h, std::hash<std::string_view>{}(n.scalar()));
+
+            case size_t(NodeType::Sequence):
+               for (auto el : n)
+                  h = Combine(h, HashNode(*el));
+               return h;
+
+            case size_t(NodeType::Map):
+               for (auto && kv : n)
+                  h = Combine(Combine(h, HashNode(*kv.first)), HashNode(*kv.second));
+               return h;
+         }
+         return h;
+      }
+
+      /// \internal true if \c a and \c b are equal scalars, or sequences or maps with equal elements, or keys and values, in the same order. Tags are ignored
+      bool IsEqualNode(detail::node const & a, detail::node const & b)
+      {
+         if (&a == &b)
+            return true;
+         auto type = a.is_defined() ? a.type() : NodeType::Undefined;
+         if (type != (b.is_defined() ? b.type() : NodeType::Undefined))
+            return false;
+
+         switch (type)
+         {
+            case NodeType::Scalar:
+               return a.scalar() == b.scalar();
+
+            case NodeType::Sequence:
+            case NodeType::Map:
+            {
+               if (a.size() != b.size())
+                  return false;
+               auto itb = b.begin();
+               for (auto ita = a.begin(); ita != a.end(); ++ita, ++itb)
+               {
+                  auto ea = *ita, eb = *itb;
+                  if (type == NodeType::Sequence ? !IsEqualNode(*ea, *eb) : !IsEqualNode(*ea.first, *eb.first) || !IsEqualNode(*ea.second, *eb.second))
+                     return false;
+               }
+               return true;
+            }
+
+            default:
+               return true;
+         }
+      }
+
+      /** \internal removes nodes equal to a node before them (see \ref IsEqualNode) from \c nodes, keeping the order.
+          Each node is hashed once, and compared only with the nodes kept that have the same hash.
+      */
+      void RemoveDuplicates(std::vector<Node> & nodes)
+      {
+         if (nodes.size() < 2)
+            return;
+
+         std::unordered_multimap<size_t, size_t> kept;   // hash -> index of the node kept
+         kept.reserve(nodes.size());
+         size_t count = 0;
+         for (size_t i = 0; i < nodes.size(); ++i)
+         {
+            auto impl = NodeAccess::Impl(nodes[i]);
+            size_t hash = impl ? HashNode(*impl) : 0;
+            auto [first, last] = kept.equal_range(hash);
+            bool duplicate = std::any_of(first, last, [&](auto & k)
+            {
+               auto other = NodeAccess::Impl(nodes[k.second]);
+               return impl && other ? IsEqualNode(*impl, *other) : impl == other;
+            });
+            if (duplicate)
+               continue;
+
+            kept.emplace(hash, count);
+            if (count != i)
+               nodes[count].reset(nodes[i]);   // note: assigning would assign the node
+            ++count;
+         }
+         nodes.erase(nodes.begin() + count, nodes.end());
+      }
+   }
+
+
+   namespace YamlPathDetail
+   {
+      /// \internal records the limit that stopped an evaluation
+      void SetLimitError(PathErrorInfo & info, LimitState const * limits)
+      {
+         info.error = EPathError::LimitExceeded;
+         info.errorType = limits ? unsigned(limits->Exceeded()) : 0;
+      }
+
+      /// \internal implements \ref PathResolve, with optional limits
+      EPathError ResolvePath(Node & node, PathArg & path, PathBoundArgs args, LimitState * limits, PathException * px)
+      {
+         PathArg fullPath = path;
+         PathErrorInfo info;
+         EvalContext ctx;
+         ctx.limits = limits;
+         MetricsScope metrics(EPathOp::PathResolve, fullPath, &ctx);
+         EvalNodes nodes{ node };
+         auto err = EvalPath(nodes, path, args, px ? &info : nullptr, ctx);
+         metrics.Result(err, nodes);
+         node.reset(Materialize(nodes));
+         if (PathException::IsLimitError(err))
+            SetLimitError(info, limits);
+         if (px)
+            *px = PathException(info, err != EPathError::OK ? fullPath : PathArg());
+         return err;
+      }
+
+      /// \internal evaluates \c path for \ref TrySelect and \ref TryRequire, recording the metrics for \c op
+      EPathError TryEvalPath(EPathOp op, EvalNodes & nodes, PathArg path, PathBoundArgs args, PathErrorInfo & info)
+      {
+         EvalContext ctx;
+         MetricsScope metrics(op, path, &ctx);
+         auto err = EvalPath(nodes, path, args, &info, ctx);
+         metrics.Result(err, nodes);
+         return err;
+      }
+   }
+
+   /** Match a YAML path as far as possible
+
+      Matches nodes as long as a valid selector can be removed from the head of \c path and nodes can be matched.
+      See \ref Select for an introduction and documentation of YAML paths and selector matching.
+
+      \param node
+        [in] the node where to start to match \c path \n
+        [out] the last node that could be matched
+
+      \param path
+        [in]  the path to match \n
+        [out] the remainder of the path that could not be matched
+
+      \param args
+        List of bound arguments, see the respective paragraph in \ref Select
+
+      \param  px
+        If not \c nullptr: receives detailed diagnostics if an error occurs.
+
+      \returns Error code that occurred during matching. \c EPathError::None if the entire path could be matched.
+      You can uses \ref PathException::IsNodeError and \ref PathException::IsPathError to check what kind of error occurred.
+   */
+   EPathError PathResolve(Node & node, PathArg & path, PathBoundArgs args, PathException * px)
+   {
+      return ResolvePath(node, path, args, nullptr, px);
+   }
+
+   /** \ref PathResolve, stopping with \c EPathError::LimitExceeded when a limit of \c limits is reached.
+       Then, \c node and \c path are the last node matched and the remainder of the path, as for other errors.
+   */
+   EPathError PathResolve(Node & node, PathArg & path, PathBoundArgs args, PathLimits const & limits, PathException * px)
+   {
+      LimitState limitState(limits);
+      return ResolvePath(node, path, args, &limitState, px);
+   }
+
+   /** Selects one or more sub nodes from \c node, according to the specification in \c path
+
+      \par Error Handling
 
       if \c path is malformed, an \ref PathException exception is thrown.\n
 
@@ -893,171 +1804,624 @@ namespace YAML
 
       \c Select may throw exceptions from yaml-cpp if \c node is malformed. It is intended to not throw such exceptions otherwise.
 
-      \sa Require, PathResolve, PathValidate
+      \par Thread Safety
+
+      \c Select does not modify the document if it selects a single node. If the result is a sequence built from multiple nodes
+      (e.g. a key selector applied to a sequence), adding the nodes to the new sequence merges the memory of the document into the result.
+      Use \ref SelectNodes to select from a document that is shared between threads.
+
+      \sa Require, PathResolve, PathValidate, SelectNodes
    */
    Node Select(Node node, PathArg path, PathBoundArgs args)
    {
-      PathException x;
-      auto err = PathResolve(node, path, args, &x);
+      PathArg fullPath = path;
+      PathErrorInfo info;
+      EvalContext ctx;
+      MetricsScope metrics(EPathOp::Select, fullPath, &ctx);
+      EvalNodes nodes{ node };
+      auto err = EvalPath(nodes, path, args, &info, ctx);
+      metrics.Result(err, nodes);
       if (err == EPathError::OK)
-         return node;
+         return Materialize(nodes);
 
-      if (x.IsNodeError())
+      if (PathException::IsNodeError(err))
          return UndefinedNode();
 
-      throw x;
+      throw PathException(info, fullPath);
    }
 
    /** Like \ref Select, except that it throws a \c PathException if no node can be matched */
    Node Require(Node node, PathArg path, PathBoundArgs args)
    {
-      PathException x;
-      auto err = PathResolve(node, path, args, &x);
+      PathArg fullPath = path;
+      PathErrorInfo info;
+      EvalContext ctx;
+      MetricsScope metrics(EPathOp::Require, fullPath, &ctx);
+      EvalNodes nodes{ node };
+      auto err = EvalPath(nodes, path, args, &info, ctx);
+      metrics.Result(err, nodes);
+      if (err == EPathError::OK)
+         return Materialize(nodes);
+
+      throw PathException(info, fullPath);
+   }
+
+   /** Like \ref Select, but reports a malformed path through the result instead of throwing a \ref PathException.
+
+      \c TrySelect does not allocate strings, and does not throw on a malformed path or if no node can be matched.
+      If no node can be matched, the result evaluates to \c true (as \ref Select would not throw), its \ref PathResult::Value
+      is an undefined node (as \ref Select returns), and \ref PathResult::Error returns the node error.
+      Diagnostic messages are formatted only when requested through \ref PathResult::What or \ref PathResult::Exception.
+
+      \code
+      if (auto r = TrySelect(root, path); !r)
+         log << r.What();
+      else if (*r)
+         Use(r.Value());
+      \endcode
+
+      \c TrySelect may still throw exceptions from yaml-cpp, or \c std::bad_alloc.
+   */
+   PathResult TrySelect(Node const & node, PathArg path, PathBoundArgs args)
+   {
+      PathErrorInfo info;
+      EvalNodes nodes{ node };
+      auto err = TryEvalPath(EPathOp::Select, nodes, path, args, info);
+      if (err == EPathError::OK)
+         return PathResult(Materialize(nodes), info, path, false);
+      if (PathException::IsNodeError(err))
+         return PathResult(UndefinedNode(), info, path, false);
+      return PathResult(NodeAccess::Invalid(), info, path, true);
+   }
+
+   /** Like \ref Require, but reports errors through the result instead of throwing a \ref PathException.
+       The result evaluates to \c false if \c path is malformed or no node can be matched. Its \ref PathResult::Value
+       is then an invalid node, so that a failed \c TryRequire does not allocate. See \ref TrySelect.
+   */
+   PathResult TryRequire(Node const & node, PathArg path, PathBoundArgs args)
+   {
+      PathErrorInfo info;
+      EvalNodes nodes{ node };
+      if (TryEvalPath(EPathOp::Require, nodes, path, args, info) == EPathError::OK)
+         return PathResult(Materialize(nodes), info, path, false);
+      return PathResult(NodeAccess::Invalid(), info, path, true);
+   }
+
+   /** Read-only variant of \ref Select, returning the list of selected nodes.
+
+      \c SelectNodes never modifies \c node or the document it belongs to, and does not allocate nodes in the document's memory.
+      Any number of threads may call \c SelectNodes concurrently on the same document, as long as no thread modifies the document.
+
+      The result contains the node matched by \c path, or the nodes matched if a selector was applied to all elements of a sequence
+      (where \ref Select would return a new sequence). It is empty if no node can be matched.
+
+      Nodes in the result refer to the document, except for maps created by selecting keys with a map filter (e.g. <code>{a,b}</code>):
+      these contain copies of the selected key-value pairs, since adding the pairs of the document would modify the document's memory.
+
+      Like \ref Select, a \ref PathException is thrown if \c path is malformed.
+   */
+   std::vector<Node> SelectNodes(Node const & node, PathArg path, PathBoundArgs args)
+   {
+      PathArg fullPath = path;
+      PathErrorInfo info;
+      EvalContext ctx;
+      ctx.readOnly = true;
+      MetricsScope metrics(EPathOp::SelectNodes, fullPath, &ctx);
+      EvalNodes nodes{ node };
+      auto err = EvalPath(nodes, path, args, &info, ctx);
+      metrics.Result(err, nodes);
+      if (err == EPathError::OK)
+      {
+         if (nodes.isList)
+            return std::move(nodes.list);
+         if (nodes.node)
+            return { nodes.node };
+         return {};
+      }
+
+      if (PathException::IsNodeError(err))
+         return {};
+
+      throw PathException(info, fullPath);
+   }
+
+   /** \ref SelectNodes, stopping when a limit of \c limits is reached.
+       Throws a \ref PathException if \c path is malformed, or with \c EPathError::LimitExceeded if a limit was reached.
+
+      \code
+      PathLimits limits = PathLimits::Timeout(std::chrono::milliseconds(5));
+      limits.maxResultNodes = 1000;
+      auto nodes = SelectNodes(root, userPath, {}, limits);
+      \endcode
+   */
+   std::vector<Node> SelectNodes(Node const & node, PathArg path, PathBoundArgs args, PathLimits const & limits)
+   {
+      PathArg fullPath = path;
+      PathErrorInfo info;
+      LimitState limitState(limits);
+      EvalContext ctx;
+      ctx.readOnly = true;
+      ctx.limits = &limitState;
+      MetricsScope metrics(EPathOp::SelectNodes, fullPath, &ctx);
+      EvalNodes nodes{ node };
+      auto err = EvalPath(nodes, path, args, &info, ctx);
+      metrics.Result(err, nodes);
+      if (err == EPathError::OK)
+      {
+         if (nodes.isList)
+            return std::move(nodes.list);
+         if (nodes.node)
+            return { nodes.node };
+         return {};
+      }
+
+      if (PathException::IsNodeError(err))
+         return {};
+
+      if (PathException::IsLimitError(err))
+         SetLimitError(info, &limitState);
+      throw PathException(info, fullPath);
+   }
+
+   CompiledPath::CompiledPath(PathArg path)
+   {
+      auto compiled = std::make_shared<CompiledSelectors>();
+      compiled->path.assign(path);
+      PathErrorInfo info;
+      if (ScanSelectors(compiled->selectors, compiled->path, {}, &info) != EPathError::OK)
+         throw PathException(info, path);
+      m_selectors = std::move(compiled);
+   }
+
+   PathArg CompiledPath::Path() const
+   {
+      return m_selectors->path;
+   }
+
+   /** Like \ref Select, with the selectors of \c path scanned in advance. Returns an invalid node if no node can be matched. */
+   Node Select(Node node, CompiledPath const & path)
+   {
+      EvalContext ctx;
+      MetricsScope metrics(EPathOp::Select, path.Path(), &ctx);
+      EvalNodes nodes{ node };
+      auto err = EvalSelectors(nodes, path.Selectors().selectors, ctx);
+      metrics.Result(err, nodes);
       if (err == EPathError::OK)
-         return node;
+         return Materialize(nodes);
+      return UndefinedNode();
+   }
+
+   /** Like \ref SelectNodes, with the selectors of \c path scanned in advance. Does not throw a \ref PathException. */
+   std::vector<Node> SelectNodes(Node const & node, CompiledPath const & path)
+   {
+      EvalContext ctx;
+      ctx.readOnly = true;
+      return SelectNodes(node, path, ctx);
+   }
+
+   /// \copydoc SelectNodes(Node const &, PathArg, PathBoundArgs, PathLimits const &)
+   std::vector<Node> SelectNodes(Node const & node, CompiledPath const & path, PathLimits const & limits)
+   {
+      LimitState limitState(limits);
+      EvalContext ctx;
+      ctx.readOnly = true;
+      ctx.limits = &limitState;
+      MetricsScope metrics(EPathOp::SelectNodes, path.Path(), &ctx);
+      EvalNodes nodes{ node };
+      auto err = EvalSelectors(nodes, path.Selectors().selectors, ctx);
+      metrics.Result(err, nodes);
+      if (PathException::IsLimitError(err))
+      {
+         PathErrorInfo info;
+         SetLimitError(info, &limitState);
+         throw PathException(info, path.Path());
+      }
+      if (err != EPathError::OK)
+         return {};
+      if (nodes.isList)
+         return std::move(nodes.list);
+      if (nodes.node)
+         return { nodes.node };
+      return {};
+   }
 
-      throw x;
+   /// \internal \ref SelectNodes with a context that is reused for many evaluations (\c ctx.readOnly must be set)
+   /** Like \ref SelectNodes, but returns each distinct node once, in the order of first occurrence.
+
+      Useful for paths that fan out over a sequence, like <code>pods.node</code>. Scalars are equal if their values are equal,
+      sequences and maps if their elements, or their keys and values, are equal and in the same order. Tags are ignored.
+      The nodes matched are hashed - scalars by value, sequences and maps by their subtree - and compared only if
+      their hashes are equal, so removing duplicates takes time linear in the size of the nodes matched.
+      Duplicates are dropped from the list of nodes matched, before a result sequence is built (see \ref Select).
+
+      Like \ref SelectNodes, \c SelectDistinct does not modify the document, and may be called concurrently.
+   */
+   std::vector<Node> SelectDistinct(Node const & node, PathArg path, PathBoundArgs args)
+   {
+      auto nodes = SelectNodes(node, path, args);
+      RemoveDuplicates(nodes);
+      return nodes;
+   }
+
+   /** Like \ref SelectDistinct, with the selectors of \c path scanned in advance. Does not throw a \ref PathException. */
+   std::vector<Node> SelectDistinct(Node const & node, CompiledPath const & path)
+   {
+      auto nodes = SelectNodes(node, path);
+      RemoveDuplicates(nodes);
+      return nodes;
+   }
+
+   std::vector<Node> YamlPathDetail::SelectNodes(Node const & node, CompiledPath const & path, EvalContext & ctx)
+   {
+      MetricsScope metrics(EPathOp::SelectNodes, path.Path(), &ctx);
+      EvalNodes nodes{ node };
+      auto err = EvalSelectors(nodes, path.Selectors().selectors, ctx);
+      metrics.Result(err, nodes);
+      if (err != EPathError::OK)
+         return {};
+      if (nodes.isList)
+         return std::move(nodes.list);
+      if (nodes.node)
+         return { nodes.node };
+      return {};
    }
 
 
 
    namespace YamlPathDetail
    {
-      Node EnsureNodeApplyKeyToMapOrNothing(Node & start, std::string key)
+      /** \internal returns the value for \c key in the map \c start, adding a null value if the key does not exist.
+          \c start may also be null or undefined, then it is turned into a map.
+      */
+      Node EnsureState::ApplyKeyToMapOrNothing(Node & start, PathArg key)
       {
-         Node n = start[key];
-         if (n)
-            return n;
-         start[key] = Node(NodeType::Null);
-         return start[key];
+         KeyIndex * keys = nullptr;
+         if (m_batch)
+         {
+            keys = &IndexKeys(start);
+            if (auto it = keys->find(key); it != keys->end())
+               return it->second;
+         }
+         else
+         {
+            Node value;
+            if (FindKey(start, key, value))
+               return value;
+         }
+
+         // force_insert does not search the map again, and does not leave an undefined pair behind like operator[]
+         Node k(std::string{ key });
+         Node value(NodeType::Null);
+         start.force_insert(k, value);
+         m_modified = true;
+         if (keys)
+            keys->emplace(k.Scalar(), value);
+         return value;
+      }
+
+      /// \internal index of the keys of map \c map for batches. Built on first use, and updated when keys are added
+      EnsureState::KeyIndex & EnsureState::IndexKeys(Node const & map)
+      {
+         auto impl = NodeAccess::Impl(map);
+         auto [it, isNew] = m_keys.try_emplace(impl);
+         if (isNew && impl && impl->type() == NodeType::Map)
+         {
+            for (auto && kv : *impl)
+               if (kv.first->type() == NodeType::Scalar)
+                  it->second.emplace(kv.first->scalar(), NodeAccess::Make(*kv.second, map));  // like FindKey, the first of duplicate keys wins
+         }
+         return it->second;
       }
 
-      void EnsureNodeApplyKey(std::vector<Node> & result, Node & start, std::string key, bool recurse)
+      void EnsureState::ApplyKey(std::vector<Node> & result, Node & start, PathArg key, bool recurse)
       {
          if (!start || start.IsNull() || start.IsMap())
-            result.push_back(EnsureNodeApplyKeyToMapOrNothing(start, key));
+            result.push_back(ApplyKeyToMapOrNothing(start, key));
          else if (start.IsSequence() && recurse)
          {
-            for (auto & el : start)
+            for (auto el : start)
                if (el.IsNull() || el.IsMap())
-                  EnsureNodeApplyKey(result, el, key, false);
+                  ApplyKey(result, el, key, false);
          }
       }
 
-      void EnsureNodeApplyKey(std::vector<Node> & result, std::vector<Node> & start, std::string key)
+      void EnsureState::ApplyKey(std::vector<Node> & result, std::vector<Node> & start, PathArg key)
       {
          for (auto & el : start)
             if (el.IsNull() || el.IsMap())
-               EnsureNodeApplyKey(result, el, key, true);
+               ApplyKey(result, el, key, true);
       }
-   }
 
-   Node Create(PathArg path, PathBoundArgs args)
-   {
-      Node root(YAML::NodeType::Null);
-      Ensure(root, path, args);
-      return root;
-   }
+      /** \internal finds the first element of the sequence \c seq that is a map with the scalar value \c cond.value for \c cond.key.
+          A batch looks the element up in an index of the sequence by the value of the key. The index is built on first use;
+          elements appended since, and elements that had no value for the key, are indexed when a value is not found.
+      */
+      bool EnsureState::FindElement(Node const & seq, ArgKVPair const & cond, Node & element)
+      {
+         auto impl = NodeAccess::Impl(seq);
+         auto FindValue = [&](detail::node const & el) -> detail::node const *
+         {
+            auto value = el.type() == NodeType::Map ? FindKey(el, cond.key.token) : nullptr;
+            return value && value->type() == NodeType::Scalar ? value : nullptr;
+         };
 
-   Node Ensure(Node & node, PathArg path, PathBoundArgs args)
-   {
-      PathException x;
-      PathScanner scan(path, args, &x);
+         if (!m_batch)
+         {
+            for (auto el : *impl)
+               if (auto value = FindValue(*el); value && value->scalar() == cond.value.token)
+                  return element.reset(NodeAccess::Make(*el, seq)), true;
+            return false;
+         }
 
-      std::vector<Node> next;
-      next.push_back(node);
+         auto & index = m_elements[{ impl, std::string(cond.key.token) }];
+         auto Lookup = [&]
+         {
+            auto it = index.byValue.find(cond.value.token);
+            if (it == index.byValue.end())
+               return false;
+            element.reset(it->second);
+            return true;
+         };
+         if (Lookup())
+            return true;
 
-      while (scan)
+         std::vector<size_t> unkeyed;
+         auto Add = [&](size_t position)
+         {
+            Node el = seq[position];
+            if (auto value = FindValue(*NodeAccess::Impl(el)))
+               index.byValue.emplace(value->scalar(), el);   // the first of duplicate values wins
+            else
+               unkeyed.push_back(position);
+         };
+         for (size_t position : index.unkeyed)
+            Add(position);
+         for (size_t position = index.indexed; position < impl->size(); ++position)
+            Add(position);
+         index.unkeyed.swap(unkeyed);
+         index.indexed = impl->size();
+         return Lookup();
+      }
+
+      /** \internal the element of the sequence \c seq selected by the map filter condition \c cond for \ref Ensure.
+          If there is none, an empty map is appended.
+      */
+      Node EnsureState::UpsertElement(Node & seq, ArgKVPair const & cond)
+      {
+         Node element;
+         if (FindElement(seq, cond, element))
+            return element;
+
+         element.reset(NodeAccess::Create(seq, NodeType::Map));
+         seq.push_back(element);
+         m_modified = true;
+         return element;
+      }
+
+      /** \internal resumes evaluation of \c path from the working set of the longest prefix it shares with the previous path.
+          Returns the length of that prefix.
+      */
+      size_t EnsureState::ResumePrefix(PathArg path)
+      {
+         size_t common = std::mismatch(path.begin(), path.end(), m_prevPath.begin(), m_prevPath.end()).first - path.begin();
+         while (!m_prefixes.empty() && m_prefixes.back().offset > common)
+            m_prefixes.pop_back();
+
+         // the prefix must end at a selector boundary of path, too: for "a.b", "a.bc" only shares "a"
+         if (!m_prefixes.empty() && m_prefixes.back().offset == common && common < path.size() && !strchr(".[{", path[common]))
+            m_prefixes.pop_back();
+
+         m_prevPath.assign(path);
+         if (m_prefixes.empty())
+            return 0;
+
+         auto & prefix = m_prefixes.back();
+         m_next.insert(m_next.end(), prefix.nodes.begin(), prefix.nodes.end());
+         return prefix.offset;
+      }
+
+      /// \internal remembers the working set after the selector ending at \c offset, for \ref ResumePrefix
+      void EnsureState::AddPrefix(size_t offset)
       {
-         switch (scan.NextSelector())
+         m_prefixes.emplace_back();
+         m_prefixes.back().offset = offset;
+         m_prefixes.back().nodes.insert(m_prefixes.back().nodes.end(), m_next.begin(), m_next.end());   // note: assigning vector<Node> would assign the nodes
+      }
+
+      /** \internal implements \ref Ensure. If \c result is not null, it receives the nodes selected by \c path.
+          Throws a \ref PathException if \c path is malformed or cannot be applied.
+          If nodes were added or assigned, \ref PathSubscriptions of the document are notified, even if the path failed later.
+          \ref OrderedIndex "OrderedIndexes" of the document are notified in any case, since the generation of the document changed.
+      */
+      void EnsureState::Apply(Node & root, PathArg path, PathBoundArgs args, std::vector<Node> * result)
+      {
+         m_modified = false;
+         try
          {
-            case YamlPathDetail::ESelector::None:
-               break;
+            ApplyPath(root, path, args, result);
+         }
+         catch (...)
+         {
+            NotifyOrderedIndexes(root, path, args, m_modified);
+            if (m_modified)
+               NotifyMutation(root, path, args);
+            throw;
+         }
+         NotifyOrderedIndexes(root, path, args, m_modified);
+         if (m_modified)
+            NotifyMutation(root, path, args);
+      }
+
+      void EnsureState::ApplyPath(Node & root, PathArg path, PathBoundArgs args, std::vector<Node> * result)
+      {
+         MetricsScope metrics(EPathOp::Ensure, path);
+         BumpGeneration(root);
+         m_next.clear();
 
-            case YamlPathDetail::ESelector::Key:
+         size_t offset = 0;
+         if (m_batch && args.size() == 0)
+            offset = ResumePrefix(path);
+         else
+         {
+            m_prefixes.clear();
+            m_prevPath.clear();
+         }
+
+         if (m_next.empty())
+            m_next.push_back(root);
+
+         const size_t scanStart = offset + (offset && offset < path.size() && path[offset] == '.');   // the scanner does not accept a period at the start
+         PathErrorInfo info;
+         PathScanner scan(path.substr(scanStart), args, &info);
+         auto Fail = [&](EPathError error)
+         {
+            if (scan.Error() == EPathError::OK)
+               scan.SetError(error);
+            info.errorOffset += scanStart;
+            info.resolvedLength = info.resolvedLength ? info.resolvedLength + scanStart : offset;
+            metrics.Result(info.error);
+            throw PathException(info, path);
+         };
+
+         while (scan)
+         {
+            switch (scan.NextSelector())
             {
-               std::string key = std::string(scan.SelectorData<ArgKey>().key);
-               std::vector<Node> result;
-               EnsureNodeApplyKey(result, next, key);
+               case YamlPathDetail::ESelector::None:
+                  continue;
 
-               if (!result.size()) // nothing was added
+               case YamlPathDetail::ESelector::Key:
                {
-                  scan.SetError(EPathError::Internal);  // TODO: appropriate error msg
-                  throw x;
+                  m_result.clear();
+                  ApplyKey(m_result, m_next, scan.SelectorData<ArgKey>().key);
+
+                  if (!m_result.size()) // nothing was added
+                     Fail(EPathError::Internal);  // TODO: appropriate error msg
+                  m_next.swap(m_result);
+                  break;
                }
-               next.swap(result);
-               continue;
-            }
 
-            case YamlPathDetail::ESelector::MapFilter:
-            {
-               bool haveAssignment = false;
-               std::vector<Node> result;
-               for (auto && kvp : scan.SelectorData<ArgMapFilter>())
+               case YamlPathDetail::ESelector::MapFilter:
                {
-                  if (kvp.op == EKVOp::NotEqual ||
-                     kvp.key.starry || kvp.key.noCase || kvp.key.required ||
-                     kvp.value.starry || kvp.value.noCase || kvp.value.required)
+                  auto & filter = scan.SelectorData<ArgMapFilter>();
+                  for (auto && kvp : filter)
                   {
-                     scan.SetError(EPathError::SelectorNotSupported);
-                     throw x;
+                     if (kvp.op == EKVOp::NotEqual || IsRangeOp(kvp.op) ||
+                        kvp.key.starry || kvp.key.noCase || kvp.key.required ||
+                        kvp.value.starry || kvp.value.noCase || kvp.value.required)
+                     {
+                        Fail(EPathError::SelectorNotSupported);
+                     }
                   }
-                  if (kvp.op == EKVOp::Select)
-                     EnsureNodeApplyKey(result, next, std::string(kvp.key.token));
-                  else // has assignment
+
+                  // on a sequence, the filter applies to the element selected by its first condition, which is appended if missing
+                  m_upserted.clear();
+                  for (auto & el : m_next)
                   {
-                     std::vector<Node> assignTo;
-                     EnsureNodeApplyKey(assignTo, next, std::string(kvp.key.token));
-                     haveAssignment = !assignTo.empty();
-                     for (size_t idx = 0; idx < assignTo.size(); ++idx)
-                        if (kvp.op != EKVOp::Exists && (!assignTo[idx] || assignTo[idx].IsNull()))
-                           assignTo[idx] = Node(std::string(kvp.value.token));
+                     if (el.IsSequence())
+                     {
+                        if (filter.empty() || filter[0].op != EKVOp::Equal)
+                           Fail(EPathError::SelectorNotSupported);
+                        el.reset(UpsertElement(el, filter[0]));
+                        m_upserted.push_back(el);
+                     }
                   }
-               }
-               if (result.empty())
-               {
-                  if (haveAssignment)
-                     return Node();
-                  else
+
+                  bool haveAssignment = false;
+                  m_result.clear();
+                  for (auto && kvp : filter)
+                  {
+                     if (kvp.op == EKVOp::Select)
+                        ApplyKey(m_result, m_next, kvp.key.token);
+                     else // has assignment
+                     {
+                        m_assignTo.clear();
+                        ApplyKey(m_assignTo, m_next, kvp.key.token);
+                        haveAssignment = !m_assignTo.empty();
+                        for (size_t idx = 0; idx < m_assignTo.size(); ++idx)
+                           if (kvp.op != EKVOp::Exists && (!m_assignTo[idx] || m_assignTo[idx].IsNull()))
+                           {
+                              m_assignTo[idx] = Node(std::string(kvp.value.token));
+                              m_modified = true;
+                           }
+                     }
+                  }
+                  if (m_result.empty())
+                     m_result.swap(m_upserted);   // upserted elements are selected if the filter selects no keys
+                  if (m_result.empty())
                   {
-                     scan.SetError(EPathError::InvalidNodeType);
-                     throw x;
+                     if (haveAssignment)
+                     {
+                        m_next.clear();   // nothing selected
+                        m_prefixes.clear();
+                        metrics.Result(EPathError::OK);
+                        return;
+                     }
+                     Fail(EPathError::InvalidNodeType);
                   }
+                  m_next.swap(m_result);
+                  break;
                }
-               else
-                  next.swap(result);
-            }
-            continue;
 
-            case YamlPathDetail::ESelector::Index:
-            {
-               std::vector<Node> result;
-               for (auto el : next)
+               case YamlPathDetail::ESelector::Index:
                {
-                  if (!el || el.IsNull() || el.IsSequence())
+                  m_result.clear();
+                  for (auto el : m_next)
                   {
-                     size_t seqSize = el.IsSequence() ? el.size() : 0;
-                     size_t idx = scan.SelectorData<ArgIndex>().index;
-                     if (idx >= seqSize)
-                        for (size_t i = 0; i < idx - seqSize + 1; ++i)
-                           el.push_back(Node());
-                     result.push_back(el[idx]);
+                     if (!el || el.IsNull() || el.IsSequence())
+                     {
+                        size_t seqSize = el.IsSequence() ? el.size() : 0;
+                        size_t idx = scan.SelectorData<ArgIndex>().index;
+                        if (idx >= seqSize)
+                        {
+                           for (size_t i = 0; i < idx - seqSize + 1; ++i)
+                              el.push_back(Node());
+                           m_modified = true;
+                        }
+                        m_result.push_back(el[idx]);
+                     }
                   }
+                  if (!m_result.size())
+                     Fail(EPathError::Internal);   // TODO: appropriate error
+                  m_next.swap(m_result);
+                  break;
                }
-               if (!result.size())
-               {
-                  scan.SetError(EPathError::Internal);   // TODO: appropriate error
-                  throw x;
-               }
-               next.swap(result);
+
+               default:
+                  Fail(EPathError::SelectorNotSupported);
             }
-            continue;
 
-            default:
-               scan.SetError(EPathError::SelectorNotSupported);
-               throw x;
+            if (m_batch && args.size() == 0)
+               AddPrefix(scanStart + scan.ScanOffset());
          }
+
+         metrics.Result(scan.Error(), m_next.size());
+         if (result)
+            result->swap(m_next);
       }
+   }
+
+   Node Create(PathArg path, PathBoundArgs args)
+   {
+      Node root(YAML::NodeType::Null);
+      Ensure(root, path, args);
+      return root;
+   }
+
+   /** Ensures the nodes selected by \c path exist in \c node, adding keys, elements and values as necessary, and returns them as a sequence.
+
+      A map filter assigns its conditions to maps that don't have a value for the key yet, and selects the keys it names.
+      Applied to a sequence, the map filter first selects the element whose value for the key of the first condition matches,
+      appending a new map if there is none, e.g. <code>Ensure(root, "users.{id=%}.name", { id })</code>.
+      The first condition must be an assignment <code>key=value</code>; other conditions and selected keys apply to the element.
+      If the filter selects no keys, the element is selected.
+
+      Each such upsert checks the elements of the sequence in order. For many upserts into the same sequence, use an \ref EnsureBatch.
+   */
+   Node Ensure(Node & node, PathArg path, PathBoundArgs args)
+   {
+      std::vector<Node> next;
+      EnsureState(false).Apply(node, path, args, &next);
 
       if (!next.size())
          return Node(NodeType::Null);
@@ -1068,4 +2432,35 @@ namespace YAML
       return final;
    }
 
+   /** Like \ref Ensure, but does not return the nodes selected.
+
+      \ref Ensure returns a new sequence holding the nodes selected by \c path. Building it merges the memory of
+      the entire document into the sequence, which makes repeated calls on a growing document slow.
+   */
+   void EnsureExists(Node & node, PathArg path, PathBoundArgs args)
+   {
+      EnsureState(false).Apply(node, path, args, nullptr);
+   }
+
+   /** Starts a batch of \ref EnsureExists calls on the document \c node.
+
+      A batch remembers the keys of the maps it visits, so it can look up and add keys in constant time,
+      and indexes the elements of sequences by the value of the key used for upserts (see \ref Ensure), so finding or appending
+      the element takes amortized constant time, too. It continues each path from the nodes already resolved for the longest prefix (ending at a selector) it shares
+      with the previous path. Paths with bound arguments are resolved from \c node.
+
+      The document must not be modified other than through the batch while the batch is used.
+   */
+   EnsureBatch::EnsureBatch(Node & node) : m_node(node), m_state(std::make_unique<EnsureState>(true))
+   {
+   }
+
+   EnsureBatch::~EnsureBatch() = default;
+
+   /// like \ref EnsureExists(m_node, path, args)
+   void EnsureBatch::Ensure(PathArg path, PathBoundArgs args)
+   {
+      m_state->Apply(m_node, path, args, nullptr);
+   }
+
 } // namespace YAML
@@ -25,14 +25,21 @@ SOFTWARE.
 #pragma once
 
 #include <string_view>
+#include <chrono>
+#include <cstdint>
 #include <variant>
 #include <optional>
+#include <vector>
+#include <memory>
 #include <yaml-cpp/node/node.h>
 
 namespace YAML
 {
    class Node;
    class PathException;
+   class PathResult;
+   class CompiledPath;
+   struct PathLimits;
 
    /** \c PathArg is used by yaml-path as parameter and return value representing a slice of a \c std::string.\n
 
@@ -60,6 +67,10 @@ namespace YAML
       NotEqual,
       Exists,
       Select,
+      Less,             ///< <code>{key<value}</code>: numbers are compared as numbers, other scalars as strings
+      LessEqual,
+      Greater,
+      GreaterEqual,
    };
 
    EPathError SelectByKey(Node & node, PathArg key);
@@ -67,10 +78,21 @@ namespace YAML
 
    Node Select(Node node, PathArg path, PathBoundArgs args = {}); ///< Select a node
    Node Require(Node node, PathArg path, PathBoundArgs args = {});
+   PathResult TrySelect(Node const & node, PathArg path, PathBoundArgs args = {});  ///< \ref Select without exceptions
+   PathResult TryRequire(Node const & node, PathArg path, PathBoundArgs args = {}); ///< \ref Require without exceptions
+   std::vector<Node> SelectNodes(Node const & node, PathArg path, PathBoundArgs args = {}); ///< read-only Select, safe for concurrent readers
+   Node Select(Node node, CompiledPath const & path);                       ///< \ref Select with a path scanned once
+   std::vector<Node> SelectNodes(Node const & node, CompiledPath const & path);  ///< \ref SelectNodes with a path scanned once
+   std::vector<Node> SelectDistinct(Node const & node, PathArg path, PathBoundArgs args = {});   ///< \ref SelectNodes, without duplicate values
+   std::vector<Node> SelectDistinct(Node const & node, CompiledPath const & path);
    Node Create(PathArg path, PathBoundArgs args = {});
    Node Ensure(Node & node, PathArg path, PathBoundArgs args = {}); ///< ensure one or more nodes exist. 
+   void EnsureExists(Node & node, PathArg path, PathBoundArgs args = {}); ///< like \ref Ensure, without returning the nodes
    EPathError PathValidate(PathArg p, std::string * valid = 0, size_t * errorOffs = 0);
    EPathError PathResolve(Node & node, PathArg & path, PathBoundArgs args = {}, PathException * px = 0);
+   EPathError PathResolve(Node & node, PathArg & path, PathBoundArgs args, PathLimits const & limits, PathException * px = 0);  ///< \ref PathResolve with resource limits
+   std::vector<Node> SelectNodes(Node const & node, PathArg path, PathBoundArgs args, PathLimits const & limits);   ///< \ref SelectNodes with resource limits
+   std::vector<Node> SelectNodes(Node const & node, CompiledPath const & path, PathLimits const & limits);
 
 
   
@@ -92,44 +114,132 @@ namespace YAML
       FirstNodeError_ = 100,     ///< all error codes after this indicate the selector was valid, but a matching node could not be found
       InvalidNodeType,
       NodeNotFound,
+
+      // evaluation stopped
+      FirstLimitError_ = 200,    ///< all error codes after this indicate the evaluation was stopped before it was complete
+      LimitExceeded,             ///< a limit of \ref PathLimits was reached
       /* to add a new error code, also add: a formatter to PathException::What */
    };
 
-   namespace YamlPathDetail { class PathScanner; }
+   namespace YamlPathDetail { class PathScanner; class EnsureState; struct CompiledSelectors; }
+
+   /** Limits the resources used by a single evaluation, e.g. of a path supplied by a user.
+       When a limit is reached, the evaluation stops with \c EPathError::LimitExceeded.
+   */
+   struct PathLimits
+   {
+      size_t maxNodesVisited = SIZE_MAX;  ///< nodes visited by all selectors, including keys compared by map filters scanning a map (e.g. <code>{*=x}</code>)
+      size_t maxResultNodes = SIZE_MAX;   ///< nodes matched by a selector: the result, and the nodes a selector fans out to
+      size_t maxBytes = SIZE_MAX;         ///< estimated memory of the nodes matched, and of maps created by map filters selecting keys
+      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();   ///< checked every few nodes visited
+
+      static PathLimits Timeout(std::chrono::nanoseconds timeout)
+      {
+         PathLimits limits;
+         limits.deadline = std::chrono::steady_clock::now() + timeout;
+         return limits;
+      }
+   };
+
+   /** Applies \ref EnsureExists for many paths to the same document. See \ref EnsureMany */
+   class EnsureBatch
+   {
+   public:
+      explicit EnsureBatch(Node & node);
+      ~EnsureBatch();
+      EnsureBatch(EnsureBatch const &) = delete;
+      EnsureBatch & operator=(EnsureBatch const &) = delete;
+
+      void Ensure(PathArg path, PathBoundArgs args = {});
+
+   private:
+      Node m_node;
+      std::unique_ptr<YamlPathDetail::EnsureState> m_state;
+   };
+
+   /** Ensures that the nodes for all paths in \c paths exist in \c node, like calling \ref EnsureExists for each path.
+      Shared prefixes are resolved once, and keys are looked up in an index, so building a document takes linear time.
+      \c paths is any range of elements convertible to \ref PathArg.
+   */
+   template <typename TPaths>
+   void EnsureMany(Node & node, TPaths const & paths)
+   {
+      EnsureBatch batch(node);
+      for (auto && path : paths)
+         batch.Ensure(path);
+   }
+
+   inline void EnsureMany(Node & node, std::initializer_list<PathArg> paths) { EnsureMany<std::initializer_list<PathArg>>(node, paths); }
+
+   /** A path that is scanned once, to be evaluated against many nodes or documents.
+
+      The constructor throws a \ref PathException if \c path is malformed. Bound arguments are not supported.
+      A \c CompiledPath is immutable: copies share the scanned selectors, and it can be used by many threads concurrently.
+
+      \code
+      CompiledPath names("pods.{phase=Running}.name");
+      for (auto & doc : docs)
+         for (auto & name : SelectNodes(doc, names))
+            Print(name);
+      \endcode
+   */
+   class CompiledPath
+   {
+   public:
+      explicit CompiledPath(PathArg path);
+
+      PathArg Path() const;
+      YamlPathDetail::CompiledSelectors const & Selectors() const { return *m_selectors; }  ///< \internal
+
+   private:
+      std::shared_ptr<YamlPathDetail::CompiledSelectors const> m_selectors;
+   };
+
+   /** Error information recorded while evaluating a path. Unlike \ref PathException, it does not hold or build any strings.
+       \ref PathException formats it into a message on demand.
+   */
+   struct PathErrorInfo
+   {
+      EPathError error = EPathError::OK;
+      std::size_t errorOffset = 0;              ///< index into the full path where the error occurred
+      std::size_t resolvedLength = 0;           ///< length of the part of the path that was resolved correctly
+      std::optional<size_t> boundArg;           ///< if token was taken from a bound argument, this is its index
+
+      uint64_t    validTypes = 0;               ///< \internal BitsOf(YAML::NodeType) for node errors, BitsOf(EToken) for token errors
+      unsigned    errorType = 0;                ///< \internal ESelector, or EToken
+   };
 
    /** Exception and diagnostics for yaml-path */
    class PathException : public std::exception
    {
    public:
       PathException() = default;
+      PathException(PathErrorInfo const & info, PathArg fullPath) : m_info(info), m_fullPath(fullPath) {}
 
-      EPathError Error() const { return m_error; }                ///< error code for this exception
-      bool IsNodeError() const { return IsNodeError(m_error); }   ///< true if \c error indicates failure to find a matching node
-      bool IsPathError() const { return IsPathError(m_error); }   ///< true if \c error indicates a malformed path
+      EPathError Error() const { return m_info.error; }           ///< error code for this exception
+      bool IsNodeError() const { return IsNodeError(Error()); }   ///< true if \c error indicates failure to find a matching node
+      bool IsPathError() const { return IsPathError(Error()); }   ///< true if \c error indicates a malformed path
+      bool IsLimitError() const { return IsLimitError(Error()); } ///< true if \c error indicates the evaluation was stopped by \ref PathLimits
 
       std::string FullPath() const { return m_fullPath; }         ///< the full path that was used by the failing command
-      std::string ResolvedPath() const { return m_fullPath.substr(0, m_offsSelectorScan);  } ///< the part of the path that was resolved correctly
-      std::size_t ErrorOffset() const { return m_offsTokenScan; }                            ///< index into the full path where the error occurred
-      std::optional<size_t> BoundArg() const { return m_fromBoundArg;  }                     ///< if token was taken from a bound argument, this is its index
+      std::string ResolvedPath() const { return m_fullPath.substr(0, m_info.resolvedLength);  } ///< the part of the path that was resolved correctly
+      std::size_t ErrorOffset() const { return m_info.errorOffset; }                            ///< index into the full path where the error occurred
+      std::optional<size_t> BoundArg() const { return m_info.boundArg;  }                       ///< if token was taken from a bound argument, this is its index
+      PathErrorInfo const & Info() const { return m_info; }                                     ///< error information as recorded during evaluation
 
       char const * what() const override { return What().c_str(); }                          ///< overrides \c std::exception::what, returning the detailed error message from \ref What
       std::string const & What(bool detailed = true) const;                
 
       static std::string GetErrorMessage(EPathError error);
-      static bool IsNodeError(EPathError error) { return error >= EPathError::FirstNodeError_; }   ///< true if \c error indicates failure to find a matching node
+      static bool IsNodeError(EPathError error) { return error >= EPathError::FirstNodeError_ && error < EPathError::FirstLimitError_; }   ///< true if \c error indicates failure to find a matching node
       static bool IsPathError(EPathError error) { return error < EPathError::FirstNodeError_ && error != EPathError::OK; }  ///< true if \c error indicates a malformed path
+      static bool IsLimitError(EPathError error) { return error >= EPathError::FirstLimitError_; }  ///< true if \c error indicates the evaluation was stopped by \ref PathLimits
 
    private:
       friend class YamlPathDetail::PathScanner; // if scanner has a non-null diags member, it will feed it scan state information
 
-      EPathError m_error = EPathError::OK;
+      PathErrorInfo m_info;
       std::string m_fullPath;
-      std::size_t m_offsTokenScan = 0;
-      std::size_t m_offsSelectorScan = 0;
-      std::optional<size_t> m_fromBoundArg;
-
-      uint64_t    m_validTypes = 0;    // BitsOf(YAML::NodeType) for node errors, BitsOf(EToken) for token errors
-      unsigned    m_errorType = 0;     // ESelector, or EToken
 
       std::string ErrorItem() const;
 
@@ -138,4 +248,38 @@ namespace YAML
       mutable std::string m_detailed;
       mutable std::string m_errorItem;
    };
+
+   /** Result of \ref TrySelect and \ref TryRequire: either the selected node, or the error that \ref Select or \ref Require would throw.
+
+      Creating a \c PathResult does not allocate strings or throw. \ref Exception and \ref What format the diagnostics
+      of \ref PathException on request. They refer to the path passed to \ref TrySelect, which must still be valid then.
+   */
+   class PathResult
+   {
+   public:
+      PathResult(PathResult const &) = default;
+      PathResult & operator=(PathResult const &) = delete;   // Node::operator= would assign to the selected node
+
+      explicit operator bool() const { return !m_failed; }    ///< true if a node was selected, or - for \ref TrySelect - no node was found
+      Node const & Value() const { return m_node; }           ///< the node selected. If no node was selected, a node that evaluates to \c false: undefined for \ref TrySelect (like \ref Select returns), invalid if the result failed
+      Node const & operator*() const { return m_node; }
+      Node const * operator->() const { return &m_node; }
+
+      EPathError Error() const { return m_info.error; }       ///< error code. For \ref TrySelect, this may be a node error even if the result is \c true
+      PathErrorInfo const & Info() const { return m_info; }   ///< error information without message text
+
+      PathException Exception() const { return PathException(m_info, m_path); }    ///< the exception \ref Select or \ref Require would throw
+      std::string What(bool detailed = true) const { return Exception().What(detailed); }
+
+   private:
+      friend PathResult TrySelect(Node const & node, PathArg path, PathBoundArgs args);
+      friend PathResult TryRequire(Node const & node, PathArg path, PathBoundArgs args);
+
+      PathResult(Node const & node, PathErrorInfo const & info, PathArg path, bool failed) : m_node(node), m_info(info), m_path(path), m_failed(failed) {}
+
+      Node           m_node;
+      PathErrorInfo  m_info;
+      PathArg        m_path;
+      bool           m_failed = false;
+   };
 }
@@ -0,0 +1,187 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-pool.h"
+#include "yaml-path-internals.h"
+#include <unordered_set>
+#include <set>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+#if YAML_PATH_POOL_INTERNALS
+      /** \internal yaml-cpp does not provide access to the nodes of a pool. Pointers to the private members are formed in
+          explicit instantiations, where access is not checked. The compiler still checks their names and types.
+      */
+      template <typename TTag, typename TTag::type member>
+      struct PrivateMember
+      {
+         friend typename TTag::type Get(TTag) { return member; }
+      };
+
+      struct HolderMemory { using type = detail::shared_memory detail::memory_holder::*; friend type Get(HolderMemory); };
+      struct MemoryNodes { using type = std::set<detail::shared_node> detail::memory::*; friend type Get(MemoryNodes); };
+
+      template struct PrivateMember<HolderMemory, &detail::memory_holder::m_pMemory>;
+      template struct PrivateMember<MemoryNodes, &detail::memory::m_nodes>;
+
+      /// \internal the nodes in the pool of \c node, or \c nullptr if \c node has no pool
+      std::set<detail::shared_node> const * PoolNodes(Node const & node)
+      {
+         auto holder = NodeAccess::Memory(node);
+         if (!holder)
+            return nullptr;
+         auto const & memory = holder->*Get(HolderMemory());
+         return memory ? &(memory.get()->*Get(MemoryNodes())) : nullptr;
+      }
+#endif
+
+      /** \internal identifies the pool behind \c holder, to find the documents of registries of documents (e.g. that of \ref QueryCache).
+
+         The memory holders of the nodes of a document may differ: a node built separately keeps its holder after it was added
+         to the document, and only the pools behind the holders are merged. The pool is not a stable key either: merging another
+         node's pool into the document (e.g. building the result of \ref Ensure) moves the document to another pool.
+         Registries therefore key documents by the holder of their root, and compare the current pools (see \ref SameDocument).
+         Without \c YAML_PATH_POOL_INTERNALS, the pool is not accessible, and the holder is returned.
+      */
+      void const * DocumentPool(detail::memory_holder const * holder)
+      {
+#if YAML_PATH_POOL_INTERNALS
+         if (holder)
+            return (holder->*Get(HolderMemory())).get();
+#endif
+         return holder;
+      }
+
+      /// \internal estimated memory used by a single node, without its children
+      size_t NodeBytes(detail::node const & node)
+      {
+         // node, node_ref, node_data, and the entry in the pool
+         size_t bytes = sizeof(detail::node) + sizeof(detail::node_ref) + sizeof(detail::node_data) + sizeof(detail::shared_node) + 4 * sizeof(void *);
+         bytes += node.tag().capacity() > 15 ? node.tag().capacity() : 0;    // assuming small string optimization for short strings
+
+         switch (node.type())
+         {
+            case NodeType::Scalar:
+               bytes += node.scalar().capacity() > 15 ? node.scalar().capacity() : 0;
+               break;
+
+            case NodeType::Sequence:
+               bytes += std::distance(node.begin(), node.end()) * sizeof(detail::node *);
+               break;
+
+            case NodeType::Map:
+               bytes += std::distance(node.begin(), node.end()) * 2 * sizeof(detail::node *);
+               break;
+
+            default:
+               break;
+         }
+         return bytes;
+      }
+
+      /// \internal adds \c node and all nodes reachable from it to \c stats.reachable*
+      void CountReachable(detail::node const & node, std::unordered_set<detail::node const *> & visited, NodePoolStats & stats)
+      {
+         if (!visited.insert(&node).second)     // aliases refer to the same node
+            return;
+
+         ++stats.reachableNodes;
+         stats.reachableBytes += NodeBytes(node);
+
+         if (node.type() == NodeType::Sequence)
+         {
+            for (auto && el : node)
+               CountReachable(*el, visited, stats);
+         }
+         else if (node.type() == NodeType::Map)
+         {
+            for (auto && kv : node)
+            {
+               CountReachable(*kv.first, visited, stats);
+               CountReachable(*kv.second, visited, stats);
+            }
+         }
+      }
+   }
+
+   using namespace YamlPathDetail;
+
+   /** Returns statistics of the node pool that holds \c node, see \ref NodePoolStats.
+
+      The pool is shared by all nodes of a document, and - after a node of one document was added to another - by all
+      nodes of both documents. Reachable nodes are counted starting from \c node, so for a pool shared with other 
+      documents or a node that is not the document root, not all unreachable nodes can be reclaimed by \ref Compact.
+
+      Use this to monitor the growth of long-lived documents. Takes time linear in the size of the pool.
+      Like other read accesses through yaml-cpp, this must not run concurrently with modifications of the document.
+   */
+   NodePoolStats PoolStats(Node const & node)
+   {
+      NodePoolStats stats;
+      if (auto impl = NodeAccess::Impl(node); impl && impl->is_defined())
+      {
+         std::unordered_set<detail::node const *> visited;
+         CountReachable(*impl, visited, stats);
+      }
+
+#if YAML_PATH_POOL_INTERNALS
+      if (auto pool = PoolNodes(node))
+      {
+         stats.poolNodes = pool->size();
+         for (auto & el : *pool)
+            stats.poolBytes += NodeBytes(*el);
+      }
+#else
+      stats.poolNodes = stats.reachableNodes;
+      stats.poolBytes = stats.reachableBytes;
+#endif
+      return stats;
+   }
+
+   /** Rebuilds the document \c node into a new pool that contains only the nodes reachable from \c node.
+
+      Returns the estimated number of bytes reclaimed (\ref NodePoolStats::poolBytes before and after).
+      Aliases are preserved. The old pool is released when the last \c Node referring to it is destroyed, so the
+      memory is actually freed only if no other \c Node (including results of \ref Select) refer to the old document.
+      Those continue to see the old document, and changes made through them do not affect \c node.
+
+      \code
+      auto stats = PoolStats(doc);
+      if (stats.UnreachableBytes() > stats.reachableBytes)
+         Compact(doc);
+      \endcode
+   */
+   size_t Compact(Node & node)
+   {
+      if (!NodeAccess::Impl(node) || !node.IsDefined())
+         return 0;
+
+      const size_t before = PoolStats(node).poolBytes;
+      node.reset(Clone(node));
+      const size_t after = PoolStats(node).poolBytes;
+      return before > after ? before - after : 0;
+   }
+}
@@ -0,0 +1,61 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <yaml-cpp/yaml.h>
+
+/** Set to 0 to build against a yaml-cpp version whose node pool (<code>detail::memory_holder</code> and
+    <code>detail::memory</code>) differs from yaml-cpp 0.6 to 0.8. With the default of 1, \ref PoolStats reads the nodes
+    of the pool through private members of these classes, and a version that changed them fails to compile.
+    With 0, \ref NodePoolStats::poolNodes and \ref NodePoolStats::poolBytes count only the reachable nodes, and modifying
+    a document through a node that was built separately and then added to it does not invalidate its \ref QueryCache.
+*/
+#ifndef YAML_PATH_POOL_INTERNALS
+#define YAML_PATH_POOL_INTERNALS 1
+#endif
+
+namespace YAML
+{
+   /** Memory statistics of the yaml-cpp node pool behind a \c Node, see \ref PoolStats.
+
+      yaml-cpp keeps all nodes of a document in a pool that is released only when the last \c Node referring to it is destroyed.
+      Nodes that are removed from the document, or that are added as placeholders by the non-const <code>Node::operator[]</code>
+      for keys that don't exist, remain in the pool. Byte counts are estimates: they include the node structures, scalars, tags 
+      and child lists, but not the allocator overhead. Counting the nodes of the pool requires <code>YAML_PATH_POOL_INTERNALS=1</code>.
+   */
+   struct NodePoolStats
+   {
+      size_t poolNodes = 0;         ///< nodes in the pool
+      size_t poolBytes = 0;         ///< estimated memory used by the nodes in the pool
+      size_t reachableNodes = 0;    ///< nodes reachable from the node passed to \ref PoolStats
+      size_t reachableBytes = 0;    ///< estimated memory used by the reachable nodes
+
+      size_t UnreachableNodes() const { return poolNodes - reachableNodes; }
+      size_t UnreachableBytes() const { return poolBytes - reachableBytes; }
+   };
+
+   NodePoolStats PoolStats(Node const & node);
+   size_t Compact(Node & node);
+}
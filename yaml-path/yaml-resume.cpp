@@ -0,0 +1,206 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-resume.h"
+#include "yaml-path-internals.h"
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      /** \internal state of a \ref PathEvaluation between calls of \c Resume.
+
+         Selectors are applied by \ref ApplySelector, except a key or map filter selector fanning out over many nodes:
+         it is applied item by item, so that it can be interrupted. Other selectors count the nodes they process as visited. \c item is the position in \c nodes.list,
+         or \c it the position in the sequence \c nodes.node; the matches so far are collected in \c ctx.scratch.
+      */
+      struct ResumeState
+      {
+         explicit ResumeState(CompiledPath const & path) : path(path) {}
+
+         CompiledPath       path;
+         EvalNodes          nodes;
+         EvalContext        ctx;
+         size_t             step = 0;         // next selector to apply
+         bool               fanOut = false;   // selector \c step is being applied item by item
+         size_t             item = 0;
+         Node::const_iterator it, end;
+         EPathError         error = EPathError::OK;
+         bool               done = false;
+         std::vector<Node>  result;
+         size_t             nodesVisited = 0;
+         size_t             calls = 0;
+
+         /// checks the budget every \c TimeCheckInterval nodes: reading the clock is more expensive than visiting a node
+         static constexpr size_t TimeCheckInterval = 64;
+
+         void Finish(EPathError err)
+         {
+            error = err;
+            done = true;
+            if (err == EPathError::OK)
+            {
+               if (nodes.isList)
+                  result.swap(nodes.list);
+               else if (nodes.node)
+                  result.push_back(nodes.node);
+            }
+            nodes.node.reset();     // note: assigning would assign to the node of the document
+            nodes.list.clear();
+            nodes.isList = false;
+            ctx.scratch.clear();
+         }
+
+         /// applies the selector \c sel to one item of the fan-out, like \ref ApplyKey and \ref ApplyMapFilter
+         void FanOutItem(SelectorRecord const & sel, Node const & el)
+         {
+            if (!el.IsMap())
+               return;
+
+            Node value;
+            if (sel.selector == ESelector::Key)
+            {
+               if (FindKey(el, std::get<ArgKey>(sel.data).key, value))
+                  ctx.scratch.push_back(value);
+            }
+            else if (ApplyMapFilterToMap(el, std::get<ArgMapFilter>(sel.data), value, ctx) == EPathError::OK)
+               ctx.scratch.push_back(value);
+         }
+      };
+   }
+
+   using namespace YamlPathDetail;
+
+   /// Prepares the evaluation of \c path, starting at \c node. No nodes are visited until \ref Resume is called.
+   PathEvaluation::PathEvaluation(Node const & node, CompiledPath const & path) : m_state(std::make_unique<ResumeState>(path))
+   {
+      m_state->nodes.node.reset(node);
+      m_state->ctx.readOnly = true;
+   }
+
+   PathEvaluation::~PathEvaluation() = default;
+   PathEvaluation::PathEvaluation(PathEvaluation &&) noexcept = default;
+   PathEvaluation & PathEvaluation::operator=(PathEvaluation &&) noexcept = default;
+
+   /** Continues the evaluation until it is done, or \c budget is used up.
+       At least one node is visited by each call, so that the evaluation progresses with any budget.
+   */
+   EPathEvalState PathEvaluation::Resume(PathBudget const & budget)
+   {
+      auto & s = *m_state;
+      if (s.done)
+         return EPathEvalState::Done;
+
+      using Clock = std::chrono::steady_clock;
+      const bool timed = budget.time != std::chrono::nanoseconds::max();
+      const auto deadline = timed ? Clock::now() + budget.time : Clock::time_point::max();
+      size_t visited = 0;
+      auto Exhausted = [&]
+      {
+         if (visited >= budget.nodes)
+            return true;
+         return timed && visited % ResumeState::TimeCheckInterval == 0 && Clock::now() >= deadline;
+      };
+
+      ++s.calls;
+      auto const & selectors = s.path.Selectors().selectors;
+      while (s.step < selectors.size())
+      {
+         auto const & sel = selectors[s.step];
+         auto & nodes = s.nodes;
+         if (!nodes.isList && !nodes.node)
+         {
+            s.Finish(EPathError::NodeNotFound);
+            break;
+         }
+
+         // --- start a fan-out: key and map filter selectors over a list or a sequence
+         if (!s.fanOut && (sel.selector == ESelector::Key || sel.selector == ESelector::MapFilter) && (nodes.isList || nodes.node.IsSequence()))
+         {
+            s.fanOut = true;
+            s.item = 0;
+            if (!nodes.isList)
+            {
+               s.it = static_cast<Node const &>(nodes.node).begin();
+               s.end = static_cast<Node const &>(nodes.node).end();
+            }
+            s.ctx.scratch.clear();
+         }
+
+         if (s.fanOut)
+         {
+            if (nodes.isList)
+            {
+               for (; s.item < nodes.list.size() && (!visited || !Exhausted()); ++s.item, ++visited)
+                  s.FanOutItem(sel, nodes.list[s.item]);
+               if (s.item < nodes.list.size())
+                  break;
+            }
+            else
+            {
+               for (; s.it != s.end && (!visited || !Exhausted()); ++s.it, ++visited)
+                  s.FanOutItem(sel, *s.it);
+               if (s.it != s.end)
+                  break;
+            }
+
+            s.fanOut = false;
+            if (s.ctx.scratch.empty())
+            {
+               s.Finish(EPathError::NodeNotFound);
+               break;
+            }
+            nodes.list.swap(s.ctx.scratch);
+            nodes.isList = true;
+            s.ctx.scratch.clear();
+         }
+         else
+         {
+            // applied at once: counts each node of the list, or each element sorted, and waits for the next call if that exceeds the budget
+            size_t cost = nodes.isList ? nodes.list.size() : sel.selector == ESelector::Sort && nodes.node.IsSequence() ? nodes.node.size() : 1;
+            cost = std::max<size_t>(cost, 1);
+            if (visited && (visited + cost > budget.nodes || (timed && Clock::now() >= deadline)))
+               break;
+            visited += cost;
+            if (auto err = ApplySelector(nodes, sel.selector, sel.data, s.ctx); err != EPathError::OK)
+            {
+               s.Finish(err);
+               break;
+            }
+         }
+         ++s.step;
+      }
+
+      if (!s.done && s.step == selectors.size())
+         s.Finish(EPathError::OK);
+      s.nodesVisited += visited;
+      return s.done ? EPathEvalState::Done : EPathEvalState::Pending;
+   }
+
+   bool PathEvaluation::Done() const                     { return m_state->done; }
+   EPathError PathEvaluation::Error() const              { return m_state->error; }
+   std::vector<Node> const & PathEvaluation::Result() const { return m_state->result; }
+   size_t PathEvaluation::NodesVisited() const           { return m_state->nodesVisited; }
+   size_t PathEvaluation::Calls() const                  { return m_state->calls; }
+}
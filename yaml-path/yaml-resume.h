@@ -0,0 +1,85 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <chrono>
+#include <memory>
+
+namespace YAML
+{
+   namespace YamlPathDetail { struct ResumeState; }
+
+   /// Work allowed for one call of \ref PathEvaluation::Resume. The default is unlimited.
+   struct PathBudget
+   {
+      size_t                   nodes = SIZE_MAX;                            ///< nodes visited
+      std::chrono::nanoseconds time = std::chrono::nanoseconds::max();      ///< elapsed time, checked every few nodes
+   };
+
+   enum class EPathEvalState
+   {
+      Pending,    ///< the budget was used up, call \ref PathEvaluation::Resume again
+      Done,       ///< the result is available
+   };
+
+   /** Evaluates a path in slices of limited work, e.g. to interleave a large query with other work on an event loop.
+
+      Each call of \ref Resume continues where the previous one stopped, until \c budget is used up.
+      A key or map filter fanning out over a sequence may be interrupted between two elements. Other selectors, e.g. \c sort and \c top,
+      are applied at once, and count each node they process as visited: if that exceeds the rest of the budget, the call returns before
+      the selector, and the next call applies it even if it exceeds the whole budget.
+      The result is that of \ref SelectNodes.
+
+      The document must not be modified until the evaluation is done.
+
+      \code
+      PathEvaluation eval(root, CompiledPath("pods.{phase=Pending}.name"));
+      while (eval.Resume({ 1000 }) == EPathEvalState::Pending)
+         RunOtherTasks();
+      for (auto & name : eval.Result())
+         ...
+      \endcode
+   */
+   class PathEvaluation
+   {
+   public:
+      PathEvaluation(Node const & node, CompiledPath const & path);
+      ~PathEvaluation();
+      PathEvaluation(PathEvaluation &&) noexcept;
+      PathEvaluation & operator=(PathEvaluation &&) noexcept;
+
+      EPathEvalState Resume(PathBudget const & budget = {});
+
+      bool Done() const;
+      EPathError Error() const;                    ///< \c EPathError::OK, or the node error that ended the evaluation
+      std::vector<Node> const & Result() const;    ///< the nodes selected, once \ref Done
+      size_t NodesVisited() const;                 ///< total of all calls of \ref Resume
+      size_t Calls() const;                        ///< number of calls of \ref Resume that did some work
+
+   private:
+      std::unique_ptr<YamlPathDetail::ResumeState> m_state;
+   };
+}
@@ -0,0 +1,412 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-stream.h"
+#include "yaml-path-internals.h"
+#include <yaml-cpp/eventhandler.h>
+#include <yaml-cpp/parser.h>
+#include <yaml-cpp/yaml.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      /** \internal builds one document from parser events, like \c YAML::Load.
+          All nodes are created in the memory of the document, so documents built one after another don't share memory.
+      */
+      class DocumentBuilder : public EventHandler
+      {
+      public:
+         /// parses the next document from \c parser into \c doc. Returns false at the end of the stream
+         bool Next(Parser & parser, Node & doc)
+         {
+            m_memory = std::make_shared<detail::memory_holder>();   // the previous document keeps its pool
+            m_root = nullptr;
+            m_stack.clear();     // after a parser error, the previous document may be incomplete
+            m_anchors.clear();
+            if (!parser.HandleNextDocument(*this))
+               return false;
+
+            doc.reset(m_root ? NodeAccess::Make(*m_root, m_memory) : Node(NodeType::Null));
+            return true;
+         }
+
+         void OnDocumentStart(const Mark &) override {}
+         void OnDocumentEnd() override {}
+
+         void OnNull(const Mark & mark, anchor_t anchor) override
+         {
+            auto & node = Create(mark, anchor);
+            node.set_null();
+            Add(node);
+         }
+
+         void OnAlias(const Mark &, anchor_t anchor) override
+         {
+            Add(*m_anchors[anchor]);
+         }
+
+         void OnScalar(const Mark & mark, const std::string & tag, anchor_t anchor, const std::string & value) override
+         {
+            auto & node = Create(mark, anchor);
+            node.set_scalar(value);
+            node.set_tag(tag);
+            Add(node);
+         }
+
+         void OnSequenceStart(const Mark & mark, const std::string & tag, anchor_t anchor, EmitterStyle::value style) override
+         {
+            Push(mark, tag, anchor, style, NodeType::Sequence);
+         }
+
+         void OnMapStart(const Mark & mark, const std::string & tag, anchor_t anchor, EmitterStyle::value style) override
+         {
+            Push(mark, tag, anchor, style, NodeType::Map);
+         }
+
+         void OnSequenceEnd() override { Pop(); }
+         void OnMapEnd() override { Pop(); }
+
+      private:
+         struct Frame
+         {
+            detail::node * node;
+            detail::node * key;     // for a map: the key waiting for its value
+         };
+
+         detail::shared_memory_holder  m_memory;   // pool of the document being built. Not used after Next returned the document
+         detail::node *                m_root = nullptr;
+         std::vector<Frame>            m_stack;
+         std::vector<detail::node *>   m_anchors;  // by anchor_t (starting at 1)
+
+         /// creates a node at \c mark, like \c NodeBuilder, so \c Node::Mark reports its position in the stream
+         detail::node & Create(const Mark & mark, anchor_t anchor)
+         {
+            auto & node = m_memory->create_node();
+            node.set_mark(mark);
+            if (anchor != NullAnchor)
+            {
+               if (m_anchors.size() <= anchor)
+                  m_anchors.resize(anchor + 1);
+               m_anchors[anchor] = &node;
+            }
+            return node;
+         }
+
+         void Push(const Mark & mark, const std::string & tag, anchor_t anchor, EmitterStyle::value style, NodeType::value type)
+         {
+            auto & node = Create(mark, anchor);
+            node.set_type(type);
+            node.set_tag(tag);
+            node.set_style(style);
+            m_stack.push_back({ &node, nullptr });
+         }
+
+         void Pop()
+         {
+            auto & node = *m_stack.back().node;
+            m_stack.pop_back();
+            Add(node);
+         }
+
+         /// adds a completed node to the container being built
+         void Add(detail::node & node)
+         {
+            if (m_stack.empty())
+            {
+               m_root = &node;
+               return;
+            }
+
+            auto & frame = m_stack.back();
+            if (frame.node->type() == NodeType::Sequence)
+               frame.node->push_back(node, m_memory);
+            else if (!frame.key)
+               frame.key = &node;
+            else
+            {
+               frame.node->insert(*frame.key, node, m_memory);
+               frame.key = nullptr;
+            }
+         }
+      };
+
+      /// \internal read-only stream over a buffer, without copying it
+      class ViewStreamBuf : public std::streambuf
+      {
+      public:
+         explicit ViewStreamBuf(std::string_view text)
+         {
+            char * p = const_cast<char *>(text.data());
+            setg(p, p, p + text.size());
+         }
+      };
+
+      /** \internal task queues of a work-stealing pool: each worker takes tasks from the front of its own queue,
+          and when that is empty, steals from the back of the queue of another worker.
+      */
+      class WorkStealingQueues
+      {
+      public:
+         /// distributes tasks [0, count) round robin, so that workers start with the first tasks
+         WorkStealingQueues(size_t workers, size_t count) : m_queues(workers)
+         {
+            for (size_t i = 0; i < count; ++i)
+               m_queues[i % workers].tasks.push_back(i);
+         }
+
+         bool Next(size_t worker, size_t & task)
+         {
+            {
+               auto & own = m_queues[worker];
+               std::lock_guard<std::mutex> lock(own.lock);
+               if (!own.tasks.empty())
+               {
+                  task = own.tasks.front();
+                  own.tasks.pop_front();
+                  return true;
+               }
+            }
+
+            for (size_t i = 1; i < m_queues.size(); ++i)
+            {
+               auto & victim = m_queues[(worker + i) % m_queues.size()];
+               std::lock_guard<std::mutex> lock(victim.lock);
+               if (!victim.tasks.empty())
+               {
+                  task = victim.tasks.back();
+                  victim.tasks.pop_back();
+                  return true;
+               }
+            }
+            return false;
+         }
+
+      private:
+         struct Queue
+         {
+            std::mutex lock;
+            std::deque<size_t> tasks;
+         };
+         std::vector<Queue> m_queues;
+      };
+
+      /// \internal state of a \ref SelectBatch worker thread, reused for all sources the worker processes
+      struct BatchWorker
+      {
+         DocumentBuilder builder;
+         EvalContext     ctx;
+
+         BatchWorker() { ctx.readOnly = true; }
+
+         void Process(BatchSource const & source, std::vector<CompiledPath> const & paths, BatchSourceResult & result)
+         {
+            try
+            {
+               ViewStreamBuf buffer(source.text);
+               std::istream bufferStream(&buffer);
+               std::ifstream fileStream;
+               if (source.isFile)
+               {
+                  fileStream.open(source.name, std::ios::binary);
+                  if (!fileStream)
+                  {
+                     result.error = "cannot open file";
+                     return;
+                  }
+               }
+
+               Parser parser(source.isFile ? static_cast<std::istream &>(fileStream) : bufferStream);
+               for (Node doc; builder.Next(parser, doc); doc.reset(), ++result.documents)
+               {
+                  for (size_t p = 0; p < paths.size(); ++p)
+                  {
+                     auto nodes = SelectNodes(doc, paths[p], ctx);
+                     if (!nodes.empty())
+                        result.matches.push_back({ result.documents, p, std::move(nodes) });
+                  }
+               }
+            }
+            catch (std::exception const & e)
+            {
+               result.error = e.what();
+            }
+         }
+      };
+   }
+
+   using namespace YamlPathDetail;
+
+   /** Calls \c handler for each document in \c input, parsing one document at a time.
+       Each document is released after \c handler returns, unless \c handler keeps a reference to it.
+       Returns the number of documents read. Throws \c YAML::ParserException if \c input is malformed.
+   */
+   size_t ForEachDocument(std::istream & input, std::function<void(size_t document, Node const & doc)> const & handler)
+   {
+      Parser parser(input);
+      DocumentBuilder builder;
+      size_t count = 0;
+      for (Node doc; builder.Next(parser, doc); doc.reset())
+         handler(count++, doc);
+      return count;
+   }
+
+   /** Evaluates \c path on each document of a multi-document stream (documents separated by \c ---), and calls \c handler
+      with the nodes matched in each document (see \ref SelectNodes). Documents without matches are skipped.
+
+      Unlike \c YAML::LoadAll, documents are parsed one at a time, and each document is released after \c handler returns.
+      Memory use is bounded by the largest document, plus the matches \c handler keeps.
+
+      \c handler receives the index of the document in the stream. Returns the number of documents read.
+      Throws \c YAML::ParserException if \c input is malformed.
+
+      \code
+      std::ifstream log("events.yaml");
+      SelectEachDocument(log, "{level=error}.message", [&](size_t doc, std::vector<Node> const & matches)
+      {
+         for (auto & m : matches)
+            errors.push_back(m.Scalar());
+      });
+      \endcode
+   */
+   size_t SelectEachDocument(std::istream & input, CompiledPath const & path, DocumentMatchHandler const & handler)
+   {
+      return ForEachDocument(input, [&](size_t index, Node const & doc)
+      {
+         auto matches = SelectNodes(doc, path);
+         if (!matches.empty())
+            handler(index, matches);
+      });
+   }
+
+   /// \copydoc SelectEachDocument(std::istream &, CompiledPath const &, DocumentMatchHandler const &)
+   size_t SelectEachDocument(std::istream & input, PathArg path, DocumentMatchHandler const & handler)
+   {
+      return SelectEachDocument(input, CompiledPath(path), handler);
+   }
+
+   /** Evaluates \c paths on all documents of many files or buffers, using a pool of worker threads.
+
+      Sources are parsed and evaluated in parallel, one source per task. Workers that run out of sources take
+      sources queued for other workers, so a few large files don't leave the other workers idle.
+      Each worker reuses its parser state and evaluation scratch space for all sources it processes.
+      Each document is built in its own node pool, which the worker does not touch after evaluating the paths, so the nodes
+      passed to \c handler don't share memory with other documents or with the worker.
+
+      \c handler is called on the calling thread, once for each source (including sources without matches).
+      With <code>options.ordered</code> (the default), results are delivered in the order of \c sources,
+      independent of the number of threads. Otherwise, they are delivered in the order sources complete,
+      identified by \ref BatchSourceResult::source.
+
+      Errors reading or parsing a source are reported in \ref BatchSourceResult::error; they don't stop the batch.
+      If \c handler throws, the remaining sources are skipped, and the exception is rethrown after all workers ended.
+
+      \code
+      std::vector<CompiledPath> paths = { CompiledPath("metadata.name"), CompiledPath("spec.replicas") };
+      SelectBatch(sources, paths, [&](BatchSourceResult & r)
+      {
+         for (auto & m : r.matches)
+            Report(sources[r.source].name, m.document, paths[m.path].Path(), m.nodes);
+      });
+      \endcode
+   */
+   void SelectBatch(std::vector<BatchSource> const & sources, std::vector<CompiledPath> const & paths, BatchHandler const & handler, BatchOptions const & options)
+   {
+      if (sources.empty())
+         return;
+
+      size_t threadCount = options.threads ? options.threads : std::max<size_t>(1, std::thread::hardware_concurrency());
+      threadCount = std::min(threadCount, sources.size());
+
+      WorkStealingQueues queues(threadCount, sources.size());
+      std::vector<std::unique_ptr<BatchSourceResult>> results(sources.size());
+      std::vector<size_t> completed;      // for unordered delivery: sources in the order they completed
+      std::mutex lock;
+      std::condition_variable ready;
+      std::atomic<bool> stop { false };
+
+      auto Work = [&](size_t worker)
+      {
+         BatchWorker state;
+         size_t task;
+         while (!stop && queues.Next(worker, task))
+         {
+            auto result = std::make_unique<BatchSourceResult>();
+            result->source = task;
+            state.Process(sources[task], paths, *result);
+
+            std::lock_guard<std::mutex> guard(lock);
+            results[task] = std::move(result);
+            if (!options.ordered)
+               completed.push_back(task);
+            ready.notify_one();
+         }
+      };
+
+      std::vector<std::thread> threads;
+      for (size_t t = 0; t < threadCount; ++t)
+         threads.emplace_back(Work, t);
+
+      std::exception_ptr handlerError;
+      try
+      {
+         for (size_t delivered = 0; delivered < sources.size(); ++delivered)
+         {
+            std::unique_ptr<BatchSourceResult> result;
+            {
+               std::unique_lock<std::mutex> guard(lock);
+               if (options.ordered)
+               {
+                  ready.wait(guard, [&] { return results[delivered] != nullptr; });
+                  result = std::move(results[delivered]);
+               }
+               else
+               {
+                  ready.wait(guard, [&] { return completed.size() > delivered; });
+                  result = std::move(results[completed[delivered]]);
+               }
+            }
+            handler(*result);
+         }
+      }
+      catch (...)
+      {
+         handlerError = std::current_exception();
+         stop = true;
+      }
+
+      for (auto & t : threads)
+         t.join();
+
+      if (handlerError)
+         std::rethrow_exception(handlerError);
+   }
+}
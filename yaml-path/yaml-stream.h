@@ -0,0 +1,78 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <functional>
+#include <iosfwd>
+#include <string>
+
+namespace YAML
+{
+   /// receives the nodes matched in one document of a stream, see \ref SelectEachDocument
+   using DocumentMatchHandler = std::function<void(size_t document, std::vector<Node> const & matches)>;
+
+   size_t SelectEachDocument(std::istream & input, CompiledPath const & path, DocumentMatchHandler const & handler);
+   size_t SelectEachDocument(std::istream & input, PathArg path, DocumentMatchHandler const & handler);
+   size_t ForEachDocument(std::istream & input, std::function<void(size_t document, Node const & doc)> const & handler);
+
+   /// a YAML file or in-memory buffer, see \ref SelectBatch
+   struct BatchSource
+   {
+      std::string       name;             ///< file name, or a name identifying the buffer
+      std::string_view  text;             ///< the buffer. Must remain valid until \ref SelectBatch returns
+      bool              isFile = false;   ///< if true, \c name is read from disk, and \c text is ignored
+
+      static BatchSource File(std::string path) { return { std::move(path), {}, true }; }
+      static BatchSource Buffer(std::string name, std::string_view text) { return { std::move(name), text, false }; }
+   };
+
+   /// nodes matched by one path in one document, see \ref BatchSourceResult
+   struct BatchMatches
+   {
+      size_t document = 0;       ///< index of the document in the source
+      size_t path = 0;           ///< index of the path in the list passed to \ref SelectBatch
+      std::vector<Node> nodes;
+   };
+
+   /// all matches in one source, passed to the handler of \ref SelectBatch
+   struct BatchSourceResult
+   {
+      size_t source = 0;                  ///< index of the source in the list passed to \ref SelectBatch
+      size_t documents = 0;               ///< number of documents read
+      std::vector<BatchMatches> matches;  ///< ordered by document, then path. Only paths with matches are included
+      std::string error;                  ///< if not empty: the file could not be read or parsed. \c matches contains the documents before the error
+   };
+
+   using BatchHandler = std::function<void(BatchSourceResult & result)>;
+
+   struct BatchOptions
+   {
+      size_t threads = 0;     ///< number of worker threads. 0: one per hardware thread
+      bool   ordered = true;  ///< deliver results in the order of the sources. If false, results are delivered as soon as a source is completed
+   };
+
+   void SelectBatch(std::vector<BatchSource> const & sources, std::vector<CompiledPath> const & paths, BatchHandler const & handler, BatchOptions const & options = {});
+}
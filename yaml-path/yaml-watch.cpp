@@ -0,0 +1,401 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "yaml-watch.h"
+#include "yaml-path-internals.h"
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+
+namespace YAML
+{
+   namespace YamlPathDetail
+   {
+      /** \internal \ref PathSubscriptions by the memory holder of their root. Other nodes of the document may have another
+          holder, see \ref SameDocument. The lock only protects the registry: subscriptions are evaluated, and handlers are called, without it.
+      */
+      struct WatchRegistry
+      {
+         std::mutex lock;
+         std::unordered_multimap<detail::memory_holder const *, PathSubscriptions *> documents;
+         std::atomic<size_t> count { 0 };    // size of documents, checked without locking
+      };
+
+      WatchRegistry & Watches()
+      {
+         static WatchRegistry * registry = new WatchRegistry;    // not destroyed, like the registry of QueryCache generations
+         return *registry;
+      }
+
+      /** \internal false if modifying the nodes selected by \c edited cannot change which nodes \c watched selects.
+          Both paths are evaluated from the same node. While their selectors are equal, they select the same nodes;
+          the first key or index that differs selects disjoint subtrees. Any other difference may overlap.
+      */
+      bool MayOverlap(SelectorList const & watched, SelectorList const & edited)
+      {
+         const size_t count = std::min(watched.size(), edited.size());
+         for (size_t i = 0; i < count; ++i)
+         {
+            auto & w = watched[i];
+            auto & e = edited[i];
+            if (w.selector != e.selector)
+               return true;
+
+            switch (w.selector)
+            {
+               case ESelector::Key:
+                  if (std::get<ArgKey>(w.data).key != std::get<ArgKey>(e.data).key)
+                     return false;
+                  break;
+
+               case ESelector::Index:
+               {
+                  // Ensure pads a sequence with null elements up to the index, so only elements after it are not affected
+                  size_t wi = std::get<ArgIndex>(w.data).index;
+                  size_t ei = std::get<ArgIndex>(e.data).index;
+                  if (wi > ei)
+                     return false;
+                  if (wi != ei)
+                     return true;
+                  break;
+               }
+
+               default:
+                  return true;
+            }
+         }
+         return true;
+      }
+
+      /** \internal the number of selectors of \c selectors that select the sequence a subscription is evaluated on element by element:
+          the keys and indices before a map filter that is followed only by keys and map filters. \c SIZE_MAX if there is none.
+          Each of these selectors selects from each element of the sequence independently.
+      */
+      size_t SequenceStep(SelectorList const & selectors)
+      {
+         size_t step = 0;
+         while (step < selectors.size() && (selectors[step].selector == ESelector::Key || selectors[step].selector == ESelector::Index))
+            ++step;
+         if (step == selectors.size() || selectors[step].selector != ESelector::MapFilter)
+            return SIZE_MAX;
+
+         for (size_t i = step; i < selectors.size(); ++i)
+         {
+            auto & sel = selectors[i];
+            if (sel.selector == ESelector::Key)
+               continue;
+            if (sel.selector != ESelector::MapFilter)
+               return SIZE_MAX;
+            for (auto & kvp : std::get<ArgMapFilter>(sel.data))
+               if (kvp.op == EKVOp::Select)
+                  return SIZE_MAX;
+         }
+         return step;
+      }
+
+      /// \internal applies selectors \c first to \c last of \c selectors, like \ref EvalSelectors
+      EPathError EvalSelectorRange(EvalNodes & nodes, SelectorList const & selectors, size_t first, size_t last, EvalContext & ctx)
+      {
+         for (size_t i = first; i < last; ++i)
+         {
+            if (!nodes.isList && !nodes.node)
+               return EPathError::NodeNotFound;
+            if (auto err = ApplySelector(nodes, selectors[i].selector, selectors[i].data, ctx); err != EPathError::OK)
+               return err;
+         }
+         return EPathError::OK;
+      }
+
+      /// \internal access to the internals of \ref PathSubscriptions
+      struct WatchAccess
+      {
+         static void Attach(PathSubscriptions & subs)
+         {
+            auto & r = Watches();
+            std::lock_guard<std::mutex> lock(r.lock);
+            r.documents.emplace(NodeAccess::Memory(subs.m_root), &subs);
+            r.count = r.documents.size();
+         }
+
+         static void Detach(PathSubscriptions & subs)
+         {
+            auto & r = Watches();
+            std::lock_guard<std::mutex> lock(r.lock);
+            auto range = r.documents.equal_range(NodeAccess::Memory(subs.m_root));
+            for (auto it = range.first; it != range.second; ++it)
+               if (it->second == &subs)
+               {
+                  r.documents.erase(it);
+                  break;
+               }
+            r.count = r.documents.size();
+         }
+
+         /// selects the sequence \c sub is evaluated on element by element into \c sequence. Returns false if there is none
+         static bool SelectSequence(PathSubscriptions const & subs, PathSubscriptions::Subscription const & sub, Node & sequence, EvalContext & ctx)
+         {
+            if (sub.sequenceStep == SIZE_MAX)
+               return false;
+            EvalNodes nodes{ subs.m_root };
+            if (EvalSelectorRange(nodes, sub.path.Selectors().selectors, 0, sub.sequenceStep, ctx) != EPathError::OK || nodes.isList || !nodes.node.IsSequence())
+               return false;
+            sequence.reset(nodes.node);
+            return true;
+         }
+
+         /// appends the nodes \c sub selects from \c element, the element at \c index of its sequence, to \c nodes and \c elements
+         static void SelectElement(PathSubscriptions::Subscription const & sub, Node const & element, size_t index, std::vector<Node> & nodes, std::vector<size_t> & elements, EvalContext & ctx)
+         {
+            auto & selectors = sub.path.Selectors().selectors;
+            EvalNodes el{ Node(), { element }, true };
+            if (EvalSelectorRange(el, selectors, sub.sequenceStep, selectors.size(), ctx) != EPathError::OK)
+               return;
+            for (auto & n : el.list)
+            {
+               nodes.push_back(n);
+               elements.push_back(index);
+            }
+         }
+
+         /// evaluates the path of \c sub into \c nodes, element by element if possible
+         static void Evaluate(PathSubscriptions const & subs, PathSubscriptions::Subscription & sub, std::vector<Node> & nodes)
+         {
+            EvalContext ctx;
+            ctx.readOnly = true;
+            sub.elements.clear();
+            Node sequence;
+            if (!SelectSequence(subs, sub, sequence, ctx))
+            {
+               sub.sequence = nullptr;
+               nodes = SelectNodes(subs.m_root, sub.path);
+               return;
+            }
+
+            sub.sequence = NodeAccess::Impl(sequence);
+
+            size_t index = 0;
+            for (auto && element : sequence)
+               SelectElement(sub, element, index++, nodes, sub.elements, ctx);
+         }
+
+         /** evaluates only element \c index of the sequence of \c sub into \c nodes, keeping the nodes selected from the other elements.
+             Returns false if the subscription has to be evaluated entirely.
+         */
+         static bool EvaluateElement(PathSubscriptions const & subs, PathSubscriptions::Subscription & sub, size_t index, std::vector<Node> & nodes)
+         {
+            EvalContext ctx;
+            ctx.readOnly = true;
+            Node sequence;
+            if (!sub.sequence || !SelectSequence(subs, sub, sequence, ctx) || NodeAccess::Impl(sequence) != sub.sequence || index >= sequence.size())
+               return false;
+
+            // the nodes of the element replace those selected from it before. Nodes are copy-constructed: assigning a Node assigns its value
+            auto first = std::lower_bound(sub.elements.begin(), sub.elements.end(), index) - sub.elements.begin();
+            auto last = std::upper_bound(sub.elements.begin(), sub.elements.end(), index) - sub.elements.begin();
+            std::vector<size_t> elements(sub.elements.begin(), sub.elements.begin() + first);
+            nodes.reserve(sub.nodes.size());
+            nodes.insert(nodes.end(), sub.nodes.begin(), sub.nodes.begin() + first);
+            SelectElement(sub, std::as_const(sequence)[index], index, nodes, elements, ctx);
+            nodes.insert(nodes.end(), sub.nodes.begin() + last, sub.nodes.end());
+            elements.insert(elements.end(), sub.elements.begin() + last, sub.elements.end());
+            sub.elements.swap(elements);
+            return true;
+         }
+
+         /** updates the subscriptions that may be affected by modifying the nodes selected by \c path from \c node.
+             A subscription evaluated element by element only evaluates the element \c path modified.
+             The handlers are called after all subscriptions were updated.
+         */
+         static void OnMutation(PathSubscriptions & subs, Node const & node, PathArg path, PathBoundArgs args)
+         {
+            // a path from another node of the document can affect any subscription
+            SelectorList edited;
+            bool fromRoot = NodeAccess::Impl(node) == NodeAccess::Impl(subs.m_root) && ScanSelectors(edited, path, args) == EPathError::OK;
+
+            std::vector<std::pair<size_t, size_t>> affected;    // id and modified element. Handlers may unsubscribe
+            for (auto & [id, sub] : subs.m_subscriptions)
+            {
+               auto & watched = sub.path.Selectors().selectors;
+               if (fromRoot && !MayOverlap(watched, edited))
+                  continue;
+
+               size_t element = SIZE_MAX;
+               const size_t step = sub.sequenceStep;
+               if (fromRoot && sub.sequence && step < edited.size() && edited[step].selector == ESelector::Index &&
+                   std::equal(watched.begin(), watched.begin() + step, edited.begin(), IsSameSelector))
+                  element = std::get<ArgIndex>(edited[step].data).index;
+               affected.emplace_back(id, element);
+            }
+
+            std::vector<PathChange> changes;
+            for (auto [id, element] : affected)
+               subs.Update(id, element, changes);
+            subs.Report(changes);
+         }
+      };
+
+      /// \internal called after \ref Ensure modified a document. Costs one atomic load if no document has \ref PathSubscriptions
+      void NotifyMutation(Node const & node, PathArg path, PathBoundArgs args)
+      {
+         auto & r = Watches();
+         if (!r.count.load(std::memory_order_relaxed))
+            return;
+
+         std::vector<PathSubscriptions *> watchers;
+         {
+            std::lock_guard<std::mutex> lock(r.lock);
+            auto holder = NodeAccess::Memory(node);
+            for (auto & [root, subs] : r.documents)
+               if (SameDocument(root, holder))
+                  watchers.push_back(subs);
+         }
+
+         // the lock is not held: handlers may modify the document, or wait for threads modifying other documents
+         for (auto subs : watchers)
+            WatchAccess::OnMutation(*subs, node, path, args);
+      }
+   }
+
+   using namespace YamlPathDetail;
+
+   PathSubscriptions::PathSubscriptions(Node const & root) : m_root(root)
+   {
+      WatchAccess::Attach(*this);
+   }
+
+   PathSubscriptions::~PathSubscriptions()
+   {
+      WatchAccess::Detach(*this);
+   }
+
+   /** Evaluates \c path, and calls \c handler whenever nodes start or stop matching it.
+       Returns the id of the subscription, for \ref Current and \ref Unsubscribe.
+       Throws a \ref PathException with \c EPathError::SelectorNotSupported if \c path contains a map filter selecting keys.
+   */
+   size_t PathSubscriptions::Subscribe(CompiledPath const & path, PathChangeHandler handler)
+   {
+      for (auto & sel : path.Selectors().selectors)
+      {
+         if (sel.selector != ESelector::MapFilter)
+            continue;
+         for (auto & kvp : std::get<ArgMapFilter>(sel.data))
+            if (kvp.op == EKVOp::Select && !kvp.key.IsAllStar())
+            {
+               PathErrorInfo info;
+               info.error = EPathError::SelectorNotSupported;
+               throw PathException(info, path.Path());
+            }
+      }
+
+      const size_t id = m_nextId++;
+      auto & sub = m_subscriptions.emplace(id, Subscription{ path, std::move(handler), {} }).first->second;
+      sub.sequenceStep = SequenceStep(sub.path.Selectors().selectors);
+      WatchAccess::Evaluate(*this, sub, sub.nodes);
+      ++m_evaluations;
+      return id;
+   }
+
+   void PathSubscriptions::Unsubscribe(size_t id)
+   {
+      m_subscriptions.erase(id);
+   }
+
+   /// Returns the nodes currently matched by subscription \c id. The reference is valid until the document is modified.
+   std::vector<Node> const & PathSubscriptions::Current(size_t id) const
+   {
+      static const std::vector<Node> none;
+      auto it = m_subscriptions.find(id);
+      return it != m_subscriptions.end() ? it->second.nodes : none;
+   }
+
+   /// Evaluates all subscriptions again, and reports changes. Call after modifying the document other than through \ref Ensure.
+   void PathSubscriptions::Refresh()
+   {
+      std::vector<size_t> ids;
+      for (auto & [id, sub] : m_subscriptions)
+         ids.push_back(id);
+      std::vector<PathChange> changes;
+      for (auto id : ids)
+         Update(id, SIZE_MAX, changes);
+      Report(changes);
+   }
+
+   /** Evaluates the subscriptions that may be affected by modifying the nodes \c path selects from the root, and reports changes.
+       Call after assigning to a node returned by \ref Ensure, or modifying these nodes other than through \c Ensure.
+       Like \c Ensure, if \c path selects an element of a sequence, subscriptions filtering that sequence evaluate only the element.
+   */
+   void PathSubscriptions::Refresh(PathArg path, PathBoundArgs args)
+   {
+      WatchAccess::OnMutation(*this, m_root, path, args);
+   }
+
+   /// \internal evaluates subscription \c id (only the modified \c element of its sequence, if possible), and adds the change to \c changes if the nodes matched changed
+   void PathSubscriptions::Update(size_t id, size_t element, std::vector<PathChange> & changes)
+   {
+      auto it = m_subscriptions.find(id);
+      if (it == m_subscriptions.end())
+         return;
+
+      auto & sub = it->second;
+      std::vector<Node> nodes;
+      if (element != SIZE_MAX && WatchAccess::EvaluateElement(*this, sub, element, nodes))
+         ++m_elementEvaluations;
+      else
+         WatchAccess::Evaluate(*this, sub, nodes);
+      ++m_evaluations;
+
+      std::unordered_set<detail::node const *> before, after;
+      for (auto & n : sub.nodes)
+         before.insert(NodeAccess::Impl(n));
+      for (auto & n : nodes)
+         after.insert(NodeAccess::Impl(n));
+
+      PathChange change;
+      change.subscription = id;
+      for (auto & n : nodes)
+         if (!before.count(NodeAccess::Impl(n)))
+            change.added.push_back(n);
+      for (auto & n : sub.nodes)
+         if (!after.count(NodeAccess::Impl(n)))
+            change.removed.push_back(n);
+
+      sub.nodes.swap(nodes);
+      if (change.added.size() || change.removed.size())
+         changes.push_back(std::move(change));
+   }
+
+   /// \internal calls the handlers of \c changes. Subscriptions removed by a handler called before are skipped
+   void PathSubscriptions::Report(std::vector<PathChange> const & changes)
+   {
+      for (auto & change : changes)
+      {
+         auto it = m_subscriptions.find(change.subscription);
+         if (it == m_subscriptions.end() || !it->second.handler)
+            continue;
+         auto handler = it->second.handler;      // the handler may unsubscribe
+         handler(change);
+      }
+   }
+}
@@ -0,0 +1,125 @@
+/*
+MIT License
+
+Copyright(c) 2019 Peter Hauptmann
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files(the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions :
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "yaml-path.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace YAML
+{
+   namespace YamlPathDetail { struct WatchAccess; }
+
+   /// Nodes that started or stopped matching the path of a subscription, see \ref PathSubscriptions
+   struct PathChange
+   {
+      size_t            subscription = 0;   ///< id returned by \ref PathSubscriptions::Subscribe
+      std::vector<Node> added;              ///< nodes matched now, but not before, in document order
+      std::vector<Node> removed;            ///< nodes matched before, but not now
+   };
+
+   using PathChangeHandler = std::function<void(PathChange const & change)>;
+
+   /** Keeps the results of paths over a document up to date, and reports nodes that start or stop matching.
+
+      \ref Subscribe evaluates a path, and \ref Current returns its result.
+      When the document is modified through \ref Ensure, \ref EnsureExists or \ref EnsureBatch, only the subscriptions
+      whose path can reach the modified nodes are evaluated again. E.g. after <code>Ensure(root, "services.[3].name")</code>,
+      a subscription to \c "services.{name=web}" is updated, but one to \c "settings.port" is not.
+      If the result changed, the handler of the subscription is called with the nodes added and removed.
+
+      A subscription whose path filters the elements of a sequence, followed only by keys and map filters
+      (e.g. \c "services.{enabled=true}.name"), is evaluated element by element. A modification of one element
+      (e.g. <code>Ensure(root, "services.[3].enabled")</code>) evaluates only that element again, not the whole sequence.
+
+      Nodes are compared by identity (see \c Node::is): a new value assigned to a node that still matches is not reported.
+      The subscriptions are updated while \ref Ensure runs, so a value assigned to a node it returns is not seen:
+      after <code>Ensure(root, "services.[3].enabled")[0] = true</code>, a subscription to \c "services.{enabled=true}" is
+      not updated. After assigning to the result of \c Ensure, or modifying the document directly (e.g. through
+      <code>Node::operator=</code>), call \ref Refresh with the path of the modified nodes, or without a path to evaluate all subscriptions.
+
+      Paths must not contain map filters selecting keys (e.g. \c "{a,b}"), which create new nodes for each evaluation.
+
+      A \c PathSubscriptions object is used by the thread that modifies the document. Handlers may modify the document
+      and call \ref Unsubscribe, but must not create or destroy \c PathSubscriptions objects for the same document.
+      Handlers are called after all affected subscriptions were updated, and without holding a lock: they may wait for
+      other threads that modify other documents.
+
+      \code
+      PathSubscriptions subs(config);
+      subs.Subscribe(CompiledPath("services.{enabled=true}"), [](PathChange const & change)
+      {
+         for (auto & service : change.added)
+            Start(service);
+      });
+      Ensure(config, "services.[%].{name=web,enabled=true}", { 5 });    // calls the handler with the new service
+
+      Ensure(config, "services.[2].enabled")[0] = true;
+      subs.Refresh("services.[2]");                                     // evaluates only services[2]
+      \endcode
+   */
+   class PathSubscriptions
+   {
+   public:
+      explicit PathSubscriptions(Node const & root);
+      ~PathSubscriptions();
+      PathSubscriptions(PathSubscriptions const &) = delete;
+      PathSubscriptions & operator=(PathSubscriptions const &) = delete;
+
+      size_t Subscribe(CompiledPath const & path, PathChangeHandler handler);
+      void Unsubscribe(size_t id);
+      std::vector<Node> const & Current(size_t id) const;
+      void Refresh();
+      void Refresh(PathArg path, PathBoundArgs args = {});
+
+      size_t Size() const                 { return m_subscriptions.size(); }
+      size_t Evaluations() const          { return m_evaluations; }          ///< number of path evaluations, including the initial one of each subscription
+      size_t ElementEvaluations() const   { return m_elementEvaluations; }   ///< evaluations (included in \ref Evaluations) of a single element of a sequence
+
+   private:
+      friend struct YamlPathDetail::WatchAccess;
+
+      struct Subscription
+      {
+         CompiledPath         path;
+         PathChangeHandler    handler;
+         std::vector<Node>    nodes;
+         size_t               sequenceStep = SIZE_MAX;   // number of selectors selecting the sequence evaluated element by element
+         detail::node const * sequence = nullptr;       // if set, the nodes were selected element by element from this sequence
+         std::vector<size_t>  elements;                 // if sequence is set: the element each node was selected from
+      };
+
+      Node                             m_root;
+      std::map<size_t, Subscription>   m_subscriptions;
+      size_t                           m_nextId = 1;
+      size_t                           m_evaluations = 0;
+      size_t                           m_elementEvaluations = 0;
+
+      void Update(size_t id, size_t element, std::vector<PathChange> & changes);
+      void Report(std::vector<PathChange> const & changes);
+   };
+}